@@ -0,0 +1,86 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#include "BulkDataDeduplicator.h"
+#include "PackageOutputSink.h"
+#include "ZenTools.h"
+
+bool FBulkDataDeduplicator::RegisterFile( const FString& RelativeFilename, const FIoChunkHash& ChunkHash, const FContentSource& Source, FString& OutLinkTarget )
+{
+	// Containers built without the chunk hashes cannot be deduplicated
+	if ( ChunkHash == FIoChunkHash() )
+	{
+		return true;
+	}
+	const FContentKey ContentKey( ChunkHash, Source.Size );
+
+	FScopeLock ScopeLock( &DeduplicationCriticalSection );
+
+	// Files are written again when they are overridden by a patch container. If the content has changed, the file is no longer a valid target or link for the previous content
+	if ( const FContentKey* PreviousContentKey = FileContents.Find( RelativeFilename ) )
+	{
+		if ( *PreviousContentKey != ContentKey )
+		{
+			FDeduplicatedContent& PreviousContent = DeduplicatedContents.FindChecked( *PreviousContentKey );
+			if ( PreviousContent.TargetFilename == RelativeFilename )
+			{
+				PreviousContent.TargetFilename.Reset();
+			}
+			PreviousContent.LinkFilenames.Remove( RelativeFilename );
+			FileContents.Remove( RelativeFilename );
+		}
+	}
+
+	FDeduplicatedContent& Content = DeduplicatedContents.FindOrAdd( ContentKey );
+	FileContents.Add( RelativeFilename, ContentKey );
+
+	if ( Content.TargetFilename.IsEmpty() || Content.TargetFilename == RelativeFilename )
+	{
+		Content.TargetFilename = RelativeFilename;
+		Content.Source = Source;
+		return true;
+	}
+
+	if ( !Content.LinkFilenames.Contains( RelativeFilename ) )
+	{
+		Content.LinkFilenames.Add( RelativeFilename );
+		NumBytesDeduplicated += Source.Size;
+	}
+	OutLinkTarget = Content.TargetFilename;
+	return false;
+}
+
+void FBulkDataDeduplicator::CreateLinks( IPackageOutputSink& OutputSink, TFunctionRef<void( const FString& RelativeFilename, const FContentSource& Source )> WriteContent )
+{
+	FScopeLock ScopeLock( &DeduplicationCriticalSection );
+
+	for ( TPair<FContentKey, FDeduplicatedContent>& ContentPair : DeduplicatedContents )
+	{
+		FDeduplicatedContent& Content = ContentPair.Value;
+		if ( Content.LinkFilenames.IsEmpty() )
+		{
+			continue;
+		}
+
+		// File the content has been written into has been overwritten, so one of the links has to be written as a regular file instead
+		if ( Content.TargetFilename.IsEmpty() )
+		{
+			Content.TargetFilename = Content.LinkFilenames[ 0 ];
+			Content.LinkFilenames.RemoveAt( 0 );
+			NumBytesDeduplicated -= Content.Source.Size;
+			WriteContent( Content.TargetFilename, Content.Source );
+		}
+
+		for ( const FString& LinkFilename : Content.LinkFilenames )
+		{
+			OutputSink.CreateLink( LinkFilename, Content.TargetFilename );
+			LinkTargets.Add( LinkFilename, Content.TargetFilename );
+		}
+	}
+
+	UE_LOG( LogIoStoreTools, Display, TEXT("Deduplicated %d bulk data files, saving %.2f MB"), LinkTargets.Num(), NumBytesDeduplicated / 1024.0 / 1024.0 );
+}
+
+const FString* FBulkDataDeduplicator::FindLinkTarget( const FString& RelativeFilename ) const
+{
+	return LinkTargets.Find( RelativeFilename );
+}
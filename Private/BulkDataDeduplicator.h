@@ -0,0 +1,59 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "IO/IoDispatcher.h"
+
+class FIoStoreReader;
+class FMappedIoStoreContainer;
+class IPackageOutputSink;
+
+/**
+ * Tracks the contents of the bulk data files written, identified by the chunk hash recorded in the container and the chunk size.
+ * The first file with the given content is written normally, and all following files with the same content become links to it.
+ * Links are only created once all files have been written, since the file they point to can still be overwritten by a patch container.
+ */
+class FBulkDataDeduplicator
+{
+public:
+	/** Source of the deduplicated content, used to write it again if the file it has been written into is overwritten with a different content */
+	struct FContentSource
+	{
+		const FIoStoreReader* Reader{nullptr};
+		const FMappedIoStoreContainer* MappedContainer{nullptr};
+		FIoChunkId ChunkId;
+		uint64 Size{0};
+	};
+private:
+	using FContentKey = TPair<FIoChunkHash, uint64>;
+
+	struct FDeduplicatedContent
+	{
+		/** File the content has been written into. Empty if that file has been overwritten with a different content since */
+		FString TargetFilename;
+		/** Files that should become links to the target file */
+		TArray<FString> LinkFilenames;
+		FContentSource Source;
+	};
+
+	FCriticalSection DeduplicationCriticalSection;
+	TMap<FContentKey, FDeduplicatedContent> DeduplicatedContents;
+	/** Content of each file written or linked so far */
+	TMap<FString, FContentKey> FileContents;
+	/** Link target of each linked file, filled in once the links have been created */
+	TMap<FString, FString> LinkTargets;
+	int64 NumBytesDeduplicated{0};
+public:
+	/**
+	 * Registers the bulk data file with the given contents. Returns true if the file has to be written, or false if the file is a duplicate
+	 * of another file, in which case it will become a link to that file once CreateLinks is called.
+	 */
+	bool RegisterFile( const FString& RelativeFilename, const FIoChunkHash& ChunkHash, const FContentSource& Source, FString& OutLinkTarget );
+
+	/** Creates the links to the deduplicated files. Contents which files have been overwritten are written again through the callback first */
+	void CreateLinks( IPackageOutputSink& OutputSink, TFunctionRef<void( const FString& RelativeFilename, const FContentSource& Source )> WriteContent );
+
+	/** Returns the file the given file is a link to, or null if it's a regular file. Only valid after CreateLinks has been called */
+	const FString* FindLinkTarget( const FString& RelativeFilename ) const;
+};
@@ -1,18 +1,45 @@
 ﻿// Copyright Nikita Zolotukhin. All Rights Reserved.
 
 #include "CookedAssetWriter.h"
+#include "BulkDataDeduplicator.h"
 #include "IoStorePackageMap.h"
+#include "MappedIoStoreContainer.h"
+#include "PackageChunkPrefetcher.h"
+#include "PackageExportChainCache.h"
+#include "PackageOutputSink.h"
 #include "ZenTools.h"
-#include "Dom/JsonObject.h"
+#include "Async/ParallelFor.h"
 #include "HAL/FileManager.h"
 #include "Misc/Paths.h"
+#include "Misc/ScopeRWLock.h"
 #include "Serialization/LargeMemoryWriter.h"
 #include "Serialization/MemoryWriter.h"
 #include "UObject/Class.h"
 #include "UObject/Package.h"
-#include "UObject/SoftObjectPath.h"
 #include "Misc/FileHelper.h"
-#include "Serialization/JsonSerializer.h"
+#include "Serialization/JsonWriter.h"
+#include "Tasks/Task.h"
+#include <atomic>
+
+/** Number of compression blocks read from the container at once when copying the bulk data */
+static constexpr int32 BulkDataBlocksPerRead = 4;
+/** Maximum number of bulk data reads in flight for a single chunk */
+static constexpr int32 BulkDataReadAheadWindow = 2;
+/** Size of the bulk data reads if the container does not have a compression block size */
+static constexpr uint64 DefaultBulkDataReadSize = 64 * 1024;
+
+/** Number of package chunk reads kept in flight ahead of the packages being written, unless configured otherwise */
+static constexpr int32 DefaultMaxChunkReadsInFlight = 16;
+
+/** Magic number at the start of the binary manifest file */
+static constexpr uint32 BinaryManifestMagic = 0x5A504B4D;
+/** Version of the binary manifest file format. Must be bumped each time the layout of the file changes */
+static constexpr uint32 BinaryManifestVersion = 1;
+
+/** Magic number at the start of the extraction state file */
+static constexpr uint32 ExtractionStateMagic = 0x5A585354;
+/** Version of the extraction state file. Must be bumped each time the data written for the packages or the way their hashes are computed changes */
+static constexpr uint32 ExtractionStateVersion = 4;
 
 FAssetSerializationWriter::FAssetSerializationWriter( FArchive& Ar, FAssetSerializationContext* Context ) : FArchiveProxy( Ar ), Context( Context )
 {
@@ -58,48 +85,285 @@ void FAssetSerializationWriter::SetFilterEditorOnly( bool InFilterEditorOnly )
 	FArchive::SetFilterEditorOnly( InFilterEditorOnly );
 }
 
-FCookedAssetWriter::FCookedAssetWriter(const TSharedPtr<FIoStorePackageMap>& InPackageMap, const FString& InOutputDir) : PackageMap( InPackageMap ), RootOutputDir( InOutputDir ), NumPackagesWritten( 0 )
+FCookedAssetWriter::FCookedAssetWriter(const TSharedPtr<FIoStorePackageMap>& InPackageMap, const FString& InOutputDir, const TSharedPtr<IPackageOutputSink>& InOutputSink, int32 InNumWorkerThreads) : PackageMap( InPackageMap ), RootOutputDir( InOutputDir ), OutputSink( InOutputSink ),
+	NumWorkerThreads( FMath::Max( InNumWorkerThreads, 1 ) ), MaxChunkReadsInFlight( DefaultMaxChunkReadsInFlight ), NumPackagesWritten( 0 ), bIncrementalExtraction( false ), NumPackagesUnchanged( 0 ),
+	WorkerAvailableSeconds( 0.0 ), WorkerBusySeconds( 0.0 ), WorkerReadWaitSeconds( 0.0 ), WorkerFlushWaitSeconds( 0.0 ), NumPackagesArenaCounted( 0 ), ExportChainCache( MakeShared<FPackageExportChainCache>( *InPackageMap ) )
 {
 }
 
+void FCookedAssetWriter::SetMaxChunkReadsInFlight( int32 InMaxChunkReadsInFlight )
+{
+	MaxChunkReadsInFlight = FMath::Max( InMaxChunkReadsInFlight, 1 );
+}
+
+void FCookedAssetWriter::EnableBulkDataDeduplication()
+{
+	BulkDataDeduplicator = MakeShared<FBulkDataDeduplicator>();
+}
+
+void FCookedAssetWriter::CreateDeduplicatedBulkDataLinks()
+{
+	if ( BulkDataDeduplicator )
+	{
+		BulkDataDeduplicator->CreateLinks( *OutputSink, [&]( const FString& RelativeFilename, const FBulkDataDeduplicator::FContentSource& Source )
+		{
+			const TUniquePtr<FArchive> BulkDataArchive = OutputSink->CreateFileWriter( RelativeFilename, Source.Size );
+			CopyChunkToArchive( *Source.Reader, Source.MappedContainer, Source.ChunkId, Source.Size, *BulkDataArchive );
+		} );
+	}
+}
+
+void FCookedAssetWriter::SetMappedContainer( FIoContainerId ContainerId, const TSharedPtr<FMappedIoStoreContainer>& MappedContainer )
+{
+	MappedContainers.Add( ContainerId, MappedContainer );
+}
+
+FArchive& operator<<( FArchive& Ar, FWrittenPackageInfo& PackageInfo )
+{
+	FString PackageNameString = PackageInfo.PackageName.ToString();
+
+	Ar << PackageInfo.PackageId;
+	Ar << PackageNameString;
+	Ar << PackageInfo.PackageChunkId;
+	Ar << PackageInfo.WrittenFiles;
+	Ar << PackageInfo.BulkDataChunks;
+	Ar << PackageInfo.ChunkHash;
+	Ar << PackageInfo.ImportsHash;
+
+	if ( Ar.IsLoading() )
+	{
+		PackageInfo.PackageName = FName( *PackageNameString );
+	}
+	return Ar;
+}
+
+void FCookedAssetWriter::PrepareOutputDirectories( const TArray<TSharedPtr<FIoStoreReader>>& Readers ) const
+{
+	TSet<FString> OutputDirectories;
+
+	auto AddPackageDirectories = [&]( const TArray<FPackageId>& PackageIds )
+	{
+		for ( const FPackageId& PackageId : PackageIds )
+		{
+			if ( SelectedPackages.IsSet() && !SelectedPackages->Contains( PackageId ) )
+			{
+				continue;
+			}
+			if ( const FPackageMapExportBundleEntry* ExportBundleEntry = PackageMap->FindExportBundleData( PackageId ) )
+			{
+				OutputDirectories.Add( ExportBundleEntry->GetPackageDirectory() );
+			}
+		}
+	};
+
+	for ( const TSharedPtr<FIoStoreReader>& Reader : Readers )
+	{
+		if ( const FPackageContainerMetadata* ContainerMetadata = PackageMap->FindPackageContainerMetadata( Reader->GetContainerId() ) )
+		{
+			AddPackageDirectories( ContainerMetadata->PackagesInContainer );
+			AddPackageDirectories( ContainerMetadata->OptionalPackagesInContainer );
+		}
+	}
+
+	UE_LOG( LogIoStoreTools, Display, TEXT("Preparing %d output directories"), OutputDirectories.Num() );
+	OutputSink->PrepareDirectories( OutputDirectories );
+}
+
 void FCookedAssetWriter::WritePackagesFromContainer( const TSharedPtr<FIoStoreReader>& Reader )
 {
 	const FIoContainerId ContainerId = Reader->GetContainerId();
 	UE_LOG( LogIoStoreTools, Display, TEXT("Writing asset files for Container %lld"), ContainerId.Value() );
 
-	FPackageContainerMetadata ContainerMetadata;
-	if ( PackageMap->FindPackageContainerMetadata( ContainerId, ContainerMetadata ) )
+	if ( const FPackageContainerMetadata* ContainerMetadata = PackageMap->FindPackageContainerMetadata( ContainerId ) )
 	{
-		for ( const FPackageId& PackageId : ContainerMetadata.PackagesInContainer )
+		// Required packages go first, followed by the optional segment packages, same as the order in which they are recorded in the manifest
+		TArray<TPair<FPackageId, bool>> PackagesToWrite;
+		PackagesToWrite.Reserve( ContainerMetadata->PackagesInContainer.Num() + ContainerMetadata->OptionalPackagesInContainer.Num() );
+
+		for ( const FPackageId& PackageId : ContainerMetadata->PackagesInContainer )
+		{
+			if ( !SelectedPackages.IsSet() || SelectedPackages->Contains( PackageId ) )
+			{
+				PackagesToWrite.Add( { PackageId, false } );
+			}
+		}
+		for ( const FPackageId& PackageId : ContainerMetadata->OptionalPackagesInContainer )
+		{
+			if ( !SelectedPackages.IsSet() || SelectedPackages->Contains( PackageId ) )
+			{
+				PackagesToWrite.Add( { PackageId, true } );
+			}
+		}
+		const int32 NumTotalPackages = PackagesToWrite.Num();
+
+		TArray<FWrittenPackageInfo> WrittenPackages;
+		WrittenPackages.SetNum( NumTotalPackages );
+
+		// Unchanged packages are found upfront, so that their chunks are not read from the container at all
+		if ( bIncrementalExtraction )
+		{
+			ParallelFor( NumTotalPackages, [&]( int32 PackageIndex )
+			{
+				const FPackageId PackageId = PackagesToWrite[ PackageIndex ].Key;
+				FWrittenPackageInfo& PackageInfo = WrittenPackages[ PackageIndex ];
+
+				ComputePackageHashes( PackageId, *Reader, PackageInfo );
+
+				if ( IsPackageUnchangedSincePreviousExtraction( ContainerId, PackageInfo ) )
+				{
+					PackageInfo = PreviousExtractionState.FindChecked( FContainerPackageKey( ContainerId, PackageId ) );
+					PackageInfo.bUnchangedSincePreviousExtraction = true;
+				}
+			}, NumWorkerThreads > 1 ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread );
+		}
+
+		// Packages are processed in the order of their chunks in the container, so that the prefetched reads are sequential. Results are still recorded in the package order
+		TArray<TPair<uint64, int32>> PackageWriteOrder;
+		PackageWriteOrder.Reserve( NumTotalPackages );
+
+		for ( int32 PackageIndex = 0; PackageIndex < NumTotalPackages; PackageIndex++ )
+		{
+			if ( !WrittenPackages[ PackageIndex ].bUnchangedSincePreviousExtraction )
+			{
+				const FPackageMapExportBundleEntry* ExportBundleEntry = PackageMap->FindExportBundleData( PackagesToWrite[ PackageIndex ].Key );
+				checkf( ExportBundleEntry, TEXT("Failed to find export bundle entry for PackageId %lld"), PackagesToWrite[ PackageIndex ].Key.ValueForDebugging() );
+
+				PackageWriteOrder.Add( { FPackageChunkPrefetcher::GetChunkOffset( *Reader, ExportBundleEntry->PackageChunkId ), PackageIndex } );
+			}
+		}
+		PackageWriteOrder.StableSort( []( const TPair<uint64, int32>& A, const TPair<uint64, int32>& B ) { return A.Key < B.Key; } );
+		const int32 NumPackagesToWrite = PackageWriteOrder.Num();
+
+		TArray<FIoChunkId> PackageChunksToRead;
+		PackageChunksToRead.Reserve( NumPackagesToWrite );
+		for ( const TPair<uint64, int32>& PackageToWrite : PackageWriteOrder )
 		{
-			WriteSinglePackage( PackageId, false, Reader );
+			PackageChunksToRead.Add( PackageMap->FindExportBundleData( PackagesToWrite[ PackageToWrite.Value ].Key )->PackageChunkId );
 		}
-		for ( const FPackageId& OptionalPackageId : ContainerMetadata.OptionalPackagesInContainer )
+		const TSharedPtr<FMappedIoStoreContainer>* MappedContainer = MappedContainers.Find( ContainerId );
+		FPackageChunkPrefetcher ChunkPrefetcher( *Reader, MappedContainer ? MappedContainer->Get() : nullptr, MoveTemp( PackageChunksToRead ), MaxChunkReadsInFlight );
+
+		// Each worker picks up the next package that has not been written yet, which keeps the workers busy regardless of the package sizes
+		std::atomic<int32> NextWriteIndex{0};
+		const int32 NumWorkers = FMath::Min( NumWorkerThreads, NumPackagesToWrite );
+
+		std::atomic<uint64> WorkerBusyCycles{0};
+		const double WritingStartTime = FPlatformTime::Seconds();
+
+		ParallelFor( NumWorkers, [&]( int32 WorkerIndex )
+		{
+			for ( int32 WriteIndex = NextWriteIndex++; WriteIndex < NumPackagesToWrite; WriteIndex = NextWriteIndex++ )
+			{
+				const int32 PackageIndex = PackageWriteOrder[ WriteIndex ].Value;
+				const FPackageId PackageId = PackagesToWrite[ PackageIndex ].Key;
+				const bool bIsOptionalSegmentPackage = PackagesToWrite[ PackageIndex ].Value;
+
+				const uint64 PackageStartCycles = FPlatformTime::Cycles64();
+				WriteSinglePackage( PackageId, bIsOptionalSegmentPackage, Reader, ChunkPrefetcher, WriteIndex, WrittenPackages[ PackageIndex ] );
+				WorkerBusyCycles += FPlatformTime::Cycles64() - PackageStartCycles;
+			}
+		}, NumWorkers > 1 ? EParallelForFlags::Unbalanced : EParallelForFlags::ForceSingleThread );
+
+		// Packages overridden by the later containers write the same files again, so their files must only be written once the files of this container are in place
+		const double FlushStartTime = FPlatformTime::Seconds();
+		OutputSink->Flush();
+		const double FlushWaitSeconds = ( FPlatformTime::Seconds() - FlushStartTime ) * NumWorkers;
+
+		WorkerAvailableSeconds += ( FPlatformTime::Seconds() - WritingStartTime ) * NumWorkers;
+		WorkerBusySeconds += FPlatformTime::ToSeconds64( WorkerBusyCycles.load() ) + FlushWaitSeconds;
+		WorkerFlushWaitSeconds += FlushWaitSeconds;
+		WorkerReadWaitSeconds += ChunkPrefetcher.GetWaitTimeSeconds();
+
+		// Merge the results in the package order so the manifest is identical to the one produced by a single threaded run
+		for ( const FWrittenPackageInfo& WrittenPackage : WrittenPackages )
 		{
-			WriteSinglePackage( OptionalPackageId, true, Reader );
+			if ( !WrittenPackage.bUnchangedSincePreviousExtraction )
+			{
+				PackageArenaCounters.NumAllocations += WrittenPackage.ArenaCounters.NumAllocations;
+				PackageArenaCounters.NumBytesAllocated += WrittenPackage.ArenaCounters.NumBytesAllocated;
+				MaxPackageArenaCounters.NumAllocations = FMath::Max( MaxPackageArenaCounters.NumAllocations, WrittenPackage.ArenaCounters.NumAllocations );
+				MaxPackageArenaCounters.NumBytesAllocated = FMath::Max( MaxPackageArenaCounters.NumBytesAllocated, WrittenPackage.ArenaCounters.NumBytesAllocated );
+				NumPackagesArenaCounted++;
+				WorkerReadWaitSeconds += WrittenPackage.BulkDataReadWaitSeconds;
+			}
+			RecordWrittenPackage( ContainerId, WrittenPackage );
 		}
 	}
 }
 
+void FCookedAssetWriter::FinalizeOutput()
+{
+	// Workers have nothing to do until the last files are written and the output is closed, so all of them are waiting for the write stage for the duration of it
+	const double FinalizeStartTime = FPlatformTime::Seconds();
+	OutputSink->Finalize();
+	const double FinalizeWaitSeconds = ( FPlatformTime::Seconds() - FinalizeStartTime ) * NumWorkerThreads;
+
+	WorkerAvailableSeconds += FinalizeWaitSeconds;
+	WorkerBusySeconds += FinalizeWaitSeconds;
+	WorkerFlushWaitSeconds += FinalizeWaitSeconds;
+}
+
+void FCookedAssetWriter::LogPipelineStatistics() const
+{
+	// Writers blocked on the output are still inside of the package, so the time they have been waiting for is subtracted from the processing time
+	const double WorkerWriteWaitSeconds = OutputSink->GetProducerWaitTimeSeconds() + WorkerFlushWaitSeconds;
+	const double WorkerProcessingSeconds = FMath::Max( WorkerBusySeconds - WorkerReadWaitSeconds - WorkerWriteWaitSeconds, 0.0 );
+	auto GetWorkerTimePercentage = [&]( double Seconds )
+	{
+		return WorkerAvailableSeconds > 0.0 ? Seconds / WorkerAvailableSeconds * 100.0 : 0.0;
+	};
+
+	UE_LOG( LogIoStoreTools, Display, TEXT("Read stage: %d package chunk reads in flight, workers waited %.2f seconds for the reads (%.1f%% of their time)"),
+		MaxChunkReadsInFlight, WorkerReadWaitSeconds, GetWorkerTimePercentage( WorkerReadWaitSeconds ) );
+	UE_LOG( LogIoStoreTools, Display, TEXT("Transform stage: %d worker threads, %.2f seconds spent processing the packages (%.1f%% of their time)"),
+		NumWorkerThreads, WorkerProcessingSeconds, GetWorkerTimePercentage( WorkerProcessingSeconds ) );
+	if ( NumPackagesArenaCounted > 0 )
+	{
+		UE_LOG( LogIoStoreTools, Display, TEXT("Transform stage: package arenas served %.1f allocations totalling %.1f KB per package on average, at most %llu allocations and %.1f KB for a single package"),
+			(double) PackageArenaCounters.NumAllocations / NumPackagesArenaCounted, PackageArenaCounters.NumBytesAllocated / 1024.0 / NumPackagesArenaCounted,
+			MaxPackageArenaCounters.NumAllocations, MaxPackageArenaCounters.NumBytesAllocated / 1024.0 );
+	}
+	if ( ExportChainCache->GetNumLookups() > 0 )
+	{
+		UE_LOG( LogIoStoreTools, Display, TEXT("Transform stage: %d imported export chains resolved for %lld imports, %.1f%% of them reused from the cache"),
+			ExportChainCache->GetNumChains(), ExportChainCache->GetNumLookups(), 100.0 - ExportChainCache->GetNumChains() * 100.0 / ExportChainCache->GetNumLookups() );
+	}
+	UE_LOG( LogIoStoreTools, Display, TEXT("Write stage: workers waited %.2f seconds for the output to accept the files (%.1f%% of their time)"),
+		WorkerWriteWaitSeconds, GetWorkerTimePercentage( WorkerWriteWaitSeconds ) );
+
+	const TCHAR* BottleneckStageName = TEXT("processing the packages, adding more worker threads with -Threads might help");
+	if ( WorkerReadWaitSeconds > WorkerProcessingSeconds && WorkerReadWaitSeconds >= WorkerWriteWaitSeconds )
+	{
+		BottleneckStageName = TEXT("reading the containers, increasing -PrefetchDepth might help");
+	}
+	else if ( WorkerWriteWaitSeconds > WorkerProcessingSeconds )
+	{
+		BottleneckStageName = TEXT("writing the output, increasing -IOThreads or the write queue limits might help");
+	}
+	UE_LOG( LogIoStoreTools, Display, TEXT("Extraction is bound by %s"), BottleneckStageName );
+}
+
+void FCookedAssetWriter::SetSelectedPackages( TSet<FPackageId>&& InSelectedPackages )
+{
+	SelectedPackages = MoveTemp( InSelectedPackages );
+}
+
 void FCookedAssetWriter::WriteGlobalScriptObjects(const TSharedPtr<FIoStoreReader>& Reader) const
 {
 	TIoStatusOr<FIoBuffer> ScriptObjectsBuffer = Reader->Read(CreateIoChunkId(0, 0, EIoChunkType::ScriptObjects), FIoReadOptions());
 
 	if ( ScriptObjectsBuffer.IsOk() )
 	{
-		const FString ScriptObjectsFilename = FPaths::Combine( RootOutputDir, TEXT("ScriptObjects.bin") );
-		FFileHelper::SaveArrayToFile( TArrayView<const uint8>( ScriptObjectsBuffer.ValueOrDie().Data(), ScriptObjectsBuffer.ValueOrDie().DataSize() ), *ScriptObjectsFilename );
+		const FString ScriptObjectsFilename = TEXT("ScriptObjects.bin");
+		OutputSink->WriteFile( ScriptObjectsFilename, TArrayView64<const uint8>( ScriptObjectsBuffer.ValueOrDie().Data(), ScriptObjectsBuffer.ValueOrDie().DataSize() ) );
 
-		UE_LOG( LogIoStoreTools, Display, TEXT("Written ScriptObjects chunk to '%s'"), *ScriptObjectsFilename );
+		UE_LOG( LogIoStoreTools, Display, TEXT("Written ScriptObjects chunk to '%s' in '%s'"), *ScriptObjectsFilename, *OutputSink->GetOutputPath() );
 	}
 }
 
 void FCookedAssetWriter::WritePackageStoreManifest() const
 {
-	const FString PackageStoreFilename = RootOutputDir / TEXT("PackageStoreManifest.json");
-	IFileManager::Get().MakeDirectory( *FPaths::GetPath( PackageStoreFilename ), true );
-
-	const TSharedPtr<FJsonObject> RootObject = MakeShared<FJsonObject>();
+	const FString PackageStoreFilename = TEXT("PackageStoreManifest.json");
 
 	TStringBuilder<64> ChunkIdStringBuilder;
 	auto ChunkIdToString = [&ChunkIdStringBuilder](const FIoChunkId& ChunkId)
@@ -108,63 +372,361 @@ void FCookedAssetWriter::WritePackageStoreManifest() const
 		ChunkIdStringBuilder << ChunkId;
 		return *ChunkIdStringBuilder;
 	};
-	
-	TArray<TSharedPtr<FJsonValue>> FilesArray;
+
+	// Manifest is written into the file as it is being generated, instead of building the entire document in memory first
+	using FManifestJsonWriter = TJsonWriter<UTF8CHAR, TPrettyJsonPrintPolicy<UTF8CHAR>>;
+	const TUniquePtr<FArchive> ManifestArchive = OutputSink->CreateFileWriter( PackageStoreFilename );
+	const TSharedRef<FManifestJsonWriter> JsonWriter = FManifestJsonWriter::Create( ManifestArchive.Get() );
+
+	JsonWriter->WriteObjectStart();
+	JsonWriter->WriteArrayStart( TEXT("Files") );
 	for ( const TPair<FIoChunkId, FString>& FilePair : ChunkIdToSavedFileMap )
 	{
-		const TSharedPtr<FJsonObject> FileObject = MakeShared<FJsonObject>();
-		FileObject->SetStringField( TEXT("Path"), FilePair.Value );
-		FileObject->SetStringField( TEXT("ChunkId"), ChunkIdToString( FilePair.Key ) );
+		JsonWriter->WriteObjectStart();
+		JsonWriter->WriteValue( TEXT("Path"), FilePair.Value );
+		JsonWriter->WriteValue( TEXT("ChunkId"), ChunkIdToString( FilePair.Key ) );
 
-		FilesArray.Add( MakeShared<FJsonValueObject>( FileObject ) );
+		if ( const FString* LinkTarget = BulkDataDeduplicator ? BulkDataDeduplicator->FindLinkTarget( FilePair.Value ) : nullptr )
+		{
+			JsonWriter->WriteValue( TEXT("LinkTarget"), *LinkTarget );
+		}
+		JsonWriter->WriteObjectEnd();
 	}
-	RootObject->SetArrayField( TEXT("Files"), FilesArray );
+	JsonWriter->WriteArrayEnd();
 
-	TArray<TSharedPtr<FJsonValue>> PackagesArray;
+	JsonWriter->WriteArrayStart( TEXT("Packages") );
 	for ( const TPair<FName, FSavedPackageInfo>& SavedPackageInfo : SavedPackageMap )
 	{
-		const TSharedPtr<FJsonObject> PackageObject = MakeShared<FJsonObject>();
-		PackageObject->SetStringField( TEXT("Name"), SavedPackageInfo.Key.ToString() );
+		JsonWriter->WriteObjectStart();
+		JsonWriter->WriteValue( TEXT("Name"), SavedPackageInfo.Key.ToString() );
 
 		if ( !SavedPackageInfo.Value.ExportBundleChunks.IsEmpty() )
 		{
-			TArray<TSharedPtr<FJsonValue>> ExportBundleChunkIdsArray;
+			JsonWriter->WriteArrayStart( TEXT("ExportBundleChunkIds") );
 			for ( const FIoChunkId& ExportBundleChunkId : SavedPackageInfo.Value.ExportBundleChunks )
 			{
-				ExportBundleChunkIdsArray.Add( MakeShared<FJsonValueString>( ChunkIdToString( ExportBundleChunkId ) ) );
+				JsonWriter->WriteValue( ChunkIdToString( ExportBundleChunkId ) );
 			}
-			PackageObject->SetArrayField( TEXT("ExportBundleChunkIds"), ExportBundleChunkIdsArray );
+			JsonWriter->WriteArrayEnd();
 		}
 
 		if ( !SavedPackageInfo.Value.BulkDataChunks.IsEmpty() )
 		{
-			TArray<TSharedPtr<FJsonValue>> BulkDataChunkIdsArray;
+			JsonWriter->WriteArrayStart( TEXT("BulkDataChunkIds") );
 			for ( const FIoChunkId& BulkDataChunkId : SavedPackageInfo.Value.BulkDataChunks )
 			{
-				BulkDataChunkIdsArray.Add( MakeShared<FJsonValueString>( ChunkIdToString( BulkDataChunkId ) ) );
+				JsonWriter->WriteValue( ChunkIdToString( BulkDataChunkId ) );
 			}
-			PackageObject->SetArrayField( TEXT("BulkDataChunkIds"), BulkDataChunkIdsArray );
+			JsonWriter->WriteArrayEnd();
 		}
-		PackagesArray.Add( MakeShared<FJsonValueObject>( PackageObject ) );
+		JsonWriter->WriteObjectEnd();
 	}
-	RootObject->SetArrayField( TEXT("Packages"), PackagesArray );
+	JsonWriter->WriteArrayEnd();
+	JsonWriter->WriteObjectEnd();
+	verifyf( JsonWriter->Close(), TEXT("Failed to write the PackageStore Manifest") );
 
-	FString ResultJsonString;
-	FJsonSerializer::Serialize( RootObject.ToSharedRef(), TJsonWriterFactory<>::Create( &ResultJsonString ) );
+	UE_LOG( LogIoStoreTools, Display, TEXT("Written PackageStore Manifest to '%s' in '%s'"), *PackageStoreFilename, *OutputSink->GetOutputPath() );
+}
 
-	check( FFileHelper::SaveStringToFile( ResultJsonString, *PackageStoreFilename ) );
-	UE_LOG( LogIoStoreTools, Display, TEXT("Written PackageStore Manifest to '%s'"), *PackageStoreFilename );
+void FCookedAssetWriter::WriteBinaryPackageStoreManifest() const
+{
+	const FString PackageStoreFilename = TEXT("PackageStoreManifest.bin");
+	const TUniquePtr<FArchive> ManifestArchive = OutputSink->CreateFileWriter( PackageStoreFilename );
+	FArchive& Ar = *ManifestArchive;
+
+	uint32 Magic = BinaryManifestMagic;
+	uint32 Version = BinaryManifestVersion;
+	Ar << Magic;
+	Ar << Version;
+
+	// Files are written as the chunk they have been produced from, the path and the path of the file they link to, which is empty for the regular files
+	int32 NumFiles = ChunkIdToSavedFileMap.Num();
+	Ar << NumFiles;
+	for ( const TPair<FIoChunkId, FString>& FilePair : ChunkIdToSavedFileMap )
+	{
+		FIoChunkId ChunkId = FilePair.Key;
+		FString Path = FilePair.Value;
+		const FString* LinkTarget = BulkDataDeduplicator ? BulkDataDeduplicator->FindLinkTarget( FilePair.Value ) : nullptr;
+		FString LinkTargetPath = LinkTarget ? *LinkTarget : FString();
+
+		Ar << ChunkId;
+		Ar << Path;
+		Ar << LinkTargetPath;
+	}
+
+	int32 NumPackages = SavedPackageMap.Num();
+	Ar << NumPackages;
+	for ( const TPair<FName, FSavedPackageInfo>& SavedPackageInfo : SavedPackageMap )
+	{
+		FString PackageName = SavedPackageInfo.Key.ToString();
+		TArray<FIoChunkId> ExportBundleChunks = SavedPackageInfo.Value.ExportBundleChunks;
+		TArray<FIoChunkId> BulkDataChunks = SavedPackageInfo.Value.BulkDataChunks;
+
+		Ar << PackageName;
+		Ar << ExportBundleChunks;
+		Ar << BulkDataChunks;
+	}
+	verifyf( Ar.Close(), TEXT("Failed to write the binary PackageStore Manifest") );
+
+	UE_LOG( LogIoStoreTools, Display, TEXT("Written binary PackageStore Manifest to '%s' in '%s'"), *PackageStoreFilename, *OutputSink->GetOutputPath() );
+}
+
+void FCookedAssetWriter::RecordWrittenPackage( FIoContainerId ContainerId, const FWrittenPackageInfo& PackageInfo )
+{
+	FSavedPackageInfo& SavedPackageInfo = SavedPackageMap.FindOrAdd( PackageInfo.PackageName );
+	SavedPackageInfo.ExportBundleChunks.Add( PackageInfo.PackageChunkId );
+	SavedPackageInfo.BulkDataChunks.Append( PackageInfo.BulkDataChunks );
+
+	for ( const TPair<FIoChunkId, FString>& WrittenFile : PackageInfo.WrittenFiles )
+	{
+		ChunkIdToSavedFileMap.Add( WrittenFile.Key, WrittenFile.Value );
+	}
+
+	if ( bIncrementalExtraction )
+	{
+		ExtractionState.Add( FContainerPackageKey( ContainerId, PackageInfo.PackageId ), PackageInfo );
+		PackageOutputContainers.Add( PackageInfo.PackageId, ContainerId );
+	}
+
+	if ( PackageInfo.bUnchangedSincePreviousExtraction )
+	{
+		NumPackagesUnchanged++;
+	}
+	else
+	{
+		PackagesWrittenThisExtraction.Add( PackageInfo.PackageId );
+		NumPackagesWritten++;
+	}
 }
 
-void FCookedAssetWriter::WriteSinglePackage( FPackageId PackageId, bool bIsOptionalSegmentPackage, const TSharedPtr<FIoStoreReader>& Reader )
+void FCookedAssetWriter::ComputePackageHashes( FPackageId PackageId, const FIoStoreReader& Reader, FWrittenPackageInfo& OutPackageInfo ) const
 {
-	FPackageMapExportBundleEntry ExportBundleEntry;
-	checkf( PackageMap->FindExportBundleData( PackageId, ExportBundleEntry ), TEXT("Failed to find export bundle entry for PackageId %lld"), PackageId.ValueForDebugging() );
+	const FPackageMapExportBundleEntry* ExportBundleEntry = PackageMap->FindExportBundleData( PackageId );
+	checkf( ExportBundleEntry, TEXT("Failed to find export bundle entry for PackageId %lld"), PackageId.ValueForDebugging() );
+
+	OutPackageInfo.PackageId = PackageId;
+
+	// Hashes of the chunks are already stored in the container TOC, so there is no need to read the chunks themselves
+	FSHA1 ChunkHashState;
+	auto HashChunk = [&]( const FIoChunkId& ChunkId )
+	{
+		TIoStatusOr<FIoStoreTocChunkInfo> ChunkInfo = Reader.GetChunkInfo( ChunkId );
+		checkf( ChunkInfo.IsOk(), TEXT("Failed to find chunk info for chunk of package '%s'"), *ExportBundleEntry->PackageName.ToString() );
+
+		const FIoStoreTocChunkInfo& ChunkInfoValue = ChunkInfo.ValueOrDie();
+		ChunkHashState.Update( reinterpret_cast<const uint8*>( &ChunkInfoValue.Hash ), sizeof( ChunkInfoValue.Hash ) );
+	};
+	HashChunk( ExportBundleEntry->PackageChunkId );
+	for ( const FIoChunkId& BulkDataChunkId : ExportBundleEntry->GetBulkDataChunkIds() )
+	{
+		HashChunk( BulkDataChunkId );
+	}
+	ChunkHashState.Final();
+	ChunkHashState.GetHash( OutPackageInfo.ChunkHash.Hash );
+
+	// Imports of the package are written using the names, outers and classes of the exports in the imported packages, and the class paths of these exports
+	// are resolved through further packages, so if any package reached this way changes the package must be written again
+	FSHA1 ImportsHashState;
+	ImportsHashState.Update( ScriptObjectsHash.Hash, sizeof( ScriptObjectsHash.Hash ) );
+
+	TSet<FPackageId> ImportResolutionPackages;
+	PackageMap->CollectImportResolutionPackages( PackageId, ImportResolutionPackages );
+	TArray<FPackageId> SortedImportResolutionPackages = ImportResolutionPackages.Array();
+	SortedImportResolutionPackages.Sort( []( const FPackageId& A, const FPackageId& B ) { return A.Value() < B.Value(); } );
+
+	for ( const FPackageId& ImportedPackageId : SortedImportResolutionPackages )
+	{
+		const uint64 ImportedPackageIdValue = ImportedPackageId.Value();
+		const FSHAHash ExportLayoutHash = FindOrComputeExportLayoutHash( ImportedPackageId );
+		ImportsHashState.Update( reinterpret_cast<const uint8*>( &ImportedPackageIdValue ), sizeof( ImportedPackageIdValue ) );
+		ImportsHashState.Update( ExportLayoutHash.Hash, sizeof( ExportLayoutHash.Hash ) );
+	}
+	ImportsHashState.Final();
+	ImportsHashState.GetHash( OutPackageInfo.ImportsHash.Hash );
+}
+
+FSHAHash FCookedAssetWriter::FindOrComputeExportLayoutHash( const FPackageId& PackageId ) const
+{
+	{
+		FReadScopeLock ReadLock( ExportLayoutHashesLock );
+		if ( const FSHAHash* ExistingHash = ExportLayoutHashes.Find( PackageId ) )
+		{
+			return *ExistingHash;
+		}
+	}
+
+	// Computed outside of the lock, threads computing the hash of the same package at the same time get the same result
+	const FSHAHash ExportLayoutHash = PackageMap->ComputeExportLayoutHash( PackageId );
+
+	FWriteScopeLock WriteLock( ExportLayoutHashesLock );
+	ExportLayoutHashes.Add( PackageId, ExportLayoutHash );
+	return ExportLayoutHash;
+}
+
+bool FCookedAssetWriter::IsPackageUnchangedSincePreviousExtraction( FIoContainerId ContainerId, const FWrittenPackageInfo& PackageInfo ) const
+{
+	// Package has been overwritten by the version from another container during this extraction, so the version from this container must be written again
+	if ( PackagesWrittenThisExtraction.Contains( PackageInfo.PackageId ) )
+	{
+		return false;
+	}
+
+	const FWrittenPackageInfo* PreviousPackageInfo = PreviousExtractionState.Find( FContainerPackageKey( ContainerId, PackageInfo.PackageId ) );
+	if ( PreviousPackageInfo == nullptr || PreviousPackageInfo->ChunkHash != PackageInfo.ChunkHash || PreviousPackageInfo->ImportsHash != PackageInfo.ImportsHash )
+	{
+		return false;
+	}
+
+	// Files in the output directory must come from the container the package is resolved from this time. If the package has been overridden by a container
+	// that no longer has it, or has just been overridden by a new one, the files are from another container
+	const FIoContainerId* PreviousOutputContainerId = PreviousPackageOutputContainers.Find( PackageInfo.PackageId );
+	const FIoContainerId* ExpectedOutputContainerId = ExpectedPackageOutputContainers.Find( PackageInfo.PackageId );
+	if ( PreviousOutputContainerId == nullptr || ExpectedOutputContainerId == nullptr || *PreviousOutputContainerId != *ExpectedOutputContainerId )
+	{
+		return false;
+	}
+
+	// Files could have been deleted or modified by the user since then, only trust the state if they are still there
+	for ( const TPair<FIoChunkId, FString>& WrittenFile : PreviousPackageInfo->WrittenFiles )
+	{
+		if ( !IFileManager::Get().FileExists( *FPaths::Combine( RootOutputDir, WrittenFile.Value ) ) )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+FString FCookedAssetWriter::GetExtractionStateFilename() const
+{
+	return RootOutputDir / TEXT("ExtractionState.bin");
+}
+
+void FCookedAssetWriter::EnableIncrementalExtraction( const TArray<TSharedPtr<FIoStoreReader>>& Readers )
+{
+	bIncrementalExtraction = true;
+	ScriptObjectsHash = PackageMap->ComputeScriptObjectsHash();
+
+	// Containers written later override the packages of the ones written before them
+	for ( const TSharedPtr<FIoStoreReader>& Reader : Readers )
+	{
+		const FIoContainerId ContainerId = Reader->GetContainerId();
+		if ( const FPackageContainerMetadata* ContainerMetadata = PackageMap->FindPackageContainerMetadata( ContainerId ) )
+		{
+			for ( const TArray<FPackageId>* PackageIds : { &ContainerMetadata->PackagesInContainer, &ContainerMetadata->OptionalPackagesInContainer } )
+			{
+				for ( const FPackageId& PackageId : *PackageIds )
+				{
+					ExpectedPackageOutputContainers.Add( PackageId, ContainerId );
+					ContainerPackages.Add( FContainerPackageKey( ContainerId, PackageId ) );
+				}
+			}
+		}
+	}
+
+	const FString ExtractionStateFilename = GetExtractionStateFilename();
+	const TUniquePtr<FArchive> StateArchive( IFileManager::Get().CreateFileReader( *ExtractionStateFilename ) );
+	if ( !StateArchive.IsValid() )
+	{
+		UE_LOG( LogIoStoreTools, Display, TEXT("No previous extraction state found at '%s', all packages will be written"), *ExtractionStateFilename );
+		return;
+	}
+
+	uint32 Magic = 0;
+	uint32 Version = 0;
+	*StateArchive << Magic;
+	*StateArchive << Version;
+
+	if ( StateArchive->IsError() || Magic != ExtractionStateMagic || Version != ExtractionStateVersion )
+	{
+		UE_LOG( LogIoStoreTools, Display, TEXT("Previous extraction state at '%s' has been written by a different version of ZenTools, all packages will be written"), *ExtractionStateFilename );
+		return;
+	}
+
+	*StateArchive << PreviousExtractionState;
+	*StateArchive << PreviousPackageOutputContainers;
+	if ( StateArchive->IsError() )
+	{
+		UE_LOG( LogIoStoreTools, Warning, TEXT("Previous extraction state at '%s' is corrupted, all packages will be written"), *ExtractionStateFilename );
+		PreviousExtractionState.Empty();
+		PreviousPackageOutputContainers.Empty();
+		return;
+	}
+	UE_LOG( LogIoStoreTools, Display, TEXT("Loaded previous extraction state for %d packages from '%s'"), PreviousExtractionState.Num(), *ExtractionStateFilename );
+}
+
+void FCookedAssetWriter::RecordPackagesFromPreviousExtraction()
+{
+	// Files of these packages are still in the output directory, so keep them in the manifest and in the state
+	int32 NumPackagesDropped = 0;
+	for ( const TPair<FContainerPackageKey, FWrittenPackageInfo>& PackagePair : PreviousExtractionState )
+	{
+		if ( !ContainerPackages.Contains( PackagePair.Key ) )
+		{
+			// Package has been removed from the container, or the container is not there anymore, so the package is not part of the game anymore
+			NumPackagesDropped++;
+			continue;
+		}
+		if ( !ExtractionState.Contains( PackagePair.Key ) )
+		{
+			FSavedPackageInfo& SavedPackageInfo = SavedPackageMap.FindOrAdd( PackagePair.Value.PackageName );
+			SavedPackageInfo.ExportBundleChunks.Add( PackagePair.Value.PackageChunkId );
+			SavedPackageInfo.BulkDataChunks.Append( PackagePair.Value.BulkDataChunks );
+
+			for ( const TPair<FIoChunkId, FString>& WrittenFile : PackagePair.Value.WrittenFiles )
+			{
+				ChunkIdToSavedFileMap.FindOrAdd( WrittenFile.Key, WrittenFile.Value );
+			}
+			ExtractionState.Add( PackagePair.Key, PackagePair.Value );
+
+			// Package has not been written by this extraction, so its files still come from the same container as before
+			const FIoContainerId* PreviousOutputContainerId = PreviousPackageOutputContainers.Find( PackagePair.Key.Value );
+			if ( PreviousOutputContainerId && !PackageOutputContainers.Contains( PackagePair.Key.Value ) )
+			{
+				PackageOutputContainers.Add( PackagePair.Key.Value, *PreviousOutputContainerId );
+			}
+		}
+	}
+
+	if ( NumPackagesDropped != 0 )
+	{
+		UE_LOG( LogIoStoreTools, Display, TEXT("Dropped %d packages of the previous extraction that are no longer in any of the Containers"), NumPackagesDropped );
+	}
+}
+
+void FCookedAssetWriter::WriteExtractionState()
+{
+	// State is written next to the existing one and moved over it once complete, so that the extraction interrupted while writing it leaves the previous state intact
+	const FString ExtractionStateFilename = GetExtractionStateFilename();
+	const FString TempExtractionStateFilename = ExtractionStateFilename + TEXT(".tmp");
+	{
+		const TUniquePtr<FArchive> StateArchive( IFileManager::Get().CreateFileWriter( *TempExtractionStateFilename ) );
+		checkf( StateArchive.IsValid(), TEXT("Failed to open extraction state file '%s'"), *TempExtractionStateFilename );
+
+		uint32 Magic = ExtractionStateMagic;
+		uint32 Version = ExtractionStateVersion;
+		*StateArchive << Magic;
+		*StateArchive << Version;
+		*StateArchive << ExtractionState;
+		*StateArchive << PackageOutputContainers;
+		verifyf( StateArchive->Close(), TEXT("Failed to write extraction state file '%s'"), *TempExtractionStateFilename );
+	}
+	verifyf( IFileManager::Get().Move( *ExtractionStateFilename, *TempExtractionStateFilename, true, true ), TEXT("Failed to move extraction state file '%s' to '%s'"), *TempExtractionStateFilename, *ExtractionStateFilename );
+
+	UE_LOG( LogIoStoreTools, Display, TEXT("Written extraction state for %d packages to '%s'"), ExtractionState.Num(), *ExtractionStateFilename );
+}
+
+void FCookedAssetWriter::WriteSinglePackage( FPackageId PackageId, bool bIsOptionalSegmentPackage, const TSharedPtr<FIoStoreReader>& Reader, FPackageChunkPrefetcher& ChunkPrefetcher, int32 PackageChunkIndex, FWrittenPackageInfo& OutPackageInfo ) const
+{
+	const FPackageMapExportBundleEntry* ExportBundleEntryPtr = PackageMap->FindExportBundleData( PackageId );
+	checkf( ExportBundleEntryPtr, TEXT("Failed to find export bundle entry for PackageId %lld"), PackageId.ValueForDebugging() );
+	const FPackageMapExportBundleEntry& ExportBundleEntry = *ExportBundleEntryPtr;
+	const FString PackageFilename = ExportBundleEntry.GetPackageFilename();
 	
-	const FString PackageFilename = RootOutputDir / ExportBundleEntry.PackageFilename;
-	IFileManager::Get().MakeDirectory( *FPaths::GetPath( PackageFilename ), true );
+	UE_LOG( LogIoStoreTools, Display, TEXT("Beginning writing package '%s' (0x%llx) to file '%s'"), *ExportBundleEntry.PackageName.ToString(), PackageId.Value(), *PackageFilename );
 
-	UE_LOG( LogIoStoreTools, Display, TEXT("Beginning writing package '%s' (0x%llx) to file '%s'"), *ExportBundleEntry.PackageName.ToString(), PackageId.Value(), *ExportBundleEntry.PackageFilename );
+	// Transient state of the package is allocated from the arena of this thread and released at once when the package is done
+	const FPackageArenaScope PackageArenaScope;
 
 	// Initialize serialization context
 	FAssetSerializationContext SerializationContext{};
@@ -173,9 +735,14 @@ void FCookedAssetWriter::WriteSinglePackage( FPackageId PackageId, bool bIsOptio
 	SerializationContext.PackageHeaderFilename = PackageFilename;
 	SerializationContext.BundleData = &ExportBundleEntry;
 	SerializationContext.IoStoreReader = Reader.Get();
+	SerializationContext.ChunkPrefetcher = &ChunkPrefetcher;
+	SerializationContext.PackageChunkIndex = PackageChunkIndex;
+	const TSharedPtr<FMappedIoStoreContainer>* MappedContainer = MappedContainers.Find( Reader->GetContainerId() );
+	SerializationContext.MappedContainer = MappedContainer ? MappedContainer->Get() : nullptr;
 
-	FSavedPackageInfo& SavedPackageInfo = SavedPackageMap.FindOrAdd( SerializationContext.BundleData->PackageName );
-	SavedPackageInfo.ExportBundleChunks.Add( SerializationContext.BundleData->PackageChunkId );
+	OutPackageInfo.PackageId = PackageId;
+	OutPackageInfo.PackageName = SerializationContext.BundleData->PackageName;
+	OutPackageInfo.PackageChunkId = SerializationContext.BundleData->PackageChunkId;
 
 	// Populate package summary, and also process imports and exports
 	ProcessPackageSummaryAndNamesAndExportsAndImports( SerializationContext );
@@ -191,8 +758,8 @@ void FCookedAssetWriter::WriteSinglePackage( FPackageId PackageId, bool bIsOptio
 		}
 		const FString ExportsFilename = FPaths::ChangeExtension( SerializationContext.PackageHeaderFilename, ExtensionString );
 
-		const TUniquePtr<FArchive> ExportsArchive( IFileManager::Get().CreateFileWriter( *ExportsFilename, FILEWRITE_EvenIfReadOnly ) );
-		checkf( ExportsArchive.IsValid(), TEXT("Failed to load exports file '%s'"), *ExportsFilename );
+		// Size is intentionally not provided, archive sinks buffering the file do not block other threads while the package chunk is being read
+		const TUniquePtr<FArchive> ExportsArchive = OutputSink->CreateFileWriter( ExportsFilename );
 	
 		// Write the exports. This will also fix-up serial offsets on the export map entries in the summary
 		WritePackageExports( *ExportsArchive, SerializationContext );
@@ -210,40 +777,45 @@ void FCookedAssetWriter::WriteSinglePackage( FPackageId PackageId, bool bIsOptio
 			ExtensionString.InsertAt( 0, TEXT(".o") );
 		}
 		const FString HeaderFilename = FPaths::ChangeExtension( SerializationContext.PackageHeaderFilename, ExtensionString );
-		
-		FString RelativeFilename = FPaths::SetExtension( ExportBundleEntry.PackageFilename, ExtensionString );
-		ChunkIdToSavedFileMap.Add( SerializationContext.BundleData->PackageChunkId, RelativeFilename );
-
-		const TUniquePtr<FArchive> HeaderArchive( IFileManager::Get().CreateFileWriter( *HeaderFilename, FILEWRITE_EvenIfReadOnly ) );
-		checkf( HeaderArchive.IsValid(), TEXT("Failed to open header file '%s'"), *HeaderFilename );
+		OutPackageInfo.WrittenFiles.Add( { SerializationContext.BundleData->PackageChunkId, HeaderFilename } );
 
-		FAssetSerializationWriter ProxyWriter( *HeaderArchive, &SerializationContext );
-		WritePackageHeader( ProxyWriter, SerializationContext );
-		HeaderArchive->Flush();
+		// Header is built in memory in a single forward pass and then written to the file at once
+		TArray<uint8> HeaderData;
+		HeaderData.Reserve( ComputePackageHeaderLayout( SerializationContext ) );
+		{
+			FMemoryWriter HeaderWriter( HeaderData, true );
+			FAssetSerializationWriter ProxyWriter( HeaderWriter, &SerializationContext );
+			WritePackageHeader( ProxyWriter, SerializationContext );
+		}
+		OutputSink->WriteFile( HeaderFilename, HeaderData );
 	}
 
 	// Write bulk data
-	WriteBulkData( SerializationContext );
+	WriteBulkData( SerializationContext, OutPackageInfo );
 
 	// Notify the user that we have finished writing the asset
-	UE_LOG( LogIoStoreTools, Display, TEXT("Serialized Package '%s' to '%s'"), *SerializationContext.BundleData->PackageName.ToString(), *SerializationContext.PackageHeaderFilename );
-	NumPackagesWritten++;
+	OutPackageInfo.ArenaCounters = PackageArenaScope.GetCounters();
+	UE_LOG( LogIoStoreTools, Display, TEXT("Serialized Package '%s' to '%s' (%llu arena allocations, %llu bytes)"), *SerializationContext.BundleData->PackageName.ToString(), *SerializationContext.PackageHeaderFilename,
+		OutPackageInfo.ArenaCounters.NumAllocations, OutPackageInfo.ArenaCounters.NumBytesAllocated );
 }
 
 FPackageIndex FCookedAssetWriter::FindExistingObjectImport( FPackageIndex OuterIndex, FName ObjectName, FAssetSerializationContext& Context )
 {
-	for ( int32 ImportIndex = 0; ImportIndex < Context.ImportMap.Num(); ImportIndex++ )
+	if ( const int32* ExistingImportIndex = Context.ImportLookupMap.Find( { OuterIndex, ObjectName } ) )
 	{
-		const FObjectImport& ExistingObjectImport = Context.ImportMap[ ImportIndex ];
-
-		if ( ExistingObjectImport.OuterIndex == OuterIndex && ExistingObjectImport.ObjectName == ObjectName )
-		{
-			return FPackageIndex::FromImport( ImportIndex );
-		}
+		return FPackageIndex::FromImport( *ExistingImportIndex );
 	}
 	return FPackageIndex();
 }
 
+void FCookedAssetWriter::RegisterObjectImport( int32 ImportIndex, FAssetSerializationContext& Context )
+{
+	const FObjectImport& ObjectImport = Context.ImportMap[ ImportIndex ];
+
+	// First import with the given outer and name wins, same as it would with a linear search over the import map
+	Context.ImportLookupMap.FindOrAdd( { ObjectImport.OuterIndex, ObjectImport.ObjectName }, ImportIndex );
+}
+
 FPackageIndex FCookedAssetWriter::CreatePackageImport( FName PackageName, FAssetSerializationContext& Context )
 {
 	// Package import of our own package is always 0
@@ -263,6 +835,7 @@ FPackageIndex FCookedAssetWriter::CreatePackageImport( FName PackageName, FAsset
 		NewPackageImport.ClassPackage = ClassPath.GetPackageName();
 		NewPackageImport.ClassName = ClassPath.GetAssetName();
 		NewPackageImport.ObjectName = PackageName;
+		RegisterObjectImport( ImportIndex, Context );
 
 		ImportedPackageIndex = FPackageIndex::FromImport( ImportIndex );
 	}
@@ -271,64 +844,42 @@ FPackageIndex FCookedAssetWriter::CreatePackageImport( FName PackageName, FAsset
 
 FPackageIndex FCookedAssetWriter::CreateScriptObjectImport(const FPackageObjectIndex& PackageObjectIndex, FAssetSerializationContext& Context) const
 {
-	FPackageMapScriptObjectEntry ScriptObjectEntry;
-	check( PackageMap->FindScriptObject( PackageObjectIndex, ScriptObjectEntry ) );
-		
-	// If the outer index is null, we are making a top level UPackage import
-	if ( ScriptObjectEntry.OuterIndex.IsNull() )
-	{
-		return CreatePackageImport( ScriptObjectEntry.ObjectName, Context );
-	}
+	// Path of the script object is flattened when the script objects are read, so the imports are created without walking the script object map
+	const TArrayView<const FPackageMapScriptObjectPathEntry> ScriptObjectPath = PackageMap->FindScriptObjectPath( PackageObjectIndex );
+	check( !ScriptObjectPath.IsEmpty() );
 
-	// Otherwise we should have a valid outer, and we need to resolve it first
-	const FPackageIndex OuterObjectIndex = CreateScriptObjectImport( ScriptObjectEntry.OuterIndex, Context );
-	FPackageIndex ResultObjectIndex = FindExistingObjectImport( OuterObjectIndex, ScriptObjectEntry.ObjectName, Context );
+	// Outermost object is always a top level UPackage import
+	FPackageIndex ResultObjectIndex = CreatePackageImport( ScriptObjectPath[ 0 ].ObjectName, Context );
 
-	// We couldn't find it, need to create one
-	if ( ResultObjectIndex.IsNull() )
+	for ( int32 PathIndex = 1; PathIndex < ScriptObjectPath.Num(); PathIndex++ )
 	{
-		const int32 ImportIndex = Context.ImportMap.AddDefaulted();
-		FObjectImport& NewObjectImport = Context.ImportMap[ ImportIndex ];
+		const FPackageMapScriptObjectPathEntry& PathEntry = ScriptObjectPath[ PathIndex ];
+		const FPackageIndex OuterObjectIndex = ResultObjectIndex;
+		ResultObjectIndex = FindExistingObjectImport( OuterObjectIndex, PathEntry.ObjectName, Context );
 
-		// Guessing the ScriptObject Class is a bit difficult for non-top-level objects, as they can be UClass, UFunction, UEnum or UScriptStruct
-		// If this is the CDO though, we know that it's Class is the ScriptObject specified in the CDO index
-		if ( !ScriptObjectEntry.CDOClassIndex.IsNull() )
+		// We couldn't find it, need to create one
+		if ( ResultObjectIndex.IsNull() )
 		{
-			const FPackageIndex CDOClassPackageIndex = CreateScriptObjectImport( ScriptObjectEntry.CDOClassIndex, Context );
+			const int32 ImportIndex = Context.ImportMap.AddDefaulted();
 
-			const FTopLevelAssetPath ClassPath = ResolvePackagePath( CDOClassPackageIndex, Context ).GetAssetPath();
-			NewObjectImport.ClassName = ClassPath.GetAssetName();
-			NewObjectImport.ClassPackage = ClassPath.GetPackageName();
-		}
-		// We know nothing about the object otherwise, can be a top level object, can be a default sub-object of some native object
-		else
-		{
-			const FTopLevelAssetPath ClassPath = UObject::StaticClass()->GetClassPathName();
-			NewObjectImport.ClassName = ClassPath.GetAssetName();
-			NewObjectImport.ClassPackage = ClassPath.GetPackageName();
-		}
-	
-		NewObjectImport.OuterIndex = OuterObjectIndex;
-		NewObjectImport.ObjectName = ScriptObjectEntry.ObjectName;
-	
-		ResultObjectIndex = FPackageIndex::FromImport( ImportIndex );
-	}
-	return ResultObjectIndex;
-}
+			// Class of the CDO still gets an import of its own, created after the CDO import itself
+			if ( !PathEntry.CDOClassIndex.IsNull() )
+			{
+				CreateScriptObjectImport( PathEntry.CDOClassIndex, Context );
+			}
 
-int32 FCookedAssetWriter::FindPackageExportByHash(const FPackageMapExportBundleEntry& PackageBundle, uint64 ExportHash)
-{
-	int32 FoundExportIndex = INDEX_NONE;
+			// Resolving the class might have added new imports, so the import map might have been re-allocated by now
+			FObjectImport& NewObjectImport = Context.ImportMap[ ImportIndex ];
+			NewObjectImport.ClassName = PathEntry.ClassPath.GetAssetName();
+			NewObjectImport.ClassPackage = PathEntry.ClassPath.GetPackageName();
+			NewObjectImport.OuterIndex = OuterObjectIndex;
+			NewObjectImport.ObjectName = PathEntry.ObjectName;
+			RegisterObjectImport( ImportIndex, Context );
 
-	for ( int32 i = 0; i < PackageBundle.ExportMap.Num(); i++ )
-	{
-		if ( PackageBundle.ExportMap[ i ].PublicExportHash == ExportHash )
-		{
-			FoundExportIndex = i;
-			break;
+			ResultObjectIndex = FPackageIndex::FromImport( ImportIndex );
 		}
 	}
-	return FoundExportIndex;
+	return ResultObjectIndex;
 }
 
 FPackageIndex FCookedAssetWriter::CreateExternalPackageObjectReference(const FPublicExportKey& PackageImport, FAssetSerializationContext& Context) const
@@ -337,19 +888,19 @@ FPackageIndex FCookedAssetWriter::CreateExternalPackageObjectReference(const FPu
 	if ( PackageImport.GetPackageId() != Context.PackageId )
 	{
 		// Resolve exported package bundle first
-		FPackageMapExportBundleEntry ImportedPackageBundle;
-		check( PackageMap->FindExportBundleData( PackageImport.GetPackageId(), ImportedPackageBundle ) );
+		const FPackageMapExportBundleEntry* ImportedPackageBundle = PackageMap->FindExportBundleData( PackageImport.GetPackageId() );
+		check( ImportedPackageBundle );
 		
 		// Find the index of the export with the specified hash
-		const int32 PackageExportIndex = FindPackageExportByHash( ImportedPackageBundle, PackageImport.GetExportHash() );
+		const int32 PackageExportIndex = PackageMap->FindPublicExportIndex( PackageImport );
 		check( PackageExportIndex != INDEX_NONE );
 
 		// Call the internal function that will recursively populate exports
-		return CreatePackageExportReference( &ImportedPackageBundle, PackageExportIndex, Context );
+		return CreatePackageExportReference( ImportedPackageBundle, PackageExportIndex, Context );
 	}
 
 	// This is somehow an import being resolved into our own package, so this is actually an export reference
-	const int32 PackageExportIndex = FindPackageExportByHash( *Context.BundleData, PackageImport.GetExportHash() );
+	const int32 PackageExportIndex = PackageMap->FindPublicExportIndex( PackageImport );
 
 	// These should never point to the root of the package, so the simple hash lookup should be good
 	check( PackageExportIndex != INDEX_NONE );
@@ -362,10 +913,10 @@ FPackageIndex FCookedAssetWriter::CreateExternalPackageReference(const FPackageI
 	if ( PackageId != Context.PackageId )
 	{
 		// Resolve exported package bundle first
-		FPackageMapExportBundleEntry ImportedPackageBundle;
-		check( PackageMap->FindExportBundleData( PackageId, ImportedPackageBundle ) );
+		const FPackageMapExportBundleEntry* ImportedPackageBundle = PackageMap->FindExportBundleData( PackageId );
+		check( ImportedPackageBundle );
 
-		return CreatePackageImport( ImportedPackageBundle.PackageName, Context );
+		return CreatePackageImport( ImportedPackageBundle->PackageName, Context );
 	}
 
 	// Reference to the current package itself
@@ -374,30 +925,25 @@ FPackageIndex FCookedAssetWriter::CreateExternalPackageReference(const FPackageI
 
 FPackageIndex FCookedAssetWriter::ResolvePackageLocalRef( const FPackageMapExportBundleEntry* ExternalPackageData, const FPackageLocalObjectRef& ObjectRef, FAssetSerializationContext& Context ) const
 {
-	// If our object is an imported package, resolve the import
-	if ( ObjectRef.bIsImport )
+	// Reference to the native script object
+	if ( ObjectRef.IsScriptImport() )
 	{
-		const FPackageMapImportEntry& ImportedObject = ObjectRef.Import;
-
-		// Reference to the native script object
-		if ( ImportedObject.bIsScriptImport )
-		{
-			return CreateScriptObjectImport( ImportedObject.ScriptImportIndex, Context );
-		}
-		// Reference to the object inside of the another package
-		if ( ImportedObject.bIsPackageImport )
-		{
-			return CreateExternalPackageObjectReference( ImportedObject.PackageExportKey, Context );
-		}
+		return CreateScriptObjectImport( ObjectRef.GetScriptImportIndex(), Context );
+	}
+	// Reference to the object inside of the another package. Import keys are owned by the package the ref belongs to
+	if ( ObjectRef.IsPackageImport() )
+	{
+		const FPackageMapExportBundleEntry* OwnerPackageData = ExternalPackageData ? ExternalPackageData : Context.BundleData;
+		return CreateExternalPackageObjectReference( OwnerPackageData->GetPackageImportKey( ObjectRef ), Context );
 	}
 	// Reference to an export inside of the current package
-	else if ( ObjectRef.bIsExportReference )
+	if ( ObjectRef.IsExport() )
 	{
-		return CreatePackageExportReference( ExternalPackageData, ObjectRef.ExportIndex, Context );
+		return CreatePackageExportReference( ExternalPackageData, ObjectRef.GetExportIndex(), Context );
 	}
 
 	// Otherwise this is Null. Meaning of null depends on the context in which local reference is being deserialized
-	check( ObjectRef.bIsNull || ObjectRef.Import.bIsNullImport );
+	check( ObjectRef.IsNull() );
 	
 	// If we are resolving a reference in the scope of the external package, this would always be a reference to the external package as an import
 	if ( ExternalPackageData != nullptr )
@@ -413,85 +959,42 @@ FPackageIndex FCookedAssetWriter::CreatePackageExportReference( const FPackageMa
 	// Only attempt to resolve package data if this is an external package we are attempting to import
 	if ( ExternalPackageData != nullptr && ExternalPackageData->PackageName != Context.BundleData->PackageName )
 	{
-		const FPackageMapExportEntry& ExportData = ExternalPackageData->ExportMap[ ExportIndex ];
-	
-		// Resolve the outer for the exported object first
-		const FPackageIndex OuterIndex = ResolvePackageLocalRef( ExternalPackageData, ExportData.OuterIndex, Context );
+		// Outer chain of the export and the class paths of the objects in it are the same for all packages importing it, so they are only resolved once
+		const FPackageExportChain& ExportChain = ExportChainCache->FindOrResolveChain( ExternalPackageData, ExportIndex );
 
-		// Attempt to find the existing import first
-		FPackageIndex ResultIndex = FindExistingObjectImport( OuterIndex, ExportData.ObjectName, Context );
+		// Resolve the outer of the outermost object first, which is usually the package itself
+		FPackageIndex OuterIndex = ResolvePackageLocalRef( ExternalPackageData, ExportChain.RootOuterIndex, Context );
 
-		// Need to create it if it does not already exist
-		if ( ResultIndex.IsNull() )
+		for ( const FPackageExportChainLink& ChainLink : ExportChain.Links )
 		{
-			const int32 ImportIndex = Context.ImportMap.AddDefaulted();
-			FObjectImport& NewObjectImport = Context.ImportMap[ ImportIndex ];
-
-			// The class name might be one of our exports in case of circular dependencies (which is the point),
-			// so we need to postpone class name fixup for this import until we have written our exports
-			const FPackageIndex ExportClassIndex = ResolvePackageLocalRef( ExternalPackageData, ExportData.ClassIndex, Context );
-		
-			Context.ImportClassPathFixup.Add( ImportIndex, ExportClassIndex );
-			NewObjectImport.OuterIndex = OuterIndex;
-			NewObjectImport.ObjectName = ExportData.ObjectName;
+			// Attempt to find the existing import first
+			FPackageIndex ResultIndex = FindExistingObjectImport( OuterIndex, ChainLink.ObjectName, Context );
 
-			ResultIndex = FPackageIndex::FromImport( ImportIndex );
-		}
-		return ResultIndex;
-	}
-	
-	// Otherwise this is a reference to the export of the currently serialized package
-	return FPackageIndex::FromExport( ExportIndex );
-}
-
-FSoftObjectPath FCookedAssetWriter::ResolvePackagePath( FPackageIndex PackageIndex, FAssetSerializationContext& Context )
-{
-	// Collect the asset path
-	TArray<FName> TotalAssetPath;
-	FPackageIndex CurrentPackageIndex = PackageIndex;
-
-	while ( !CurrentPackageIndex.IsNull() )
-	{
-		if ( CurrentPackageIndex.IsImport() )
-		{
-			const FObjectResource& PackageResource = Context.ImportMap[ CurrentPackageIndex.ToImport() ];
-			TotalAssetPath.Add( PackageResource.ObjectName );
-			CurrentPackageIndex = PackageResource.OuterIndex;
-		}
-		else if ( CurrentPackageIndex.IsExport() )
-		{
-			const FObjectResource& PackageResource = Context.ExportMap[ CurrentPackageIndex.ToExport() ];
-			TotalAssetPath.Add( PackageResource.ObjectName );
-			CurrentPackageIndex = PackageResource.OuterIndex;
-
-			// If outer index is Null, we need to manually append package name of the currently exported package
-			if ( CurrentPackageIndex.IsNull() )
+			// Need to create it if it does not already exist
+			if ( ResultIndex.IsNull() )
 			{
-				TotalAssetPath.Add( Context.BundleData->PackageName );
-			}
-		}
-	}
+				const int32 ImportIndex = Context.ImportMap.AddDefaulted();
 
-	// Flip the asset path to the Outermost.Outer:Inner
-	Algo::Reverse( TotalAssetPath );
+				// The class still needs an import of its own. It is created after the object, so the imports keep the order they have always been created in
+				ResolvePackageLocalRef( ExternalPackageData, ChainLink.ClassIndex, Context );
 
-	// Build top level asset path
-	const FName PackageName = TotalAssetPath.IsValidIndex( 0 ) ? TotalAssetPath[ 0 ] : NAME_None;
-	const FName TopLevelAssetName = TotalAssetPath.IsValidIndex( 1 ) ? TotalAssetPath[ 1 ] : NAME_None;
+				// Resolving the class might have added new imports, so the import map might have been re-allocated by now
+				FObjectImport& NewObjectImport = Context.ImportMap[ ImportIndex ];
+				NewObjectImport.ClassName = ChainLink.ClassPath.GetAssetName();
+				NewObjectImport.ClassPackage = ChainLink.ClassPath.GetPackageName();
+				NewObjectImport.OuterIndex = OuterIndex;
+				NewObjectImport.ObjectName = ChainLink.ObjectName;
+				RegisterObjectImport( ImportIndex, Context );
 
-	// Build sub-object path, starting at index 2 (0 is package name, 1 is asset name)
-	TStringBuilder<128> SubObjectPathBuilder;
-	for ( int32 i = 2; i < TotalAssetPath.Num(); i++ )
-	{
-		if ( i != 2 )
-		{
-			SubObjectPathBuilder.AppendChar( SUBOBJECT_DELIMITER_CHAR );
+				ResultIndex = FPackageIndex::FromImport( ImportIndex );
+			}
+			OuterIndex = ResultIndex;
 		}
-		TotalAssetPath[ i ].ToString( SubObjectPathBuilder );
+		return OuterIndex;
 	}
-
-	// Finally construct the soft object path
-	return FSoftObjectPath( FTopLevelAssetPath( PackageName, TopLevelAssetName ), SubObjectPathBuilder.ToString() );
+	
+	// Otherwise this is a reference to the export of the currently serialized package
+	return FPackageIndex::FromExport( ExportIndex );
 }
 
 void FExportPreloadDependencyList::AddDependency( uint32 CurrentCommand, FPackageIndex FromIndex, uint32 FromCommand )
@@ -502,22 +1005,22 @@ void FExportPreloadDependencyList::AddDependency( uint32 CurrentCommand, FPackag
 		{
 			if ( FromCommand == FExportBundleEntry::ExportCommandType_Create )
 			{
-				CreateBeforeCreateDependencies.AddUnique( FromIndex );
+				CreateBeforeCreateDependencies.Add( FromIndex );
 			}
 			else if ( FromCommand == FExportBundleEntry::ExportCommandType_Serialize )
 			{
-				SerializeBeforeCreateDependencies.AddUnique( FromIndex );
+				SerializeBeforeCreateDependencies.Add( FromIndex );
 			}
 		}
 		else if ( CurrentCommand == FExportBundleEntry::ExportCommandType_Serialize )
 		{
 			if ( FromCommand == FExportBundleEntry::ExportCommandType_Create )
 			{
-				CreateBeforeSerializeDependencies.AddUnique( FromIndex );
+				CreateBeforeSerializeDependencies.Add( FromIndex );
 			}
 			else if ( FromCommand == FExportBundleEntry::ExportCommandType_Serialize )
 			{
-				SerializeBeforeSerializeDependencies.AddUnique( FromIndex );
+				SerializeBeforeSerializeDependencies.Add( FromIndex );
 			}
 		}
 	}
@@ -525,7 +1028,7 @@ void FExportPreloadDependencyList::AddDependency( uint32 CurrentCommand, FPackag
 
 FExportBundleEntry FCookedAssetWriter::BuildPreloadDependenciesFromExportBundle( int32 ExportBundleIndex, FAssetSerializationContext& Context )
 {
-	const TArray<FExportBundleEntry>& ExportBundle = Context.BundleData->ExportBundles[ ExportBundleIndex ];
+	const TArrayView<const FExportBundleEntry> ExportBundle = Context.BundleData->GetExportBundle( ExportBundleIndex );
 	
 	// Only attempt to build the bundle if we have not done it before (this might be called multiple times in case bundles depend on each other)
 	if ( !Context.ProcessedExportBundles.Contains( ExportBundleIndex ) )
@@ -535,25 +1038,19 @@ FExportBundleEntry FCookedAssetWriter::BuildPreloadDependenciesFromExportBundle(
     	FExportPreloadDependencyList& FirstPreloadDependency = Context.PreloadDependencies[ FirstExportInBundle.LocalExportIndex ];
     
     	// Add internal dependencies to the first export in the bundle
-    	for ( const FPackageMapInternalDependencyArc& InternalDependency : Context.BundleData->InternalArcs )
+    	for ( const FPackageMapInternalDependencyArc& InternalDependency : Context.BundleData->GetInternalArcsToExportBundle( ExportBundleIndex ) )
     	{
-    		if ( InternalDependency.ToExportBundleIndex == ExportBundleIndex )
-    		{
-    			const FExportBundleEntry LastExportInBundle = BuildPreloadDependenciesFromExportBundle( InternalDependency.FromExportBundleIndex, Context );
-    			const FPackageIndex ExportIndex = FPackageIndex::FromExport( LastExportInBundle.LocalExportIndex );
-    			
-    			FirstPreloadDependency.AddDependency( FirstExportInBundle.CommandType, ExportIndex, LastExportInBundle.CommandType );
-    		}
+    		const FExportBundleEntry LastExportInBundle = BuildPreloadDependenciesFromExportBundle( InternalDependency.FromExportBundleIndex, Context );
+    		const FPackageIndex ExportIndex = FPackageIndex::FromExport( LastExportInBundle.LocalExportIndex );
+    		
+    		FirstPreloadDependency.AddDependency( FirstExportInBundle.CommandType, ExportIndex, LastExportInBundle.CommandType );
     	}
     	
     	// Add external dependencies to the first export in the bundle
-    	for ( const FPackageMapExternalDependencyArc& ExternalDependency : Context.BundleData->ExternalArcs )
+    	for ( const FPackageMapExternalDependencyArc& ExternalDependency : Context.BundleData->GetExternalArcsToExportBundle( ExportBundleIndex ) )
     	{
-    		if ( ExternalDependency.ToExportBundleIndex == ExportBundleIndex )
-    		{
-    			const FPackageIndex ImportIndex = FPackageIndex::FromImport( ExternalDependency.FromImportIndex );
-    			FirstPreloadDependency.AddDependency( FirstExportInBundle.CommandType, ImportIndex, ExternalDependency.FromCommandType );
-    		}
+    		const FPackageIndex ImportIndex = FPackageIndex::FromImport( ExternalDependency.FromImportIndex );
+    		FirstPreloadDependency.AddDependency( FirstExportInBundle.CommandType, ImportIndex, ExternalDependency.FromCommandType );
     	}
     
     	// Go over the exports in the bundle in their order and add dependency on the previous one for each export
@@ -575,6 +1072,7 @@ FExportBundleEntry FCookedAssetWriter::BuildPreloadDependenciesFromExportBundle(
 void FCookedAssetWriter::BuildPreloadDependenciesFromArcs(FAssetSerializationContext& Context)
 {
 	// Setup preload dependencies with the export sizes
+	Context.PreloadDependencies.Reserve( Context.ExportMap.Num() );
 	for ( int32 ExportIndex = 0; ExportIndex < Context.ExportMap.Num(); ExportIndex++ )
 	{
 		FExportPreloadDependencyList& PreloadDependencyList = Context.PreloadDependencies.AddDefaulted_GetRef();
@@ -582,7 +1080,7 @@ void FCookedAssetWriter::BuildPreloadDependenciesFromArcs(FAssetSerializationCon
 	}
 	
 	// Build export bundles in their order of definition
-	for ( int32 ExportBundleIndex = 0; ExportBundleIndex < Context.BundleData->ExportBundles.Num(); ExportBundleIndex++ )
+	for ( int32 ExportBundleIndex = 0; ExportBundleIndex < Context.BundleData->ExportBundleCount; ExportBundleIndex++ )
 	{
 		BuildPreloadDependenciesFromExportBundle( ExportBundleIndex, Context );
 	}
@@ -608,12 +1106,12 @@ void FCookedAssetWriter::BuildPreloadDependenciesFromExports(FAssetSerialization
 	}
 }
 
-void FCookedAssetWriter::ReorderPackageImports(const TArray<int32>& OriginalImportOrder, FAssetSerializationContext& Context)
+void FCookedAssetWriter::ReorderPackageImports(const TArray<int32, TPackageArenaAllocator<>>& OriginalImportOrder, FAssetSerializationContext& Context)
 {
 	// Initialize the index map with prebuilt indices
-	TArray<int32> OldIndexToNewIndexMap;
-	TArray<int32> NewIndexToOldIndexMap;
-	TBitArray<> FilledIndices;
+	TArray<int32, TPackageArenaAllocator<>> OldIndexToNewIndexMap;
+	TArray<int32, TPackageArenaAllocator<>> NewIndexToOldIndexMap;
+	TBitArray<TPackageArenaAllocator<>> FilledIndices;
 	
 	OldIndexToNewIndexMap.AddUninitialized( Context.ImportMap.Num() );
 	NewIndexToOldIndexMap.AddUninitialized( OldIndexToNewIndexMap.Num() );
@@ -643,7 +1141,8 @@ void FCookedAssetWriter::ReorderPackageImports(const TArray<int32>& OriginalImpo
 	}
 
 	// Build the new import table with the indices remapped
-	TArray<FObjectImport> NewImports;
+	TArray<FObjectImport, TPackageArenaAllocator<>> NewImports;
+	NewImports.Reserve( Context.ImportMap.Num() );
 
 	for ( int32 NewIndex = 0; NewIndex < Context.ImportMap.Num(); NewIndex++ )
 	{
@@ -656,21 +1155,14 @@ void FCookedAssetWriter::ReorderPackageImports(const TArray<int32>& OriginalImpo
 		NewImport.OuterIndex = OldImport.OuterIndex.IsImport() ? FPackageIndex::FromImport( OldIndexToNewIndexMap[ OldImport.OuterIndex.ToImport() ] ) : OldImport.OuterIndex;
 		NewImport.ObjectName = OldImport.ObjectName;
 	}
-	Context.ImportMap = NewImports;
+	Context.ImportMap = MoveTemp( NewImports );
 
-	// Rebuild import fixup map
-	TMap<int32, FPackageIndex> ObjectFixupMap;
-
-	for ( const TPair<int32, FPackageIndex>& Pair : Context.ImportClassPathFixup )
+	// Rebuild the import lookup map with the new indices
+	Context.ImportLookupMap.Reset();
+	for ( int32 ImportIndex = 0; ImportIndex < Context.ImportMap.Num(); ImportIndex++ )
 	{
-		const int32 OldIndex = Pair.Key;
-		const FPackageIndex OldIndexValue = Pair.Value;
-
-		const int32 NewIndex = OldIndexToNewIndexMap[ OldIndex ];
-		const FPackageIndex NewIndexValue = OldIndexValue.IsImport() ? FPackageIndex::FromImport( OldIndexToNewIndexMap[ OldIndexValue.ToImport() ] ) : OldIndexValue;
-		ObjectFixupMap.Add( NewIndex, NewIndexValue );
+		RegisterObjectImport( ImportIndex, Context );
 	}
-	Context.ImportClassPathFixup = ObjectFixupMap;
 }
 
 FPackageIndex FCookedAssetWriter::CreateObjectExport( const FPackageMapExportEntry& ExportData, FAssetSerializationContext& Context ) const
@@ -735,36 +1227,42 @@ void FCookedAssetWriter::ProcessPackageSummaryAndNamesAndExportsAndImports( FAss
 		Summary.SetToLatestFileVersions( true );
 	}
 
-	// Clone name map into the Context
-	for ( const FName& NameMapName : Context.BundleData->NameMap )
+	// Clone name map into the Context. Arena allocations are never grown in place, so the containers with a known size are reserved upfront
+	const int32 NumPackageNames = Context.BundleData->GetNameMapNum();
+	Context.NameMap.Reserve( NumPackageNames );
+	Context.NameReverseLookupMap.Reserve( NumPackageNames );
+	for ( int32 PackageNameIndex = 0; PackageNameIndex < NumPackageNames; PackageNameIndex++ )
 	{
+		const FName NameMapName = Context.BundleData->GetNameMapEntry( PackageNameIndex );
 		check( NameMapName.GetNumber() == NAME_NO_NUMBER_INTERNAL );
 		
 		const int32 NameIndex = Context.NameMap.Add( NameMapName );
 		Context.NameReverseLookupMap.Add( NameMapName, NameIndex );
 	}
-	Summary.NamesReferencedFromExportDataCount = Context.BundleData->NameMap.Num();
+	Summary.NamesReferencedFromExportDataCount = NumPackageNames;
 
 	// Read package header because we need it to re-hydrate our imports
-	FPackageHeaderData PackageHeaderData;
-	check( PackageMap->FindPackageHeader( Context.PackageId, PackageHeaderData ) );
+	const FPackageHeaderData* PackageHeaderDataPtr = PackageMap->FindPackageHeader( Context.PackageId );
+	check( PackageHeaderDataPtr );
+	const FPackageHeaderData& PackageHeaderData = *PackageHeaderDataPtr;
 
 	// Resolve import entries from the bundle
 	int32 CurrentImportedPackageIndex = 0;
-	TArray<int32> OriginalImportOrder;
+	TArray<int32, TPackageArenaAllocator<>> OriginalImportOrder;
+	OriginalImportOrder.Reserve( Context.BundleData->GetImportMap().Num() );
 	
-	for ( const FPackageMapImportEntry& ImportMapEntry : Context.BundleData->ImportMap )
+	for ( const FPackageLocalObjectRef& ImportMapEntry : Context.BundleData->GetImportMap() )
 	{
 		// Resolve script import first
-		if ( ImportMapEntry.bIsScriptImport )
+		if ( ImportMapEntry.IsScriptImport() )
 		{
-			const FPackageIndex TopmostImportIndex = CreateScriptObjectImport( ImportMapEntry.ScriptImportIndex, Context );
+			const FPackageIndex TopmostImportIndex = CreateScriptObjectImport( ImportMapEntry.GetScriptImportIndex(), Context );
 			OriginalImportOrder.Add( TopmostImportIndex.ToImport() );
 		}
 		// Otherwise attempt to resolve package import
-		else if ( ImportMapEntry.bIsPackageImport )
+		else if ( ImportMapEntry.IsPackageImport() )
 		{
-			const FPackageIndex TopmostImportIndex = CreateExternalPackageObjectReference( ImportMapEntry.PackageExportKey, Context );
+			const FPackageIndex TopmostImportIndex = CreateExternalPackageObjectReference( Context.BundleData->GetPackageImportKey( ImportMapEntry ), Context );
 			OriginalImportOrder.Add( TopmostImportIndex.ToImport() );
 		}
 		// Otherwise it is a null import
@@ -782,21 +1280,12 @@ void FCookedAssetWriter::ProcessPackageSummaryAndNamesAndExportsAndImports( FAss
 	ReorderPackageImports( OriginalImportOrder, Context );
 
 	// Resolve export entries from the bundle
-	for ( const FPackageMapExportEntry& ExportMapEntry : Context.BundleData->ExportMap )
+	Context.ExportMap.Reserve( Context.BundleData->GetExportMap().Num() );
+	for ( const FPackageMapExportEntry& ExportMapEntry : Context.BundleData->GetExportMap() )
 	{
 		CreateObjectExport( ExportMapEntry, Context );
 	}
 
-	// Apply late import class path fix-ups
-	for ( const TPair<int32, FPackageIndex>& ImportClassPathPair : Context.ImportClassPathFixup )
-	{
-		FObjectImport& ObjectImport = Context.ImportMap[ ImportClassPathPair.Key ];
-		const FTopLevelAssetPath& ClassPath = ResolvePackagePath( ImportClassPathPair.Value, Context ).GetAssetPath();
-
-		ObjectImport.ClassName = ClassPath.GetAssetName();
-		ObjectImport.ClassPackage = ClassPath.GetPackageName();
-	}
-	
 	Summary.ExportCount = Context.ExportMap.Num();
 	Summary.ImportCount = Context.ImportMap.Num();
 
@@ -804,76 +1293,198 @@ void FCookedAssetWriter::ProcessPackageSummaryAndNamesAndExportsAndImports( FAss
 	BuildPreloadDependenciesFromArcs( Context );
 }
 
-void FCookedAssetWriter::WritePackageHeader(FArchive& Ar, FAssetSerializationContext& Context)
+/** Archive that does not write anything and only counts the number of bytes serialized into it, used to compute the layout of the package header */
+class FPackageHeaderSizeCounter final : public FArchive
+{
+	int64 NumBytesSerialized{0};
+public:
+	FPackageHeaderSizeCounter()
+	{
+		SetIsSaving( true );
+		SetIsPersistent( true );
+	}
+
+	virtual void Serialize( void* Data, int64 Num ) override
+	{
+		NumBytesSerialized += Num;
+	}
+
+	virtual int64 Tell() override
+	{
+		return NumBytesSerialized;
+	}
+
+	virtual int64 TotalSize() override
+	{
+		return NumBytesSerialized;
+	}
+};
+
+int64 FCookedAssetWriter::ComputePackageHeaderLayout( FAssetSerializationContext& Context )
 {
 	check( Context.Summary.GetPackageFlags() & PKG_FilterEditorOnly );
-	
-	// Collect NameMap references from import and export map before we attempt to serialize them
+
+	// Collect NameMap references from import and export map before we attempt to serialize them. Editor only data is not filtered here,
+	// so the package names of the imports end up in the name map the same way they do when the package is saved by the editor
 	{
-		FArchive dummyArchive{};
-		FAssetSerializationWriter nameMapCollector{ dummyArchive, &Context };
+		FPackageHeaderSizeCounter NullArchive;
+		FAssetSerializationWriter NameMapCollector{ NullArchive, &Context };
 
 		for ( FObjectImport& Import : Context.ImportMap )
 		{
-			nameMapCollector << Import;
+			NameMapCollector << Import;
 		}
 		for ( FObjectExport& Export : Context.ExportMap )
 		{
-			nameMapCollector << Export;
+			NameMapCollector << Export;
 		}
 	}
 
+	// Measure the import and export map the way they are written. Serializing the summary enables editor only data filtering for the rest of the header,
+	// which skips the package names of the imports. None of the offsets written into the header affect the size of the serialized data,
+	// so the whole layout can be computed before anything is written
+	int64 ImportMapSize;
+	int64 ExportMapSize;
+	{
+		FPackageHeaderSizeCounter SizeCounter;
+		FAssetSerializationWriter SizeCounterProxy{ SizeCounter, &Context };
+		SizeCounterProxy.SetFilterEditorOnly( true );
+
+		for ( FObjectImport& Import : Context.ImportMap )
+		{
+			SizeCounterProxy << Import;
+		}
+		ImportMapSize = SizeCounter.Tell();
+
+		for ( FObjectExport& Export : Context.ExportMap )
+		{
+			SizeCounterProxy << Export;
+		}
+		ExportMapSize = SizeCounter.Tell() - ImportMapSize;
+	}
+
 	// Write dummy generation info for current generation
 	{
 		FGenerationInfo& GenerationInfo = Context.Summary.Generations.AddZeroed_GetRef();
 		GenerationInfo.ExportCount = Context.ExportMap.Num();
 		GenerationInfo.NameCount = Context.NameMap.Num();
 	}
-	
-	// Write dummy package summary that we will patch up later
-	Ar << Context.Summary;
-	Context.PackageSummaryEndOffset = Ar.Tell();
-	
-	// Write Name Map
-	Context.Summary.NameOffset = Context.PackageSummaryEndOffset;
 	Context.Summary.NameCount = Context.NameMap.Num();
+
+	// Set the dependency counts on the exports
+	Context.Summary.PreloadDependencyCount = 0;
+	for ( int32 i = 0; i < Context.PreloadDependencies.Num(); i++ )
+	{
+		const FExportPreloadDependencyList& PreloadDependency = Context.PreloadDependencies[ i ];
+		FObjectExport& ObjectExport = Context.ExportMap[ i ];
+
+		ObjectExport.FirstExportDependency = Context.Summary.PreloadDependencyCount;
+		ObjectExport.SerializationBeforeSerializationDependencies = PreloadDependency.SerializeBeforeSerializeDependencies.Num();
+		ObjectExport.CreateBeforeSerializationDependencies = PreloadDependency.CreateBeforeSerializeDependencies.Num();
+		ObjectExport.SerializationBeforeCreateDependencies = PreloadDependency.SerializeBeforeCreateDependencies.Num();
+		ObjectExport.CreateBeforeCreateDependencies = PreloadDependency.CreateBeforeCreateDependencies.Num();
+
+		Context.Summary.PreloadDependencyCount += ObjectExport.SerializationBeforeSerializationDependencies +
+			ObjectExport.CreateBeforeSerializationDependencies + ObjectExport.SerializationBeforeCreateDependencies + ObjectExport.CreateBeforeCreateDependencies;
+	}
+
+	// Filter out editor only data from the package summary
+	Context.Summary.SoftPackageReferencesCount = 0;
+	Context.Summary.SoftPackageReferencesOffset = 0;
+	Context.Summary.SearchableNamesOffset = 0;
+
+	// Thumbnails are not written for cooked packages
+	Context.Summary.ThumbnailTableOffset = 0;
+
+	// Legacy World Composition information, we do not have a way to obtain it and it is not used
+	Context.Summary.WorldTileInfoDataOffset = 0;
+
+	// We do not support package trailer based bulk data serialized, it can only be loaded by the editor bulk data
+	Context.Summary.PayloadTocOffset = INDEX_NONE;
+
+	// Measure the summary and the name map. Summary is measured with the offsets not filled in yet, but the size of it does not depend on them
+	int64 SummarySize;
+	int64 NameMapSize;
 	{
+		FPackageHeaderSizeCounter SizeCounter;
+		FAssetSerializationWriter SizeCounterProxy{ SizeCounter, &Context };
+
+		SizeCounterProxy << Context.Summary;
+		SummarySize = SizeCounter.Tell();
+
 		TGuardValue WritingNameMapGuard( Context.bSerializingNameMap, true );
-		
 		for ( FName& NameMapEntry : Context.NameMap )
 		{
-			Ar << NameMapEntry;
+			SizeCounterProxy << NameMapEntry;
 		}
+		NameMapSize = SizeCounter.Tell() - SummarySize;
 	}
 	// We cannot add new names to the map after this point
 	Context.bNameMapWrittenToFile = true;
 
 	// Soft Object Paths are not present in the cooked assets
 	// GatherableText are not present in the cooked assets
+	Context.Summary.NameOffset = (int32) SummarySize;
+	Context.Summary.ImportOffset = (int32) ( Context.Summary.NameOffset + NameMapSize );
+	Context.Summary.ExportOffset = (int32) ( Context.Summary.ImportOffset + ImportMapSize );
 
-	// Save Import Map
+	// Depend Map is not populated for cooked packages, so it's just an empty array for each export
+	Context.Summary.DependsOffset = (int32) ( Context.Summary.ExportOffset + ExportMapSize );
+	const int64 DependsMapSize = Context.ExportMap.Num() * (int64) sizeof( int32 );
+
+	// Asset registry data is filtered out for cooked packages, only the number of objects is written
+	Context.Summary.AssetRegistryDataOffset = (int32) ( Context.Summary.DependsOffset + DependsMapSize );
+	Context.Summary.PreloadDependencyOffset = Context.Summary.AssetRegistryDataOffset + (int32) sizeof( int32 );
+
+	// Update total header size
+	Context.Summary.TotalHeaderSize = Context.Summary.PreloadDependencyOffset + Context.Summary.PreloadDependencyCount * (int32) sizeof( FPackageIndex );
+	// Add TotalHeaderSize to the BulkDataStartOffset
+	Context.Summary.BulkDataStartOffset += Context.Summary.TotalHeaderSize;
+
+	// Fixup SerialOffset in ExportMap to take header size into account
+	for ( FObjectExport& Export : Context.ExportMap )
 	{
-		Context.Summary.ImportOffset = (int32) Ar.Tell();
-		for ( FObjectImport& Import : Context.ImportMap )
-		{
-			Ar << Import;
-		}
+		Export.SerialOffset += Context.Summary.TotalHeaderSize;
 	}
+	return Context.Summary.TotalHeaderSize;
+}
+
+void FCookedAssetWriter::WritePackageHeader(FArchive& Ar, FAssetSerializationContext& Context)
+{
+	checkf( Context.bNameMapWrittenToFile, TEXT("Package header layout must be computed before writing the header") );
+	const int64 HeaderStartOffset = Ar.Tell();
+
+	Ar << Context.Summary;
+	checkf( Ar.IsFilterEditorOnly(), TEXT("Package header must be written with editor only data filtered out, the same way its layout has been measured") );
+	checkf( Ar.Tell() - HeaderStartOffset == Context.Summary.NameOffset, TEXT("Package summary size %lld does not match the measured size %d"), Ar.Tell() - HeaderStartOffset, Context.Summary.NameOffset );
 
-	// Save Dummy Export Map
-	Context.ExportMapStartOffset = Ar.Tell();
+	// Write Name Map
 	{
-		Context.Summary.ExportOffset = (int32) Ar.Tell();
-		for ( FObjectExport& Export : Context.ExportMap )
+		TGuardValue WritingNameMapGuard( Context.bSerializingNameMap, true );
+		
+		for ( FName& NameMapEntry : Context.NameMap )
 		{
-			Ar << Export;
+			Ar << NameMapEntry;
 		}
 	}
 
-	// Save Dummy Depend Map, not populated for cooked packages
+	// Save Import Map
+	checkf( Ar.Tell() - HeaderStartOffset == Context.Summary.ImportOffset, TEXT("Name map ends at %lld instead of the measured offset %d"), Ar.Tell() - HeaderStartOffset, Context.Summary.ImportOffset );
+	for ( FObjectImport& Import : Context.ImportMap )
 	{
-		Context.Summary.DependsOffset = (int32) Ar.Tell();
+		Ar << Import;
+	}
 
+	// Save Export Map
+	checkf( Ar.Tell() - HeaderStartOffset == Context.Summary.ExportOffset, TEXT("Import map ends at %lld instead of the measured offset %d"), Ar.Tell() - HeaderStartOffset, Context.Summary.ExportOffset );
+	for ( FObjectExport& Export : Context.ExportMap )
+	{
+		Ar << Export;
+	}
+
+	// Save Depend Map, not populated for cooked packages
+	checkf( Ar.Tell() - HeaderStartOffset == Context.Summary.DependsOffset, TEXT("Export map ends at %lld instead of the measured offset %d"), Ar.Tell() - HeaderStartOffset, Context.Summary.DependsOffset );
+	{
 		TArray<FPackageIndex> Depends; // empty array
 		for (int32 ExportIndex = 0; ExportIndex < Context.ExportMap.Num(); ++ExportIndex)
 		{
@@ -881,106 +1492,49 @@ void FCookedAssetWriter::WritePackageHeader(FArchive& Ar, FAssetSerializationCon
 		}
 	}
 
-	// Filter out editor only data from the package summary
-	Context.Summary.SoftPackageReferencesCount = 0;
-	Context.Summary.SoftPackageReferencesOffset = 0;
-	Context.Summary.SearchableNamesOffset = 0;
-
-	// Thumbnails are not written for cooked packages
-	Context.Summary.ThumbnailTableOffset = 0;
-	
 	// Asset registry data is filtered out for cooked packages
-	Context.Summary.AssetRegistryDataOffset = (int32) Ar.Tell();
+	check( Ar.Tell() - HeaderStartOffset == Context.Summary.AssetRegistryDataOffset );
 	{
 		int32 DummyAssetObjectCount = 0;
 		Ar << DummyAssetObjectCount;
 	}
-	
-	// Legacy World Composition information, we do not have a way to obtain it and it is not used
-	Context.Summary.WorldTileInfoDataOffset = 0;
 
 	// Write Preload Dependencies
-	Context.Summary.PreloadDependencyOffset = (int32) Ar.Tell();
+	check( Ar.Tell() - HeaderStartOffset == Context.Summary.PreloadDependencyOffset );
+	for ( const FExportPreloadDependencyList& PreloadDependency : Context.PreloadDependencies )
 	{
-		Context.Summary.PreloadDependencyCount = 0;
-
-		for ( int32 i = 0; i < Context.PreloadDependencies.Num(); i++ )
+		for ( FPackageIndex PackageIndex : PreloadDependency.SerializeBeforeSerializeDependencies )
 		{
-			FExportPreloadDependencyList& PreloadDependency = Context.PreloadDependencies[ i ];
-			FObjectExport& ObjectExport = Context.ExportMap[ i ];
-
-			// Set the dependency counts on the export
-			ObjectExport.FirstExportDependency = Context.Summary.PreloadDependencyCount;
-			ObjectExport.SerializationBeforeSerializationDependencies = PreloadDependency.SerializeBeforeSerializeDependencies.Num();
-			ObjectExport.CreateBeforeSerializationDependencies = PreloadDependency.CreateBeforeSerializeDependencies.Num();
-			ObjectExport.SerializationBeforeCreateDependencies = PreloadDependency.SerializeBeforeCreateDependencies.Num();
-			ObjectExport.CreateBeforeCreateDependencies = PreloadDependency.CreateBeforeCreateDependencies.Num();
-
-			Context.Summary.PreloadDependencyCount += ObjectExport.SerializationBeforeSerializationDependencies +
-				ObjectExport.CreateBeforeSerializationDependencies + ObjectExport.SerializationBeforeCreateDependencies + ObjectExport.CreateBeforeCreateDependencies;
-			
-			// Write the actual dependencies into the archive
-			for ( FPackageIndex& PackageIndex : PreloadDependency.SerializeBeforeSerializeDependencies )
-			{
-				Ar << PackageIndex;
-			}
-			for ( FPackageIndex& PackageIndex : PreloadDependency.CreateBeforeSerializeDependencies )
-			{
-				Ar << PackageIndex;
-			}
-			for ( FPackageIndex& PackageIndex : PreloadDependency.SerializeBeforeCreateDependencies )
-			{
-				Ar << PackageIndex;
-			}
-			for ( FPackageIndex& PackageIndex : PreloadDependency.CreateBeforeCreateDependencies )
-			{
-				Ar << PackageIndex;
-			}
+			Ar << PackageIndex;
 		}
-	}
-
-	// We do not support package trailer based bulk data serialized, it can only be loaded by the editor bulk data
-	Context.Summary.PayloadTocOffset = INDEX_NONE;
-
-	// Update total header size
-	Context.Summary.TotalHeaderSize = (int32) Ar.Tell();
-	// Add TotalHeaderSize to the BulkDataStartOffset
-	Context.Summary.BulkDataStartOffset += Context.Summary.TotalHeaderSize;
-
-	// Fixup SerialOffset in ExportMap to take header size into account
-	{
-		const int64 OffsetBeforeSeek = Ar.Tell();
-		Ar.Seek( Context.ExportMapStartOffset );
-
-		for ( FObjectExport& Export : Context.ExportMap )
+		for ( FPackageIndex PackageIndex : PreloadDependency.CreateBeforeSerializeDependencies )
 		{
-			Export.SerialOffset += Context.Summary.TotalHeaderSize;
-			Ar << Export;
+			Ar << PackageIndex;
+		}
+		for ( FPackageIndex PackageIndex : PreloadDependency.SerializeBeforeCreateDependencies )
+		{
+			Ar << PackageIndex;
+		}
+		for ( FPackageIndex PackageIndex : PreloadDependency.CreateBeforeCreateDependencies )
+		{
+			Ar << PackageIndex;
 		}
-		Ar.Seek( OffsetBeforeSeek );
-	}
-
-	// Write the finalized package header
-	{
-		const int64 OffsetBeforeSeek = Ar.Tell();
-		Ar.Seek( 0 );
-		Ar << Context.Summary;
-		Ar.Seek( OffsetBeforeSeek );
 	}
+	checkf( Ar.Tell() - HeaderStartOffset == Context.Summary.TotalHeaderSize, TEXT("Package header size %lld does not match the computed header size %d"), Ar.Tell() - HeaderStartOffset, Context.Summary.TotalHeaderSize );
 }
 
 void FCookedAssetWriter::WritePackageExports(FArchive& Ar, FAssetSerializationContext& Context)
 {
-	// Open the package bundle chunk to read exports
-	TIoStatusOr<FIoBuffer> ChunkBuffer = Context.IoStoreReader->Read( Context.BundleData->PackageChunkId, FIoReadOptions() );
-	check( ChunkBuffer.IsOk() );
-	const uint8* ChunkDataStart = ChunkBuffer.ValueOrDie().Data();
-	const uint8* ChunkDataEnd = ChunkDataStart + ChunkBuffer.ValueOrDie().DataSize();
+	// Package bundle chunk has been read ahead by the prefetcher, most of the time it is already available by now
+	const FIoBuffer ChunkBuffer = Context.ChunkPrefetcher->RetrieveChunk( Context.PackageChunkIndex );
+	const uint8* ChunkDataStart = ChunkBuffer.Data();
+	const uint8* ChunkDataEnd = ChunkDataStart + ChunkBuffer.DataSize();
 	
 	// Write export blobs
+	const TArrayView<const FPackageMapExportEntry> OriginalExportMap = Context.BundleData->GetExportMap();
 	for ( int32 i = 0; i < Context.ExportMap.Num(); i++ )
 	{
-		const FPackageMapExportEntry& OriginalExport = Context.BundleData->ExportMap[ i ];
+		const FPackageMapExportEntry& OriginalExport = OriginalExportMap[ i ];
 		FObjectExport& Export = Context.ExportMap[ i ];
 
 		Export.SerialOffset = Ar.Tell();
@@ -997,25 +1551,68 @@ void FCookedAssetWriter::WritePackageExports(FArchive& Ar, FAssetSerializationCo
 	Ar << FooterData;
 }
 
-void FCookedAssetWriter::WriteBulkData( const FAssetSerializationContext& Context )
+void FCookedAssetWriter::WriteBulkData( const FAssetSerializationContext& Context, FWrittenPackageInfo& OutPackageInfo ) const
 {
-	FSavedPackageInfo& SavedPackageInfo = SavedPackageMap.FindOrAdd( Context.BundleData->PackageName );
-	
-	for ( const FIoChunkId& BulkDataChunkId : Context.BundleData->BulkDataChunkIds )
+	for ( const FIoChunkId& BulkDataChunkId : Context.BundleData->GetBulkDataChunkIds() )
 	{
-		TIoStatusOr<FIoBuffer> BulkDataBuffer = Context.IoStoreReader->Read( BulkDataChunkId, FIoReadOptions() );
-		check( BulkDataBuffer.IsOk() );
-
 		TIoStatusOr<FIoStoreTocChunkInfo> ChunkInfo = Context.IoStoreReader->GetChunkInfo( BulkDataChunkId );
 		check( ChunkInfo.IsOk() );
 
 		FString RelativeFilename = ChunkInfo.ValueOrDie().FileName;
 		RelativeFilename.RemoveFromStart( TEXT("../../../") );
 
-		const FString ResultFilename = FPaths::Combine( RootOutputDir, RelativeFilename );
-		FFileHelper::SaveArrayToFile( TArrayView<const uint8>( BulkDataBuffer.ValueOrDie().Data(), BulkDataBuffer.ValueOrDie().DataSize() ), *ResultFilename );
+		// Duplicates of the files written before are not written at all, they become links to them at the end of the extraction
+		const FBulkDataDeduplicator::FContentSource ContentSource{ Context.IoStoreReader, Context.MappedContainer, BulkDataChunkId, ChunkInfo.ValueOrDie().Size };
+		FString LinkTarget;
+		if ( !BulkDataDeduplicator || BulkDataDeduplicator->RegisterFile( RelativeFilename, ChunkInfo.ValueOrDie().Hash, ContentSource, LinkTarget ) )
+		{
+			const TUniquePtr<FArchive> BulkDataArchive = OutputSink->CreateFileWriter( RelativeFilename, ChunkInfo.ValueOrDie().Size );
+			OutPackageInfo.BulkDataReadWaitSeconds += CopyChunkToArchive( *Context.IoStoreReader, Context.MappedContainer, BulkDataChunkId, ChunkInfo.ValueOrDie().Size, *BulkDataArchive );
+		}
+
+		OutPackageInfo.WrittenFiles.Add( { BulkDataChunkId, RelativeFilename } );
+		OutPackageInfo.BulkDataChunks.Add( BulkDataChunkId );
+	}
+}
+
+double FCookedAssetWriter::CopyChunkToArchive( const FIoStoreReader& Reader, const FMappedIoStoreContainer* MappedContainer, const FIoChunkId& ChunkId, uint64 ChunkSize, FArchive& Ar )
+{
+	// Uncompressed chunks in the mapped container file are written straight from the mapping, without reading them into the intermediate buffers
+	TArrayView64<const uint8> MappedChunkData;
+	if ( MappedContainer && MappedContainer->TryGetChunkData( ChunkId, MappedChunkData ) )
+	{
+		check( static_cast<uint64>( MappedChunkData.Num() ) == ChunkSize );
+		Ar.Serialize( const_cast<uint8*>( MappedChunkData.GetData() ), MappedChunkData.Num() );
+		return 0.0;
+	}
+
+	// Bulk data chunks can be hundreds of megabytes, so they are copied a few compression blocks at a time instead of being read at once.
+	// Chunks always start at the compression block boundary, so reading at block size multiples decompresses each block exactly once
+	const uint64 CompressionBlockSize = Reader.GetCompressionBlockSize() != 0 ? Reader.GetCompressionBlockSize() : DefaultBulkDataReadSize;
+	const uint64 ReadSize = CompressionBlockSize * BulkDataBlocksPerRead;
+
+	// Next reads are issued while the current one is written, but no more than the window allows to keep the memory usage bounded
+	TArray<UE::Tasks::TTask<TIoStatusOr<FIoBuffer>>, TInlineAllocator<BulkDataReadAheadWindow>> PendingReads;
+	uint64 NextReadOffset = 0;
+	uint64 ReadWaitCycles = 0;
+
+	while ( NextReadOffset < ChunkSize || !PendingReads.IsEmpty() )
+	{
+		while ( PendingReads.Num() < BulkDataReadAheadWindow && NextReadOffset < ChunkSize )
+		{
+			const uint64 CurrentReadSize = FMath::Min( ReadSize, ChunkSize - NextReadOffset );
+			PendingReads.Add( Reader.ReadAsync( ChunkId, FIoReadOptions( NextReadOffset, CurrentReadSize ) ) );
+			NextReadOffset += CurrentReadSize;
+		}
+
+		const uint64 ReadWaitStartCycles = FPlatformTime::Cycles64();
+		TIoStatusOr<FIoBuffer>& ReadResult = PendingReads[ 0 ].GetResult();
+		ReadWaitCycles += FPlatformTime::Cycles64() - ReadWaitStartCycles;
+		checkf( ReadResult.IsOk(), TEXT("Failed to read chunk: %s"), *ReadResult.Status().ToString() );
 
-		ChunkIdToSavedFileMap.Add( BulkDataChunkId, RelativeFilename );
-		SavedPackageInfo.BulkDataChunks.Add( BulkDataChunkId );
+		FIoBuffer& ReadBuffer = ReadResult.ValueOrDie();
+		Ar.Serialize( ReadBuffer.Data(), ReadBuffer.DataSize() );
+		PendingReads.RemoveAt( 0, 1, false );
 	}
+	return FPlatformTime::ToSeconds64( ReadWaitCycles );
 }
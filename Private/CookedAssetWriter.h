@@ -4,11 +4,17 @@
 
 #include "CoreMinimal.h"
 #include "IoStorePackageMap.h"
+#include "PackageArena.h"
 #include "UObject/ObjectResource.h"
 #include "UObject/PackageFileSummary.h"
 
 class FIoStorePackageMap;
 class FIoStoreReader;
+class IPackageOutputSink;
+class FPackageChunkPrefetcher;
+class FMappedIoStoreContainer;
+class FBulkDataDeduplicator;
+class FPackageExportChainCache;
 
 // Because FPackageFileSummary::SetPackageFlags is not marked as COREUOBJECT_API for whatever fucking reason
 struct FUglyPackageSummaryPackageFlagsAccessWorkaround
@@ -20,39 +26,46 @@ struct FUglyPackageSummaryPackageFlagsAccessWorkaround
 	uint32 PackageFlags;
 };
 
+/** Set of the preload dependencies. Dependencies are never removed from it, so it iterates in the order they have been added in */
+using FPreloadDependencySet = TSet<FPackageIndex, DefaultKeyFuncs<FPackageIndex>, TInlineSetAllocator<4, FPackageArenaSetAllocator>>;
+
 struct FExportPreloadDependencyList
 {
 	FPackageIndex OwnerIndex;
-	TArray<FPackageIndex, TInlineAllocator<4>> CreateBeforeCreateDependencies;
-	TArray<FPackageIndex, TInlineAllocator<4>> SerializeBeforeCreateDependencies;
-	TArray<FPackageIndex, TInlineAllocator<4>> CreateBeforeSerializeDependencies;
-	TArray<FPackageIndex, TInlineAllocator<4>> SerializeBeforeSerializeDependencies;
+	FPreloadDependencySet CreateBeforeCreateDependencies;
+	FPreloadDependencySet SerializeBeforeCreateDependencies;
+	FPreloadDependencySet CreateBeforeSerializeDependencies;
+	FPreloadDependencySet SerializeBeforeSerializeDependencies;
 
 	void AddDependency( uint32 CurrentCommand, FPackageIndex FromIndex, uint32 FromCommand );
 };
 
+/** State of the package being written. Containers are allocated from the package arena, so the context must not outlive the FPackageArenaScope it has been created in */
 struct FAssetSerializationContext
 {
 	FPackageId PackageId;
 	FString PackageHeaderFilename;
-	FPackageMapExportBundleEntry* BundleData;
+	const FPackageMapExportBundleEntry* BundleData;
 	FIoStoreReader* IoStoreReader;
+	/** Provides the package chunk, read ahead of the package being written */
+	FPackageChunkPrefetcher* ChunkPrefetcher;
+	int32 PackageChunkIndex;
+	/** Memory mapped container file the uncompressed chunks are copied from directly, if available */
+	const FMappedIoStoreContainer* MappedContainer;
 	
 	FPackageFileSummary Summary;
-	int32 PackageSummaryEndOffset;
-	int32 ExportMapStartOffset;
 
-	TArray<FName> NameMap;
-	TMap<FName, int32> NameReverseLookupMap;
+	TArray<FName, TPackageArenaAllocator<>> NameMap;
+	TMap<FName, int32, FPackageArenaSetAllocator> NameReverseLookupMap;
 	bool bNameMapWrittenToFile{false};
 	bool bSerializingNameMap{false};
 	
-	TArray<FObjectImport> ImportMap;
-	TArray<FObjectExport> ExportMap;
-	TArray<FExportPreloadDependencyList> PreloadDependencies;
-	TSet<int32> ProcessedExportBundles;
-	/** Fix-ups to apply to import class paths after both imports and exports of this package are resolved */
-	TMap<int32, FPackageIndex> ImportClassPathFixup;
+	TArray<FObjectImport, TPackageArenaAllocator<>> ImportMap;
+	/** Lookup of the imports by their outer and object name, kept in sync with the ImportMap */
+	TMap<TPair<FPackageIndex, FName>, int32, FPackageArenaSetAllocator> ImportLookupMap;
+	TArray<FObjectExport, TPackageArenaAllocator<>> ExportMap;
+	TArray<FExportPreloadDependencyList, TPackageArenaAllocator<>> PreloadDependencies;
+	TSet<int32, DefaultKeyFuncs<int32>, FPackageArenaSetAllocator> ProcessedExportBundles;
 };
 
 class FAssetSerializationWriter : public FArchiveProxy
@@ -71,29 +84,152 @@ struct FSavedPackageInfo
 	TArray<FIoChunkId> BulkDataChunks;
 };
 
+/** Files written for a single package. Gathered by the workers and merged into the writer state in the original package order */
+struct FWrittenPackageInfo
+{
+	FPackageId PackageId;
+	FName PackageName;
+	FIoChunkId PackageChunkId;
+	/** Files written for this package along with the chunks they have been produced from, in the order they have been written */
+	TArray<TPair<FIoChunkId, FString>> WrittenFiles;
+	TArray<FIoChunkId> BulkDataChunks;
+	/** Hash of the package chunk and the bulk data chunks of the package, as recorded in the container. Only computed for incremental extraction */
+	FSHAHash ChunkHash;
+	/** Hash of the export layouts of the packages the imports of this package are resolved through and of the script objects. Only computed for incremental extraction */
+	FSHAHash ImportsHash;
+	/** True if the package has not changed since the previous extraction, and the files written by it have been kept as they are */
+	bool bUnchangedSincePreviousExtraction{false};
+	/** Allocations made from the package arena while writing the package. Not saved into the extraction state */
+	FAllocationCounters ArenaCounters;
+	/** Time spent waiting for the bulk data chunk reads while writing the package. Not saved into the extraction state */
+	double BulkDataReadWaitSeconds{0.0};
+
+	friend FArchive& operator<<( FArchive& Ar, FWrittenPackageInfo& PackageInfo );
+};
+
+/** Identifies the package inside of the specific container, since patched packages are written once for each container they are in */
+using FContainerPackageKey = TPair<FIoContainerId, FPackageId>;
+
 class ZENTOOLS_API FCookedAssetWriter
 {
 protected:
 	TSharedPtr<FIoStorePackageMap> PackageMap;
 	FString RootOutputDir;
+	/** Receives all files written, relative to the output root */
+	TSharedPtr<IPackageOutputSink> OutputSink;
+	int32 NumWorkerThreads;
+	/** Number of package chunk reads kept in flight ahead of the packages being written */
+	int32 MaxChunkReadsInFlight;
 	int32 NumPackagesWritten;
 	TMap<FIoChunkId, FString> ChunkIdToSavedFileMap;
 	TMap<FName, FSavedPackageInfo> SavedPackageMap;
+	/** True if packages that have not changed since the previous extraction into the same directory should not be written again */
+	bool bIncrementalExtraction;
+	int32 NumPackagesUnchanged;
+	FSHAHash ScriptObjectsHash;
+	/** Export layout hashes of the packages imported by the packages written, computed once for all packages importing them */
+	mutable FRWLock ExportLayoutHashesLock;
+	mutable TMap<FPackageId, FSHAHash> ExportLayoutHashes;
+	/** Packages written by the previous extraction, loaded from the extraction state file */
+	TMap<FContainerPackageKey, FWrittenPackageInfo> PreviousExtractionState;
+	/** Packages written or kept by this extraction, saved into the extraction state file */
+	TMap<FContainerPackageKey, FWrittenPackageInfo> ExtractionState;
+	/**
+	 * Containers the files of each package in the output directory have been written from, by the previous extraction and by this one. Packages present in multiple containers
+	 * are written for each one of them, and the last one wins, so this is the container the package is resolved from
+	 */
+	TMap<FPackageId, FIoContainerId> PreviousPackageOutputContainers;
+	TMap<FPackageId, FIoContainerId> PackageOutputContainers;
+	/** Container each package is going to be resolved from by this extraction, known upfront from the order of the containers */
+	TMap<FPackageId, FIoContainerId> ExpectedPackageOutputContainers;
+	/** Packages present in the containers of this extraction. Packages from the previous extraction that are not in any of them anymore are dropped from the state */
+	TSet<FContainerPackageKey> ContainerPackages;
+	/** Packages that have been written by this extraction. Packages present in multiple containers must be written again for each one of them once written */
+	TSet<FPackageId> PackagesWrittenThisExtraction;
+	/** If set, only these packages are written */
+	TOptional<TSet<FPackageId>> SelectedPackages;
+	/** Memory mapped files of the containers that are not encrypted */
+	TMap<FIoContainerId, TSharedPtr<FMappedIoStoreContainer>> MappedContainers;
+	/**
+	 * Statistics of the extraction pipeline, summed over all worker threads. Reading the package chunks ahead of the workers, processing the packages on the workers,
+	 * and writing the files behind them run in parallel, and the time the workers spend waiting for the other stages shows which one is the bottleneck
+	 */
+	double WorkerAvailableSeconds;
+	double WorkerBusySeconds;
+	double WorkerReadWaitSeconds;
+	/** Time the workers have spent waiting for the output to write all files of the container before moving to the next one, or to be finalized. Counted as waiting for the writes */
+	double WorkerFlushWaitSeconds;
+	/** Allocations made from the package arenas by all packages written, and the most made by a single package */
+	FAllocationCounters PackageArenaCounters;
+	FAllocationCounters MaxPackageArenaCounters;
+	int32 NumPackagesArenaCounted;
+	/** If set, bulk data files with identical contents are written once, and the rest become links to them */
+	TSharedPtr<FBulkDataDeduplicator> BulkDataDeduplicator;
+	/** Outer chains of the exports imported by the packages, shared by all packages and worker threads */
+	TSharedPtr<FPackageExportChainCache> ExportChainCache;
 public:
-	FCookedAssetWriter( const TSharedPtr<FIoStorePackageMap>& InPackageMap, const FString& InOutputDir );
+	FCookedAssetWriter( const TSharedPtr<FIoStorePackageMap>& InPackageMap, const FString& InOutputDir, const TSharedPtr<IPackageOutputSink>& InOutputSink, int32 InNumWorkerThreads = 1 );
 	
+	/** Sets the number of package chunk reads kept in flight ahead of the packages being written */
+	void SetMaxChunkReadsInFlight( int32 InMaxChunkReadsInFlight );
+
+	/** Provides the memory mapped file of the container, which will be used to copy the uncompressed chunks instead of reading them */
+	void SetMappedContainer( FIoContainerId ContainerId, const TSharedPtr<FMappedIoStoreContainer>& MappedContainer );
+
+	/** Restricts the packages written to the given set. Packages not in the set are skipped */
+	void SetSelectedPackages( TSet<FPackageId>&& InSelectedPackages );
+
+	/**
+	 * Creates all directories the packages from the given containers are going to be written into in a single pass, so that writing the packages
+	 * does not have to create the directory for each file. Bulk data files are always placed next to the package header, so they do not add any directories.
+	 */
+	void PrepareOutputDirectories( const TArray<TSharedPtr<FIoStoreReader>>& Readers ) const;
+
 	void WritePackagesFromContainer( const TSharedPtr<FIoStoreReader>& Reader );
 	void WriteGlobalScriptObjects( const TSharedPtr<FIoStoreReader>& Reader ) const;
 	void WritePackageStoreManifest() const;
+	/** Writes the same data as the manifest in a compact binary format, for the tools that do not want to parse the JSON */
+	void WriteBinaryPackageStoreManifest() const;
+
+	/**
+	 * Enables incremental extraction. The state of the previous extraction is loaded from the output directory, and only packages which chunks have changed,
+	 * or which imported packages have changed their export layout since then are written again. Containers must be given in the order they are going to be written in
+	 */
+	void EnableIncrementalExtraction( const TArray<TSharedPtr<FIoStoreReader>>& Readers );
+	/**
+	 * Records the packages written by the previous extraction that have not been encountered by this one, so that the manifest still contains them.
+	 * Packages that are not in their container anymore, or which container is not extracted anymore, are dropped
+	 */
+	void RecordPackagesFromPreviousExtraction();
+	/** Enables deduplication of the bulk data files. Files with the same contents as the file written before are turned into links to it once all packages are written */
+	void EnableBulkDataDeduplication();
+	/** Creates the links for the deduplicated bulk data files. Must be called after all packages have been written and before the manifest is written */
+	void CreateDeduplicatedBulkDataLinks();
+
+	/** Finalizes the output sink once all files have been written. Time spent on it is counted as the time the workers wait for the writes */
+	void FinalizeOutput();
+
+	/** Saves the state of this extraction into the output directory, to be used by the next incremental extraction */
+	void WriteExtractionState();
 
 	FORCEINLINE int32 GetTotalNumPackagesWritten() const { return NumPackagesWritten; }
+	FORCEINLINE int32 GetTotalNumPackagesUnchanged() const { return NumPackagesUnchanged; }
+
+	/** Logs how much of the worker threads time has been spent in each stage of the extraction pipeline, and which stage is the bottleneck. Must be called after the output has been finalized */
+	void LogPipelineStatistics() const;
 private:
-	void WriteSinglePackage( FPackageId PackageId, bool bIsOptionalSegmentPackage, const TSharedPtr<FIoStoreReader>& Reader );
+	void WriteSinglePackage( FPackageId PackageId, bool bIsOptionalSegmentPackage, const TSharedPtr<FIoStoreReader>& Reader, FPackageChunkPrefetcher& ChunkPrefetcher, int32 PackageChunkIndex, FWrittenPackageInfo& OutPackageInfo ) const;
+	void RecordWrittenPackage( FIoContainerId ContainerId, const FWrittenPackageInfo& PackageInfo );
+	void ComputePackageHashes( FPackageId PackageId, const FIoStoreReader& Reader, FWrittenPackageInfo& OutPackageInfo ) const;
+	/** Returns the export layout hash of the package, computing it if it has not been computed yet. Can be called from multiple threads at the same time */
+	FSHAHash FindOrComputeExportLayoutHash( const FPackageId& PackageId ) const;
+	bool IsPackageUnchangedSincePreviousExtraction( FIoContainerId ContainerId, const FWrittenPackageInfo& PackageInfo ) const;
+	FString GetExtractionStateFilename() const;
 	void ProcessPackageSummaryAndNamesAndExportsAndImports( FAssetSerializationContext& Context ) const;
 	static FExportBundleEntry BuildPreloadDependenciesFromExportBundle( int32 ExportBundleIndex, FAssetSerializationContext& Context );
 	static void BuildPreloadDependenciesFromArcs( FAssetSerializationContext& Context );
 	static void BuildPreloadDependenciesFromExports( FAssetSerializationContext& Context );
-	static void ReorderPackageImports( const TArray<int32>& OriginalImportOrder, FAssetSerializationContext& Context );
+	static void ReorderPackageImports( const TArray<int32, TPackageArenaAllocator<>>& OriginalImportOrder, FAssetSerializationContext& Context );
 	
 	FPackageIndex CreateScriptObjectImport( const FPackageObjectIndex& PackageObjectIndex, FAssetSerializationContext& Context ) const;
 	FPackageIndex CreateExternalPackageObjectReference( const FPublicExportKey& PackageImport, FAssetSerializationContext& Context ) const;
@@ -103,11 +239,15 @@ private:
 	static FPackageIndex CreatePackageImport( FName PackageName, FAssetSerializationContext& Context );
 	FPackageIndex CreateObjectExport(const FPackageMapExportEntry& ExportData, FAssetSerializationContext& Context ) const;
 	
-	static int32 FindPackageExportByHash( const FPackageMapExportBundleEntry& PackageBundle, uint64 ExportHash );
-	static FSoftObjectPath ResolvePackagePath( FPackageIndex PackageIndex, FAssetSerializationContext& Context );
 	static FPackageIndex FindExistingObjectImport( FPackageIndex OuterIndex, FName ObjectName, FAssetSerializationContext& Context );
+	static void RegisterObjectImport( int32 ImportIndex, FAssetSerializationContext& Context );
 
+	/** Collects the names referenced by the header and computes the offsets of all header sections. Returns the total size of the package header */
+	static int64 ComputePackageHeaderLayout( FAssetSerializationContext& Context );
+	/** Writes the package header in a single forward pass. The layout of the header must have been computed first */
 	static void WritePackageHeader( FArchive& Ar, FAssetSerializationContext& Context );
 	static void WritePackageExports( FArchive& Ar, FAssetSerializationContext& Context );
-	void WriteBulkData(const FAssetSerializationContext& Context );
+	void WriteBulkData( const FAssetSerializationContext& Context, FWrittenPackageInfo& OutPackageInfo ) const;
+	/** Copies the contents of the chunk into the archive a few compression blocks at a time. Returns the time spent waiting for the reads to complete */
+	static double CopyChunkToArchive( const FIoStoreReader& Reader, const FMappedIoStoreContainer* MappedContainer, const FIoChunkId& ChunkId, uint64 ChunkSize, FArchive& Ar );
 };
\ No newline at end of file
@@ -1,11 +1,165 @@
 ﻿// Copyright Nikita Zolotukhin. All Rights Reserved.
 
 #include "IoStorePackageMap.h"
+#include "ZenTools.h"
 #include "Serialization/LargeMemoryReader.h"
 #include "Serialization/MemoryReader.h"
 #include "IO/IoContainerHeader.h"
+#include "UObject/Class.h"
+
+/**
+ * Reads just the header of the package export bundle chunk. The export payloads are only needed when writing the package out,
+ * so we decompress the first compression block to find out the header size and only read further if the header spans multiple blocks.
+ */
+static TIoStatusOr<FIoBuffer> ReadPackageHeaderData( FIoStoreReader& Reader, const FIoStoreTocChunkInfo& ChunkInfo )
+{
+	const uint64 InitialReadSize = FMath::Min<uint64>( ChunkInfo.Size, FMath::Max<uint64>( Reader.GetCompressionBlockSize(), sizeof(FZenPackageSummary) ) );
+	TIoStatusOr<FIoBuffer> InitialBuffer = Reader.Read( ChunkInfo.Id, FIoReadOptions( 0, InitialReadSize ) );
+	if ( !InitialBuffer.IsOk() )
+	{
+		return InitialBuffer;
+	}
+
+	const FZenPackageSummary* PackageSummary = reinterpret_cast<const FZenPackageSummary*>( InitialBuffer.ValueOrDie().Data() );
+	if ( PackageSummary->HeaderSize <= InitialBuffer.ValueOrDie().DataSize() )
+	{
+		return InitialBuffer;
+	}
+	return Reader.Read( ChunkInfo.Id, FIoReadOptions( 0, PackageSummary->HeaderSize ) );
+}
+
+/**
+ * Groups the arcs by the export bundle they lead to and fills in the offset of the first arc for each bundle.
+ * This is a counting sort, so the arcs leading to the same bundle keep their original order, which the order of the preload dependencies depends on.
+ * Arcs leading to the bundles outside of the package are dropped, since nothing would ever look them up.
+ */
+template<typename ArcType>
+static void GroupArcsByExportBundle( TArray<ArcType>& Arcs, int32 ExportBundleCount, TArray<int32>& OutBundleArcOffsets )
+{
+	OutBundleArcOffsets.SetNumZeroed( ExportBundleCount + 1 );
+	for ( const ArcType& Arc : Arcs )
+	{
+		if ( Arc.ToExportBundleIndex >= 0 && Arc.ToExportBundleIndex < ExportBundleCount )
+		{
+			OutBundleArcOffsets[ Arc.ToExportBundleIndex + 1 ]++;
+		}
+	}
+	for ( int32 ExportBundleIndex = 0; ExportBundleIndex < ExportBundleCount; ExportBundleIndex++ )
+	{
+		OutBundleArcOffsets[ ExportBundleIndex + 1 ] += OutBundleArcOffsets[ ExportBundleIndex ];
+	}
+
+	TArray<int32> NextArcIndices( OutBundleArcOffsets.GetData(), ExportBundleCount );
+	TArray<ArcType> GroupedArcs;
+	GroupedArcs.SetNumUninitialized( OutBundleArcOffsets[ ExportBundleCount ] );
+
+	for ( const ArcType& Arc : Arcs )
+	{
+		if ( Arc.ToExportBundleIndex >= 0 && Arc.ToExportBundleIndex < ExportBundleCount )
+		{
+			GroupedArcs[ NextArcIndices[ Arc.ToExportBundleIndex ]++ ] = Arc;
+		}
+	}
+	Arcs = MoveTemp( GroupedArcs );
+}
+
+FIoStorePackageMap::FIoStorePackageMap() : Arenas( MakeUnique<FPackageMapArenas>() )
+{
+}
+
+/** Appends the path to the path characters in UTF-8, and returns the range it has been written into */
+static FPackageMapArenaRange AppendPathCharacters( TArray<uint8>& PathCharacters, FStringView Path )
+{
+	const FTCHARToUTF8 Utf8Path( Path.GetData(), Path.Len() );
+	const FPackageMapArenaRange PathRange{ PathCharacters.Num(), Utf8Path.Length() };
+	PathCharacters.Append( reinterpret_cast<const uint8*>( Utf8Path.Get() ), Utf8Path.Length() );
+	return PathRange;
+}
+
+void FPackageMapArenas::Append( const FPackageMapArenas& Other, const TArray<int32>& OtherNameIndexRemap )
+{
+	NameMapEntries.Reserve( NameMapEntries.Num() + Other.NameMapEntries.Num() );
+	for ( const int32 OtherNameIndex : Other.NameMapEntries )
+	{
+		NameMapEntries.Add( OtherNameIndexRemap[ OtherNameIndex ] );
+	}
+	PathCharacters.Append( Other.PathCharacters );
+	Imports.Append( Other.Imports );
+	PackageImportKeys.Append( Other.PackageImportKeys );
+	Exports.Append( Other.Exports );
+	ExportBundleEntries.Append( Other.ExportBundleEntries );
+	InternalArcs.Append( Other.InternalArcs );
+	ExternalArcs.Append( Other.ExternalArcs );
+	ExportBundleOffsets.Append( Other.ExportBundleOffsets );
+	BulkDataChunkIds.Append( Other.BulkDataChunkIds );
+}
+
+void FPackageMapArenas::Shrink()
+{
+	UniqueNames.Shrink();
+	NameMapEntries.Shrink();
+	PathCharacters.Shrink();
+	PackageDirectories.Shrink();
+	Imports.Shrink();
+	PackageImportKeys.Shrink();
+	Exports.Shrink();
+	ExportBundleEntries.Shrink();
+	InternalArcs.Shrink();
+	ExternalArcs.Shrink();
+	ExportBundleOffsets.Shrink();
+	BulkDataChunkIds.Shrink();
+}
+
+SIZE_T FPackageMapArenas::GetAllocatedSize() const
+{
+	return UniqueNames.GetAllocatedSize() + NameMapEntries.GetAllocatedSize() + PathCharacters.GetAllocatedSize() + PackageDirectories.GetAllocatedSize() + Imports.GetAllocatedSize() + PackageImportKeys.GetAllocatedSize() + Exports.GetAllocatedSize() + ExportBundleEntries.GetAllocatedSize() +
+		InternalArcs.GetAllocatedSize() + ExternalArcs.GetAllocatedSize() + ExportBundleOffsets.GetAllocatedSize() + BulkDataChunkIds.GetAllocatedSize();
+}
+
+FString FPackageMapArenas::GetPath( const FPackageMapArenaRange& Range ) const
+{
+	return FString( Range.Num, reinterpret_cast<const UTF8CHAR*>( PathCharacters.GetData() + Range.Offset ) );
+}
+
+FString FPackageMapExportBundleEntry::GetPackageDirectory() const
+{
+	return Arenas->GetPath( Arenas->PackageDirectories[ PackageDirectoryIndex ] );
+}
+
+FString FPackageMapExportBundleEntry::GetPackageFilename() const
+{
+	const FString PackageFileName = Arenas->GetPath( PackageFileNameRange );
+	const FString PackageDirectory = GetPackageDirectory();
+	return PackageDirectory.IsEmpty() ? PackageFileName : PackageDirectory / PackageFileName;
+}
+
+void FPackageMapExportBundleEntry::RebaseArenaRanges( const FPackageMapArenas& BaseArenas )
+{
+	NameMapRange.Offset += BaseArenas.NameMapEntries.Num();
+	PackageFileNameRange.Offset += BaseArenas.PathCharacters.Num();
+	ImportMapRange.Offset += BaseArenas.Imports.Num();
+	PackageImportKeyRange.Offset += BaseArenas.PackageImportKeys.Num();
+	ExportMapRange.Offset += BaseArenas.Exports.Num();
+	ExportBundleEntryRange.Offset += BaseArenas.ExportBundleEntries.Num();
+	InternalArcRange.Offset += BaseArenas.InternalArcs.Num();
+	ExternalArcRange.Offset += BaseArenas.ExternalArcs.Num();
+	ExportBundleOffsetRange.Offset += BaseArenas.ExportBundleOffsets.Num();
+	BulkDataChunkIdRange.Offset += BaseArenas.BulkDataChunkIds.Num();
+}
 
 void FIoStorePackageMap::PopulateFromContainer(const TSharedPtr<FIoStoreReader>& Reader)
+{
+	ReadContainerHeader( Reader );
+	ReadPackagesFromContainer( Reader );
+}
+
+FIoChunkId FIoStorePackageMap::GetPackageChunkId( const FPackageId& PackageId, bool bIsOptionalSegmentPackage )
+{
+	// Optional chunk has index 1, required one has index 0
+	return CreateIoChunkId( PackageId.Value(), bIsOptionalSegmentPackage ? 1 : 0, EIoChunkType::ExportBundleData );
+}
+
+void FIoStorePackageMap::ReadContainerHeader(const TSharedPtr<FIoStoreReader>& Reader)
 {
 	// If this is a global container, read the Script Objects from it
 	TIoStatusOr<FIoBuffer> ScriptObjectsBuffer = Reader->Read(CreateIoChunkId(0, 0, EIoChunkType::ScriptObjects), FIoReadOptions());
@@ -14,8 +168,7 @@ void FIoStorePackageMap::PopulateFromContainer(const TSharedPtr<FIoStoreReader>&
 		ReadScriptObjects( ScriptObjectsBuffer.ValueOrDie() );
 	}
 
-	TArray<FPackageId> PackageIdsInThisContainer;
-	TArray<FPackageId> OptionalPackageIdsInThisContainer;
+	FPackageContainerMetadata& Metadata = ContainerMetadata.FindOrAdd( Reader->GetContainerId() );
 	
 	// Read the Package Headers from the Container Header of the container.
 	TIoStatusOr<FIoBuffer> ContainerHeaderBuffer = Reader->Read(CreateIoChunkId(Reader->GetContainerId().Value(), 0, EIoChunkType::ContainerHeader), FIoReadOptions());
@@ -39,7 +192,7 @@ void FIoStorePackageMap::PopulateFromContainer(const TSharedPtr<FIoStoreReader>&
 			PackageHeader.ExportCount = ContainerEntry.ExportCount;
 			PackageHeader.ExportBundleCount = ContainerEntry.ExportBundleCount;
 			
-			PackageIdsInThisContainer.Add(PackageId);
+			Metadata.PackagesInContainer.Add(PackageId);
 		}
 
 		int32 OptionalPackageIndex = 0;
@@ -53,100 +206,563 @@ void FIoStorePackageMap::PopulateFromContainer(const TSharedPtr<FIoStoreReader>&
 			PackageHeader.ExportCount = ContainerEntry.ExportCount;
 			PackageHeader.ExportBundleCount = ContainerEntry.ExportBundleCount;
 			
-			OptionalPackageIdsInThisContainer.Add(PackageId);
+			Metadata.OptionalPackagesInContainer.Add(PackageId);
 		}
 	}
+}
+
+void FIoStorePackageMap::ReadPackagesFromContainer(const TSharedPtr<FIoStoreReader>& Reader, const TSet<FPackageId>* PackagesToRead)
+{
+	const FPackageContainerMetadata* Metadata = ContainerMetadata.Find( Reader->GetContainerId() );
+	checkf( Metadata, TEXT("Container header must be read before the packages of the container") );
 
 	// Iterate package chunks from the header
-	for ( const FPackageId& PackageId : PackageIdsInThisContainer )
+	for ( const FPackageId& PackageId : Metadata->PackagesInContainer )
 	{
-		// Optional chunk has index 1, required one has index 0
-		const FIoChunkId ChunkId = CreateIoChunkId( PackageId.Value(), 0, EIoChunkType::ExportBundleData );
+		if ( PackagesToRead && !PackagesToRead->Contains( PackageId ) )
+		{
+			continue;
+		}
+		const FIoChunkId ChunkId = GetPackageChunkId( PackageId, false );
 		
 		TIoStatusOr<FIoStoreTocChunkInfo> ChunkInfo = Reader->GetChunkInfo( ChunkId );
-		TIoStatusOr<FIoBuffer> PackageBuffer = Reader->Read( ChunkId, FIoReadOptions() );
+		check( ChunkInfo.IsOk() );
+		TIoStatusOr<FIoBuffer> PackageBuffer = ReadPackageHeaderData( *Reader, ChunkInfo.ValueOrDie() );
 		check( PackageBuffer.IsOk() );
 
-		FPackageMapExportBundleEntry* ExportBundleEntry = ReadExportBundleData( PackageId, ChunkInfo.ValueOrDie(), PackageBuffer.ValueOrDie() );
-
 		// Required segment packages can have bulk data, memory mapped bulk data and optional bulk data
 		const TArray BulkDataChunkTypes{ EIoChunkType::BulkData, EIoChunkType::MemoryMappedBulkData, EIoChunkType::OptionalBulkData };
+		TArray<FIoChunkId, TInlineAllocator<3>> BulkDataChunkIds;
 
 		for ( const EIoChunkType BulkDataChunkType : BulkDataChunkTypes )
 		{
 			const FIoChunkId BulkDataChunkId = CreateIoChunkId( PackageId.Value(), 0, BulkDataChunkType );
 			if ( Reader->GetChunkInfo( BulkDataChunkId ).IsOk() )
 			{
-				ExportBundleEntry->BulkDataChunkIds.Add( BulkDataChunkId );
+				BulkDataChunkIds.Add( BulkDataChunkId );
 			}
 		}
+		ReadExportBundleData( PackageId, ChunkInfo.ValueOrDie(), PackageBuffer.ValueOrDie(), BulkDataChunkIds );
 	}
 
 	// Iterate optional packages from the header
-	for ( const FPackageId& PackageId : OptionalPackageIdsInThisContainer )
+	for ( const FPackageId& PackageId : Metadata->OptionalPackagesInContainer )
 	{
-		// Optional chunk has index 1, required one has index 0
-		const FIoChunkId ChunkId = CreateIoChunkId( PackageId.Value(), 1, EIoChunkType::ExportBundleData );
+		if ( PackagesToRead && !PackagesToRead->Contains( PackageId ) )
+		{
+			continue;
+		}
+		const FIoChunkId ChunkId = GetPackageChunkId( PackageId, true );
 		
 		TIoStatusOr<FIoStoreTocChunkInfo> ChunkInfo = Reader->GetChunkInfo( ChunkId );
-		TIoStatusOr<FIoBuffer> PackageBuffer = Reader->Read( ChunkId, FIoReadOptions() );
+		check( ChunkInfo.IsOk() );
+		TIoStatusOr<FIoBuffer> PackageBuffer = ReadPackageHeaderData( *Reader, ChunkInfo.ValueOrDie() );
 		check( PackageBuffer.IsOk() );
 		
-		FPackageMapExportBundleEntry* ExportBundleEntry = ReadExportBundleData( PackageId, ChunkInfo.ValueOrDie(), PackageBuffer.ValueOrDie() );
-
 		// Optional segment packages can only have optional segment bulk data
+		TArray<FIoChunkId, TInlineAllocator<1>> BulkDataChunkIds;
 		const FIoChunkId BulkDataChunkId = CreateIoChunkId( PackageId.Value(), 1, EIoChunkType::BulkData );
 		if ( Reader->GetChunkInfo( BulkDataChunkId ).IsOk() )
 		{
-			ExportBundleEntry->BulkDataChunkIds.Add( BulkDataChunkId );
+			BulkDataChunkIds.Add( BulkDataChunkId );
 		}
+		ReadExportBundleData( PackageId, ChunkInfo.ValueOrDie(), PackageBuffer.ValueOrDie(), BulkDataChunkIds );
 	}
 
-	FPackageContainerMetadata& Metadata = ContainerMetadata.FindOrAdd( Reader->GetContainerId() );
+	// Arenas are not going to grow anymore unless the map is merged into, so there is no point in keeping the slack around
+	Arenas->Shrink();
+}
+
+void FIoStorePackageMap::MergeFrom( FIoStorePackageMap&& OtherPackageMap )
+{
+	// Script objects only come from the global container, so this happens once
+	if ( !OtherPackageMap.ScriptObjectMap.IsEmpty() )
+	{
+		ScriptObjectMap.Append( MoveTemp( OtherPackageMap.ScriptObjectMap ) );
+		BuildScriptObjectPaths();
+	}
+	PackageHeaders.Append( MoveTemp( OtherPackageMap.PackageHeaders ) );
+	ContainerMetadata.Append( MoveTemp( OtherPackageMap.ContainerMetadata ) );
+
+	// Names and directories of the other map are interned into this one first, since they are not appended together with the rest of the arenas
+	TArray<int32> NameIndexRemap;
+	NameIndexRemap.Reserve( OtherPackageMap.Arenas->UniqueNames.Num() );
+	for ( const FName& OtherName : OtherPackageMap.Arenas->UniqueNames )
+	{
+		NameIndexRemap.Add( InternName( OtherName ) );
+	}
+	TArray<int32> DirectoryIndexRemap;
+	DirectoryIndexRemap.Reserve( OtherPackageMap.Arenas->PackageDirectories.Num() );
+	for ( const FPackageMapArenaRange& OtherDirectoryRange : OtherPackageMap.Arenas->PackageDirectories )
+	{
+		DirectoryIndexRemap.Add( InternPackageDirectory( OtherPackageMap.Arenas->GetPath( OtherDirectoryRange ) ) );
+	}
+
+	for ( TPair<FPackageId, FPackageMapExportBundleEntry>& PackagePair : OtherPackageMap.PackageMap )
+	{
+		// Public exports of the overriden package need to go, the ones of the new package are added below
+		// Their data stays in the arenas, overrides by the patch containers are rare enough for it to not matter
+		if ( const FPackageMapExportBundleEntry* ExistingPackageData = PackageMap.Find( PackagePair.Key ) )
+		{
+			RemovePublicExports( PackagePair.Key, *ExistingPackageData );
+		}
 
-	Metadata.PackagesInContainer = PackageIdsInThisContainer;
-	Metadata.OptionalPackagesInContainer = OptionalPackageIdsInThisContainer;
+		// Data of the merged packages is appended after the data already in our arenas
+		PackagePair.Value.RebaseArenaRanges( *Arenas );
+		PackagePair.Value.PackageDirectoryIndex = DirectoryIndexRemap[ PackagePair.Value.PackageDirectoryIndex ];
+		PackagePair.Value.Arenas = Arenas.Get();
+		PackageMap.Add( PackagePair.Key, MoveTemp( PackagePair.Value ) );
+	}
+	Arenas->Append( *OtherPackageMap.Arenas, NameIndexRemap );
+	PublicExportMap.Append( MoveTemp( OtherPackageMap.PublicExportMap ) );
+	OtherPackageMap.PackageMap.Empty();
+	OtherPackageMap.Arenas = MakeUnique<FPackageMapArenas>();
+	OtherPackageMap.UniqueNameIndices.Empty();
+	OtherPackageMap.PackageDirectoryIndices.Empty();
 }
 
-bool FIoStorePackageMap::FindPackageContainerMetadata(FIoContainerId ContainerId, FPackageContainerMetadata& OutMetadata) const
+int32 FIoStorePackageMap::InternName( FName Name )
 {
-	if ( const FPackageContainerMetadata* Metadata = ContainerMetadata.Find( ContainerId ) )
+	// Name map entries never have a number, so the display entry identifies the name completely and keeps its original casing
+	if ( const int32* ExistingNameIndex = UniqueNameIndices.Find( Name.GetDisplayIndex() ) )
 	{
-		OutMetadata = *Metadata;
-		return true;
+		return *ExistingNameIndex;
 	}
-	return false;
+	const int32 NameIndex = Arenas->UniqueNames.Add( Name );
+	UniqueNameIndices.Add( Name.GetDisplayIndex(), NameIndex );
+	return NameIndex;
 }
 
-bool FIoStorePackageMap::FindPackageHeader(const FPackageId& PackageId, FPackageHeaderData& OutPackageHeader) const
+int32 FIoStorePackageMap::InternPackageDirectory( const FString& PackageDirectory )
 {
-	if ( const FPackageHeaderData* HeaderData = PackageHeaders.Find( PackageId ) )
+	if ( const int32* ExistingDirectoryIndex = PackageDirectoryIndices.Find( PackageDirectory ) )
 	{
-		OutPackageHeader = *HeaderData;
-		return true;
+		return *ExistingDirectoryIndex;
 	}
-	return false;
+	const int32 DirectoryIndex = Arenas->PackageDirectories.Add( AppendPathCharacters( Arenas->PathCharacters, PackageDirectory ) );
+	PackageDirectoryIndices.Add( PackageDirectory, DirectoryIndex );
+	return DirectoryIndex;
 }
 
-bool FIoStorePackageMap::FindScriptObject(const FPackageObjectIndex& Index, FPackageMapScriptObjectEntry& OutMapEntry) const
+const FPackageContainerMetadata* FIoStorePackageMap::FindPackageContainerMetadata(FIoContainerId ContainerId) const
+{
+	return ContainerMetadata.Find( ContainerId );
+}
+
+const FPackageHeaderData* FIoStorePackageMap::FindPackageHeader(const FPackageId& PackageId) const
+{
+	return PackageHeaders.Find( PackageId );
+}
+
+const FPackageMapScriptObjectEntry* FIoStorePackageMap::FindScriptObject(const FPackageObjectIndex& Index) const
 {
 	check( Index.IsScriptImport() );
-	if ( const FPackageMapScriptObjectEntry* Entry = ScriptObjectMap.Find( Index ) )
+	return ScriptObjectMap.Find( Index );
+}
+
+TArrayView<const FPackageMapScriptObjectPathEntry> FIoStorePackageMap::FindScriptObjectPath( const FPackageObjectIndex& Index ) const
+{
+	check( Index.IsScriptImport() );
+	if ( const FPackageMapArenaRange* PathRange = ScriptObjectPaths.Find( Index ) )
+	{
+		return PathRange->GetView( ScriptObjectPathEntries );
+	}
+	return TArrayView<const FPackageMapScriptObjectPathEntry>();
+}
+
+const FPackageMapExportBundleEntry* FIoStorePackageMap::FindExportBundleData(const FPackageId& PackageId) const
+{
+	return PackageMap.Find( PackageId );
+}
+
+int32 FIoStorePackageMap::FindPublicExportIndex( const FPublicExportKey& ExportKey ) const
+{
+	const int32* ExportIndex = PublicExportMap.Find( ExportKey );
+	return ExportIndex ? *ExportIndex : INDEX_NONE;
+}
+
+int32 FIoStorePackageMap::ReportDanglingImports( const TSet<FPackageId>* PackagesToCheck ) const
+{
+	int32 NumDanglingImports = 0;
+
+	for ( const TPair<FPackageId, FPackageMapExportBundleEntry>& PackagePair : PackageMap )
+	{
+		if ( PackagesToCheck && !PackagesToCheck->Contains( PackagePair.Key ) )
+		{
+			continue;
+		}
+		const FPackageMapExportBundleEntry& PackageData = PackagePair.Value;
+
+		// Package import keys are unique within the package and cover both the import map and the refs of the exports
+		for ( const FPublicExportKey& ImportKey : PackageData.PackageImportKeyRange.GetView( Arenas->PackageImportKeys ) )
+		{
+			if ( !PublicExportMap.Contains( ImportKey ) )
+			{
+				const FPackageMapExportBundleEntry* ImportedPackageData = PackageMap.Find( ImportKey.GetPackageId() );
+				const FString ImportedPackageName = ImportedPackageData ? ImportedPackageData->PackageName.ToString() : FString::Printf( TEXT("0x%llx (not found in any container)"), ImportKey.GetPackageId().Value() );
+
+				UE_LOG( LogIoStoreTools, Warning, TEXT("Package '%s' imports public export 0x%llx from package '%s' that does not exist"), *PackageData.PackageName.ToString(), ImportKey.GetExportHash(), *ImportedPackageName );
+				NumDanglingImports++;
+			}
+		}
+	}
+	return NumDanglingImports;
+}
+
+void FIoStorePackageMap::RemovePublicExports( const FPackageId& PackageId, const FPackageMapExportBundleEntry& PackageData )
+{
+	for ( const FPackageMapExportEntry& Export : PackageData.GetExportMap() )
+	{
+		if ( Export.PublicExportHash != 0 )
+		{
+			PublicExportMap.Remove( FPublicExportKey::MakeKey( PackageId, Export.PublicExportHash ) );
+		}
+	}
+}
+
+FArchive& operator<<( FArchive& Ar, FPackageContainerMetadata& Metadata )
+{
+	Ar << Metadata.PackagesInContainer;
+	Ar << Metadata.OptionalPackagesInContainer;
+	return Ar;
+}
+
+FArchive& operator<<( FArchive& Ar, FPackageHeaderData& HeaderData )
+{
+	Ar << HeaderData.ImportedPackages;
+	Ar << HeaderData.ShaderMapHashes;
+	Ar << HeaderData.ExportCount;
+	Ar << HeaderData.ExportBundleCount;
+	return Ar;
+}
+
+FArchive& operator<<( FArchive& Ar, FPackageMapScriptObjectEntry& ScriptObject )
+{
+	Ar << ScriptObject.ObjectName;
+	Ar << ScriptObject.ScriptObjectIndex;
+	Ar << ScriptObject.OuterIndex;
+	Ar << ScriptObject.CDOClassIndex;
+	return Ar;
+}
+
+FArchive& operator<<( FArchive& Ar, FPackageMapExportEntry& Export )
+{
+	Ar << Export.ObjectName;
+	Ar << Export.OuterIndex;
+	Ar << Export.ClassIndex;
+	Ar << Export.SuperIndex;
+	Ar << Export.TemplateIndex;
+	Ar << Export.PublicExportHash;
+
+	uint32 ObjectFlags = Export.ObjectFlags;
+	uint8 FilterFlags = static_cast<uint8>( Export.FilterFlags );
+	Ar << ObjectFlags;
+	Ar << FilterFlags;
+	Export.ObjectFlags = static_cast<EObjectFlags>( ObjectFlags );
+	Export.FilterFlags = static_cast<EExportFilterFlags>( FilterFlags );
+
+	Ar << Export.SerialDataOffset;
+	Ar << Export.SerialDataSize;
+	return Ar;
+}
+
+FArchive& operator<<( FArchive& Ar, FPackageMapInternalDependencyArc& Arc )
+{
+	Ar << Arc.FromExportBundleIndex;
+	Ar << Arc.ToExportBundleIndex;
+	return Ar;
+}
+
+FArchive& operator<<( FArchive& Ar, FPackageMapExternalDependencyArc& Arc )
+{
+	uint8 FromCommandType = static_cast<uint8>( Arc.FromCommandType );
+	Ar << Arc.FromImportIndex;
+	Ar << FromCommandType;
+	Ar << Arc.ToExportBundleIndex;
+	Arc.FromCommandType = static_cast<FExportBundleEntry::EExportCommandType>( FromCommandType );
+	return Ar;
+}
+
+FArchive& operator<<( FArchive& Ar, FPackageMapArenaRange& Range )
+{
+	Ar << Range.Offset;
+	Ar << Range.Num;
+	return Ar;
+}
+
+FArchive& operator<<( FArchive& Ar, FPackageMapArenas& Arenas )
+{
+	Ar << Arenas.UniqueNames;
+	Ar << Arenas.NameMapEntries;
+	Ar << Arenas.PathCharacters;
+	Ar << Arenas.PackageDirectories;
+	Ar << Arenas.Imports;
+
+	int32 NumPackageImportKeys = Arenas.PackageImportKeys.Num();
+	Ar << NumPackageImportKeys;
+	Arenas.PackageImportKeys.SetNum( NumPackageImportKeys );
+
+	for ( FPublicExportKey& ImportKey : Arenas.PackageImportKeys )
+	{
+		FPackageId ImportedPackageId = ImportKey.GetPackageId();
+		uint64 ImportedExportHash = ImportKey.GetExportHash();
+		Ar << ImportedPackageId;
+		Ar << ImportedExportHash;
+		ImportKey = FPublicExportKey::MakeKey( ImportedPackageId, ImportedExportHash );
+	}
+
+	Ar << Arenas.Exports;
+
+	int32 NumExportBundleEntries = Arenas.ExportBundleEntries.Num();
+	Ar << NumExportBundleEntries;
+	Arenas.ExportBundleEntries.SetNum( NumExportBundleEntries );
+
+	for ( FExportBundleEntry& BundleEntry : Arenas.ExportBundleEntries )
+	{
+		Ar << BundleEntry.LocalExportIndex;
+		Ar << BundleEntry.CommandType;
+	}
+
+	Ar << Arenas.InternalArcs;
+	Ar << Arenas.ExternalArcs;
+	Ar << Arenas.ExportBundleOffsets;
+	Ar << Arenas.BulkDataChunkIds;
+	return Ar;
+}
+
+FArchive& operator<<( FArchive& Ar, FPackageMapExportBundleEntry& PackageData )
+{
+	Ar << PackageData.PackageName;
+
+	bool bHasVersioningInfo = PackageData.VersioningInfo.IsSet();
+	Ar << bHasVersioningInfo;
+	if ( bHasVersioningInfo )
+	{
+		if ( Ar.IsLoading() )
+		{
+			PackageData.VersioningInfo.Emplace();
+		}
+		Ar << PackageData.VersioningInfo.GetValue();
+	}
+	else if ( Ar.IsLoading() )
+	{
+		PackageData.VersioningInfo.Reset();
+	}
+
+	Ar << PackageData.PackageFlags;
+	Ar << PackageData.PackageDirectoryIndex;
+	Ar << PackageData.PackageChunkId;
+	Ar << PackageData.ExportBundleCount;
+
+	Ar << PackageData.NameMapRange;
+	Ar << PackageData.PackageFileNameRange;
+	Ar << PackageData.ImportMapRange;
+	Ar << PackageData.PackageImportKeyRange;
+	Ar << PackageData.ExportMapRange;
+	Ar << PackageData.ExportBundleEntryRange;
+	Ar << PackageData.InternalArcRange;
+	Ar << PackageData.ExternalArcRange;
+	Ar << PackageData.ExportBundleOffsetRange;
+	Ar << PackageData.BulkDataChunkIdRange;
+	return Ar;
+}
+
+/** Archive feeding everything serialized into it into the SHA1 hash. Names are hashed as strings, so the hash does not depend on the name table */
+class FPackageMapHashingArchive final : public FArchive
+{
+	FSHA1 HashState;
+public:
+	FPackageMapHashingArchive()
+	{
+		SetIsSaving( true );
+		SetIsPersistent( true );
+	}
+
+	virtual void Serialize( void* Data, int64 Num ) override
+	{
+		HashState.Update( static_cast<const uint8*>( Data ), Num );
+	}
+
+	virtual FArchive& operator<<( FName& Name ) override
+	{
+		FString NameString = Name.ToString();
+		*this << NameString;
+		return *this;
+	}
+
+	FSHAHash Finalize()
+	{
+		FSHAHash ResultHash;
+		HashState.Final();
+		HashState.GetHash( ResultHash.Hash );
+		return ResultHash;
+	}
+};
+
+FSHAHash FIoStorePackageMap::ComputeExportLayoutHash( const FPackageId& PackageId ) const
+{
+	const FPackageMapExportBundleEntry* PackageData = PackageMap.Find( PackageId );
+	if ( PackageData == nullptr )
+	{
+		return FSHAHash();
+	}
+
+	FPackageMapHashingArchive HashingArchive;
+	FName PackageName = PackageData->PackageName;
+	HashingArchive << PackageName;
+
+	// Package import refs are indices into the import keys of the package, so the keys themselves are hashed to not depend on their order
+	auto HashObjectRef = [&]( const FPackageLocalObjectRef& ObjectRef )
+	{
+		if ( ObjectRef.IsPackageImport() )
+		{
+			const FPublicExportKey& ImportKey = PackageData->GetPackageImportKey( ObjectRef );
+			FPackageId ImportedPackageId = ImportKey.GetPackageId();
+			uint64 ImportedExportHash = ImportKey.GetExportHash();
+			HashingArchive << ImportedPackageId;
+			HashingArchive << ImportedExportHash;
+		}
+		else
+		{
+			FPackageLocalObjectRef ObjectRefCopy = ObjectRef;
+			HashingArchive << ObjectRefCopy;
+		}
+	};
+
+	// Serial offsets and sizes are not hashed since they do not affect the packages importing this one
+	for ( const FPackageMapExportEntry& ExportEntry : PackageData->GetExportMap() )
+	{
+		FName ObjectName = ExportEntry.ObjectName;
+		uint64 PublicExportHash = ExportEntry.PublicExportHash;
+		uint32 ObjectFlags = ExportEntry.ObjectFlags;
+		uint8 FilterFlags = static_cast<uint8>( ExportEntry.FilterFlags );
+
+		HashingArchive << ObjectName;
+		HashObjectRef( ExportEntry.OuterIndex );
+		HashObjectRef( ExportEntry.ClassIndex );
+		HashObjectRef( ExportEntry.SuperIndex );
+		HashObjectRef( ExportEntry.TemplateIndex );
+		HashingArchive << PublicExportHash;
+		HashingArchive << ObjectFlags;
+		HashingArchive << FilterFlags;
+	}
+	return HashingArchive.Finalize();
+}
+
+void FIoStorePackageMap::CollectImportResolutionPackages( const FPackageId& PackageId, TSet<FPackageId>& OutPackageIds ) const
+{
+	// Imports without an export are written as a reference to the package, so the name of every imported package is used
+	if ( const FPackageHeaderData* PackageHeader = PackageHeaders.Find( PackageId ) )
+	{
+		OutPackageIds.Append( PackageHeader->ImportedPackages );
+	}
+	const FPackageMapExportBundleEntry* PackageData = PackageMap.Find( PackageId );
+	if ( PackageData == nullptr )
+	{
+		return;
+	}
+
+	// Exports whose outer chain and classes are resolved when writing the package, identified by the package they belong to and their index
+	TSet<TPair<const FPackageMapExportBundleEntry*, int32>> VisitedExports;
+	TArray<TPair<const FPackageMapExportBundleEntry*, int32>> PendingExports;
+
+	auto VisitObjectRef = [&]( const FPackageMapExportBundleEntry* ScopePackageData, const FPackageLocalObjectRef& ObjectRef )
+	{
+		if ( ObjectRef.IsPackageImport() )
+		{
+			const FPublicExportKey& ImportKey = ScopePackageData->GetPackageImportKey( ObjectRef );
+			OutPackageIds.Add( ImportKey.GetPackageId() );
+
+			// Dangling imports are reported separately, the package they point to is still hashed so that it being added later is noticed
+			const FPackageMapExportBundleEntry* ImportedPackageData = PackageMap.Find( ImportKey.GetPackageId() );
+			const int32 ImportedExportIndex = ImportedPackageData ? FindPublicExportIndex( ImportKey ) : INDEX_NONE;
+			if ( ImportedExportIndex != INDEX_NONE )
+			{
+				PendingExports.Add( { ImportedPackageData, ImportedExportIndex } );
+			}
+		}
+		else if ( ObjectRef.IsExport() && ScopePackageData != PackageData )
+		{
+			PendingExports.Add( { ScopePackageData, ObjectRef.GetExportIndex() } );
+		}
+	};
+
+	// Package import keys cover both the import map and the refs of the exports of the package
+	for ( int32 ImportKeyIndex = 0; ImportKeyIndex < PackageData->PackageImportKeyRange.Num; ImportKeyIndex++ )
 	{
-		OutMapEntry = *Entry;
-		return true;
+		VisitObjectRef( PackageData, FPackageLocalObjectRef::FromPackageImport( ImportKeyIndex ) );
+	}
+
+	while ( !PendingExports.IsEmpty() )
+	{
+		const TPair<const FPackageMapExportBundleEntry*, int32> ExportKey = PendingExports.Pop( false );
+		bool bAlreadyVisited = false;
+		VisitedExports.Add( ExportKey, &bAlreadyVisited );
+		if ( !bAlreadyVisited )
+		{
+			const FPackageMapExportEntry& ExportData = ExportKey.Key->GetExportMap()[ ExportKey.Value ];
+			VisitObjectRef( ExportKey.Key, ExportData.OuterIndex );
+			VisitObjectRef( ExportKey.Key, ExportData.ClassIndex );
+		}
 	}
-	return false;
 }
 
-bool FIoStorePackageMap::FindExportBundleData(const FPackageId& PackageId, FPackageMapExportBundleEntry& OutExportBundleEntry) const
+SIZE_T FIoStorePackageMap::GetAllocatedPackageDataSize() const
 {
-	if ( const FPackageMapExportBundleEntry* Bundle = PackageMap.Find( PackageId ) )
+	return PackageMap.GetAllocatedSize() + Arenas->GetAllocatedSize();
+}
+
+FSHAHash FIoStorePackageMap::ComputeScriptObjectsHash() const
+{
+	FPackageMapHashingArchive HashingArchive;
+	for ( const TPair<FPackageObjectIndex, FPackageMapScriptObjectEntry>& ScriptObjectPair : ScriptObjectMap )
 	{
-		OutExportBundleEntry = *Bundle;
-		return true;
+		FPackageMapScriptObjectEntry ScriptObject = ScriptObjectPair.Value;
+		HashingArchive << ScriptObject;
+	}
+	return HashingArchive.Finalize();
+}
+
+void FIoStorePackageMap::Serialize( FArchive& Ar )
+{
+	Ar << PackageHeaders;
+	Ar << ScriptObjectMap;
+	Ar << *Arenas;
+	Ar << PackageMap;
+	Ar << ContainerMetadata;
+
+	// Public export map, script object paths and the interning lookups are not serialized, they are cheap enough to rebuild from the rest of the map
+	if ( Ar.IsLoading() )
+	{
+		PublicExportMap.Reset();
+		BuildScriptObjectPaths();
+		UniqueNameIndices.Reset();
+		PackageDirectoryIndices.Reset();
+
+		for ( int32 NameIndex = 0; NameIndex < Arenas->UniqueNames.Num(); NameIndex++ )
+		{
+			UniqueNameIndices.Add( Arenas->UniqueNames[ NameIndex ].GetDisplayIndex(), NameIndex );
+		}
+		for ( int32 DirectoryIndex = 0; DirectoryIndex < Arenas->PackageDirectories.Num(); DirectoryIndex++ )
+		{
+			PackageDirectoryIndices.Add( Arenas->GetPath( Arenas->PackageDirectories[ DirectoryIndex ] ), DirectoryIndex );
+		}
+
+		for ( TPair<FPackageId, FPackageMapExportBundleEntry>& PackagePair : PackageMap )
+		{
+			PackagePair.Value.Arenas = Arenas.Get();
+			const TArrayView<const FPackageMapExportEntry> ExportMap = PackagePair.Value.GetExportMap();
+
+			for ( int32 ExportIndex = 0; ExportIndex < ExportMap.Num(); ExportIndex++ )
+			{
+				const uint64 PublicExportHash = ExportMap[ ExportIndex ].PublicExportHash;
+				if ( PublicExportHash != 0 )
+				{
+					PublicExportMap.FindOrAdd( FPublicExportKey::MakeKey( PackagePair.Key, PublicExportHash ), ExportIndex );
+				}
+			}
+		}
 	}
-	return false;
 }
 
 void FIoStorePackageMap::ReadScriptObjects(const FIoBuffer& ChunkBuffer)
@@ -171,49 +787,74 @@ void FIoStorePackageMap::ReadScriptObjects(const FIoBuffer& ChunkBuffer)
 		ScriptObject.OuterIndex = ScriptObjectEntry.OuterIndex;
 		ScriptObject.CDOClassIndex = ScriptObjectEntry.CDOClassIndex;
 	}
+	BuildScriptObjectPaths();
 }
 
-FPackageLocalObjectRef FIoStorePackageMap::ResolvePackageLocalRef( const FPackageObjectIndex& PackageObjectIndex, const TArrayView<const FPackageId>& ImportedPackages, const TArrayView<const uint64>& ImportedPublicExportHashes )
+void FIoStorePackageMap::BuildScriptObjectPaths()
 {
-	FPackageLocalObjectRef Result{};
+	ScriptObjectPaths.Reset();
+	ScriptObjectPathEntries.Reset();
+	ScriptObjectPaths.Reserve( ScriptObjectMap.Num() );
+	// Script objects are mostly classes and CDOs inside of the script package, or functions inside of the classes, so their paths are two or three entries long
+	ScriptObjectPathEntries.Reserve( ScriptObjectMap.Num() * 3 );
 
-	if ( PackageObjectIndex.IsExport() )
+	for ( const TPair<FPackageObjectIndex, FPackageMapScriptObjectEntry>& ScriptObjectPair : ScriptObjectMap )
 	{
-		Result.bIsExportReference = true;
-		Result.ExportIndex = PackageObjectIndex.ToExport();
+		BuildScriptObjectPath( ScriptObjectPair.Key );
 	}
-	else if ( PackageObjectIndex.IsImport() )
+	ScriptObjectPathEntries.Shrink();
+}
+
+FPackageMapArenaRange FIoStorePackageMap::BuildScriptObjectPath( const FPackageObjectIndex& Index )
+{
+	if ( const FPackageMapArenaRange* ExistingPathRange = ScriptObjectPaths.Find( Index ) )
 	{
-		Result.bIsImport = true;
+		return *ExistingPathRange;
+	}
+	const FPackageMapScriptObjectEntry* ScriptObjectEntry = ScriptObjectMap.Find( Index );
+	checkf( ScriptObjectEntry, TEXT("Script object 0x%llx is referenced by another script object, but is not in the script object map"), Index.Value() );
 
-		if ( PackageObjectIndex.IsScriptImport() )
-		{
-			Result.Import.ScriptImportIndex = PackageObjectIndex;
-			Result.Import.bIsScriptImport = true;
-		}
-		else if ( PackageObjectIndex.IsPackageImport() )
-		{
-			Result.Import.PackageExportKey = FPublicExportKey::FromPackageImport( PackageObjectIndex, ImportedPackages, ImportedPublicExportHashes );
-			Result.Import.bIsPackageImport = true;
-		}
-		else
-		{
-			check( PackageObjectIndex.IsNull() );
-			Result.Import.bIsNullImport = true;
-		}
+	// Path of the outer is built first, and the path of this object is a copy of it with this object at the end
+	const FPackageMapArenaRange OuterPathRange = ScriptObjectEntry->OuterIndex.IsNull() ? FPackageMapArenaRange() : BuildScriptObjectPath( ScriptObjectEntry->OuterIndex );
+
+	FPackageMapScriptObjectPathEntry PathEntry;
+	PathEntry.ObjectName = ScriptObjectEntry->ObjectName;
+	PathEntry.CDOClassIndex = ScriptObjectEntry->CDOClassIndex;
+
+	// Class of the CDO is written as the package and the top level object of the path of the class, the same as the rest of the import class paths
+	if ( !ScriptObjectEntry->CDOClassIndex.IsNull() )
+	{
+		const FPackageMapArenaRange ClassPathRange = BuildScriptObjectPath( ScriptObjectEntry->CDOClassIndex );
+		const FName ClassPackageName = ScriptObjectPathEntries[ ClassPathRange.Offset ].ObjectName;
+		const FName ClassAssetName = ClassPathRange.Num > 1 ? ScriptObjectPathEntries[ ClassPathRange.Offset + 1 ].ObjectName : NAME_None;
+		PathEntry.ClassPath = FTopLevelAssetPath( ClassPackageName, ClassAssetName );
 	}
-	else
+	// Top level script objects are packages, which get their class when the package import is created
+	else if ( !ScriptObjectEntry->OuterIndex.IsNull() )
 	{
-		check( PackageObjectIndex.IsNull() );
-		Result.bIsNull = true;
+		PathEntry.ClassPath = UObject::StaticClass()->GetClassPathName();
 	}
-	return Result;
+
+	const FPackageMapArenaRange PathRange{ ScriptObjectPathEntries.Num(), OuterPathRange.Num + 1 };
+	for ( int32 OuterPathIndex = 0; OuterPathIndex < OuterPathRange.Num; OuterPathIndex++ )
+	{
+		// Copied first, since the entry would be a reference into the array being added to
+		const FPackageMapScriptObjectPathEntry OuterPathEntry = ScriptObjectPathEntries[ OuterPathRange.Offset + OuterPathIndex ];
+		ScriptObjectPathEntries.Add( OuterPathEntry );
+	}
+	ScriptObjectPathEntries.Add( PathEntry );
+
+	ScriptObjectPaths.Add( Index, PathRange );
+	return PathRange;
 }
 
-FPackageMapExportBundleEntry* FIoStorePackageMap::ReadExportBundleData( const FPackageId& PackageId, const FIoStoreTocChunkInfo& ChunkInfo, const FIoBuffer& ChunkBuffer )
+void FIoStorePackageMap::ReadExportBundleData( const FPackageId& PackageId, const FIoStoreTocChunkInfo& ChunkInfo, const FIoBuffer& ChunkBuffer, TArrayView<const FIoChunkId> BulkDataChunkIds )
 {
 	const uint8* PackageSummaryData = ChunkBuffer.Data();
 	const FZenPackageSummary* PackageSummary = reinterpret_cast<const FZenPackageSummary*>(PackageSummaryData);
+	
+	// Only the package header is read at this point, export data is read later when the package is written
+	checkf( PackageSummary->HeaderSize <= ChunkBuffer.DataSize(), TEXT("Package header buffer for package %s is truncated"), *ChunkInfo.FileName );
 
 	const TArrayView<const uint8> PackageHeaderDataView(PackageSummaryData + sizeof(FZenPackageSummary), PackageSummary->HeaderSize - sizeof(FZenPackageSummary));
 	FMemoryReaderView PackageHeaderDataReader(PackageHeaderDataView);
@@ -230,83 +871,118 @@ FPackageMapExportBundleEntry* FIoStorePackageMap::ReadExportBundleData( const FP
 	// Find package header to resolve imported package IDs
 	const FPackageHeaderData& PackageHeader = PackageHeaders.FindChecked( PackageId );
 	
+	// If this package has already been read from another container, it is being overriden by a patch container, so the old data needs to go
+	if ( const FPackageMapExportBundleEntry* ExistingPackageData = PackageMap.Find( PackageId ) )
+	{
+		RemovePublicExports( PackageId, *ExistingPackageData );
+	}
+
 	// Construct package data
-	FPackageMapExportBundleEntry& PackageData = PackageMap.FindOrAdd( PackageId );
-	PackageData.PackageFilename = ChunkInfo.FileName;
+	FPackageMapExportBundleEntry& PackageData = PackageMap.Add( PackageId );
 	PackageData.PackageName = PackageName;
 	PackageData.PackageFlags = PackageSummary->PackageFlags;
 	PackageData.VersioningInfo = VersioningInfo;
 	PackageData.PackageChunkId = ChunkInfo.Id;
+	PackageData.ExportBundleCount = PackageHeader.ExportBundleCount;
+	PackageData.Arenas = Arenas.Get();
 
 	// get rid of standard filename prefix
-	PackageData.PackageFilename.RemoveFromStart( TEXT("../../../") );
+	FString PackageFilename = ChunkInfo.FileName;
+	PackageFilename.RemoveFromStart( TEXT("../../../") );
 
-	// Save name map
-	PackageData.NameMap.AddZeroed( PackageNameMap.Num() );
-	for ( int32 i = 0; i < PackageNameMap.Num(); i++ )
+	// Packages in the same directory share it, only the file name is stored for each package
+	int32 LastSlashIndex = INDEX_NONE;
+	PackageFilename.FindLastChar( TEXT('/'), LastSlashIndex );
+	PackageData.PackageDirectoryIndex = InternPackageDirectory( LastSlashIndex != INDEX_NONE ? PackageFilename.Left( LastSlashIndex ) : FString() );
+	PackageData.PackageFileNameRange = AppendPathCharacters( Arenas->PathCharacters, FStringView( PackageFilename ).RightChop( LastSlashIndex + 1 ) );
+
+	// Save name map. The same names are used by most of the packages, so they are only stored once and the name map refers to them by index
+	PackageData.NameMapRange = { Arenas->NameMapEntries.Num(), PackageNameMap.Num() };
+	for ( const FDisplayNameEntryId& PackageNameEntry : PackageNameMap )
 	{
-		PackageData.NameMap[i] = PackageNameMap[ i ].ToName( NAME_NO_NUMBER_INTERNAL );
+		Arenas->NameMapEntries.Add( InternName( PackageNameEntry.ToName( NAME_NO_NUMBER_INTERNAL ) ) );
 	}
 
 	/** Public export hashes for each import map entry in this package. */
 	TArrayView<const uint64> ImportedPublicExportHashes = MakeArrayView<const uint64>(reinterpret_cast<const uint64*>(PackageSummaryData + PackageSummary->ImportedPublicExportHashesOffset), (PackageSummary->ImportMapOffset - PackageSummary->ImportedPublicExportHashesOffset) / sizeof(uint64));
 
-	// Resolve import map now
-	const FPackageObjectIndex* ImportMap = reinterpret_cast<const FPackageObjectIndex*>(PackageSummaryData + PackageSummary->ImportMapOffset);
-	PackageData.ImportMap.SetNum((PackageSummary->ExportMapOffset - PackageSummary->ImportMapOffset) / sizeof(FPackageObjectIndex));
-	
-	for (int32 ImportIndex = 0; ImportIndex < PackageData.ImportMap.Num(); ++ImportIndex)
+	// Package imports are resolved into the keys once and referenced by their index in the package import keys. Exports usually refer to the same imports as the import map
+	PackageData.PackageImportKeyRange.Offset = Arenas->PackageImportKeys.Num();
+	TMap<FPackageObjectIndex, int32> PackageImportKeyIndices;
+
+	auto ResolvePackageLocalRef = [&]( const FPackageObjectIndex& PackageObjectIndex )
 	{
-		const FPackageObjectIndex& ImportMapEntry = ImportMap[ImportIndex];
-		FPackageMapImportEntry& PackageMapImport = PackageData.ImportMap[ImportIndex];
-		
-		if ( ImportMapEntry.IsScriptImport() )
+		if ( PackageObjectIndex.IsExport() )
 		{
-			PackageMapImport.bIsScriptImport = true;
-			PackageMapImport.ScriptImportIndex = ImportMapEntry;
+			return FPackageLocalObjectRef::FromExportIndex( PackageObjectIndex.ToExport() );
 		}
-		else if ( ImportMapEntry.IsPackageImport() )
+		if ( PackageObjectIndex.IsScriptImport() )
 		{
-			PackageMapImport.bIsPackageImport = true;
-			PackageMapImport.PackageExportKey = FPublicExportKey::FromPackageImport( ImportMapEntry, PackageHeader.ImportedPackages, ImportedPublicExportHashes );
+			return FPackageLocalObjectRef::FromScriptImport( PackageObjectIndex );
 		}
-		else
+		if ( PackageObjectIndex.IsPackageImport() )
 		{
-			check( ImportMapEntry.IsNull() );
-			PackageMapImport.bIsNullImport = true;
+			int32& PackageImportKeyIndex = PackageImportKeyIndices.FindOrAdd( PackageObjectIndex, INDEX_NONE );
+			if ( PackageImportKeyIndex == INDEX_NONE )
+			{
+				PackageImportKeyIndex = Arenas->PackageImportKeys.Add( FPublicExportKey::FromPackageImport( PackageObjectIndex, PackageHeader.ImportedPackages, ImportedPublicExportHashes ) ) - PackageData.PackageImportKeyRange.Offset;
+			}
+			return FPackageLocalObjectRef::FromPackageImport( PackageImportKeyIndex );
 		}
+		check( PackageObjectIndex.IsNull() );
+		return FPackageLocalObjectRef();
+	};
+
+	// Resolve import map now
+	const FPackageObjectIndex* ImportMap = reinterpret_cast<const FPackageObjectIndex*>(PackageSummaryData + PackageSummary->ImportMapOffset);
+	PackageData.ImportMapRange = { Arenas->Imports.Num(), static_cast<int32>( ( PackageSummary->ExportMapOffset - PackageSummary->ImportMapOffset ) / sizeof(FPackageObjectIndex) ) };
+	
+	for ( int32 ImportIndex = 0; ImportIndex < PackageData.ImportMapRange.Num; ++ImportIndex )
+	{
+		// Import map never refers to the exports, so the entries are script imports, package imports or null imports
+		Arenas->Imports.Add( ResolvePackageLocalRef( ImportMap[ ImportIndex ] ) );
 	}
 	
 	const FExportMapEntry* ExportMap = reinterpret_cast<const FExportMapEntry*>(PackageSummaryData + PackageSummary->ExportMapOffset);
-	PackageData.ExportMap.SetNum( PackageHeader.ExportCount );
+	PackageData.ExportMapRange = { Arenas->Exports.AddDefaulted( PackageHeader.ExportCount ), PackageHeader.ExportCount };
 	
-	for (int32 ExportIndex = 0; ExportIndex < PackageData.ExportMap.Num(); ++ExportIndex)
+	for (int32 ExportIndex = 0; ExportIndex < PackageData.ExportMapRange.Num; ++ExportIndex)
 	{
 		const FExportMapEntry& ExportMapEntry = ExportMap[ ExportIndex ];
-		FPackageMapExportEntry& ExportData = PackageData.ExportMap[ ExportIndex ];
+		FPackageMapExportEntry& ExportData = Arenas->Exports[ PackageData.ExportMapRange.Offset + ExportIndex ];
 
 		ExportData.ObjectName = ExportMapEntry.ObjectName.ResolveName( PackageNameMap );
 		ExportData.FilterFlags = ExportMapEntry.FilterFlags;
 		ExportData.ObjectFlags = ExportMapEntry.ObjectFlags;
 		ExportData.PublicExportHash = ExportMapEntry.PublicExportHash;
 
-		ExportData.OuterIndex = ResolvePackageLocalRef( ExportMapEntry.OuterIndex, PackageHeader.ImportedPackages, ImportedPublicExportHashes );
-		ExportData.ClassIndex = ResolvePackageLocalRef( ExportMapEntry.ClassIndex, PackageHeader.ImportedPackages, ImportedPublicExportHashes );
-		ExportData.SuperIndex = ResolvePackageLocalRef( ExportMapEntry.SuperIndex, PackageHeader.ImportedPackages, ImportedPublicExportHashes );
-		ExportData.TemplateIndex = ResolvePackageLocalRef( ExportMapEntry.TemplateIndex, PackageHeader.ImportedPackages, ImportedPublicExportHashes );
+		ExportData.OuterIndex = ResolvePackageLocalRef( ExportMapEntry.OuterIndex );
+		ExportData.ClassIndex = ResolvePackageLocalRef( ExportMapEntry.ClassIndex );
+		ExportData.SuperIndex = ResolvePackageLocalRef( ExportMapEntry.SuperIndex );
+		ExportData.TemplateIndex = ResolvePackageLocalRef( ExportMapEntry.TemplateIndex );
 
 		ExportData.SerialDataSize = ExportMapEntry.CookedSerialSize;
 		ExportData.SerialDataOffset = INDEX_NONE;
+
+		// Register the public export so the imports from other packages can find it without scanning the export map. First export with the hash wins
+		if ( ExportData.PublicExportHash != 0 )
+		{
+			PublicExportMap.FindOrAdd( FPublicExportKey::MakeKey( PackageId, ExportData.PublicExportHash ), ExportIndex );
+		}
 	}
+	PackageData.PackageImportKeyRange.Num = Arenas->PackageImportKeys.Num() - PackageData.PackageImportKeyRange.Offset;
 
-	// Read export bundles
+	// Read export bundles. Offsets of the entries of each bundle go first in the export bundle offsets of the package, followed by the internal and the external arc offsets
 	const FExportBundleHeader* ExportBundleHeaders = reinterpret_cast<const FExportBundleHeader*>(PackageSummaryData + PackageSummary->GraphDataOffset);
 	const FExportBundleEntry* ExportBundleEntries = reinterpret_cast<const FExportBundleEntry*>(PackageSummaryData + PackageSummary->ExportBundleEntriesOffset);
 	uint64 CurrentExportOffset = PackageSummary->HeaderSize;
+
+	PackageData.ExportBundleEntryRange.Offset = Arenas->ExportBundleEntries.Num();
+	PackageData.ExportBundleOffsetRange = { Arenas->ExportBundleOffsets.Num(), 3 * ( PackageHeader.ExportBundleCount + 1 ) };
 	
 	for ( int32 ExportBundleIndex = 0; ExportBundleIndex < PackageHeader.ExportBundleCount; ExportBundleIndex++ )
 	{
-		TArray<FExportBundleEntry>& ExportBundles = PackageData.ExportBundles.AddDefaulted_GetRef();
+		Arenas->ExportBundleOffsets.Add( Arenas->ExportBundleEntries.Num() - PackageData.ExportBundleEntryRange.Offset );
 		const FExportBundleHeader* ExportBundle = ExportBundleHeaders + ExportBundleIndex;
 		
 		const FExportBundleEntry* BundleEntry = ExportBundleEntries + ExportBundle->FirstEntryIndex;
@@ -315,17 +991,19 @@ FPackageMapExportBundleEntry* FIoStorePackageMap::ReadExportBundleData( const FP
 		
 		while (BundleEntry < BundleEntryEnd)
 		{
-			ExportBundles.Add( *BundleEntry );
+			Arenas->ExportBundleEntries.Add( *BundleEntry );
 			
 			if (BundleEntry->CommandType == FExportBundleEntry::ExportCommandType_Serialize)
 			{
-				FPackageMapExportEntry& Export = PackageData.ExportMap[ BundleEntry->LocalExportIndex ];
+				FPackageMapExportEntry& Export = Arenas->Exports[ PackageData.ExportMapRange.Offset + BundleEntry->LocalExportIndex ];
 				Export.SerialDataOffset = CurrentExportOffset;
 				CurrentExportOffset += Export.SerialDataSize;
 			}
 			BundleEntry++;
 		}
 	}
+	PackageData.ExportBundleEntryRange.Num = Arenas->ExportBundleEntries.Num() - PackageData.ExportBundleEntryRange.Offset;
+	Arenas->ExportBundleOffsets.Add( PackageData.ExportBundleEntryRange.Num );
 
 	// Read arcs, they are needed to create a list of preload dependencies for this package
 	const uint64 ExportBundleHeadersSize = sizeof(FExportBundleHeader) * PackageHeader.ExportBundleCount;
@@ -334,12 +1012,15 @@ FPackageMapExportBundleEntry* FIoStorePackageMap::ReadExportBundleData( const FP
 
 	FMemoryReaderView ArcsAr(MakeArrayView<const uint8>(PackageSummaryData + ArcsDataOffset, ArcsDataSize));
 
+	TArray<FPackageMapInternalDependencyArc> InternalArcs;
+	TArray<FPackageMapExternalDependencyArc> ExternalArcs;
+
 	int32 InternalArcsCount = 0;
 	ArcsAr << InternalArcsCount;
 
 	for ( int32 Idx = 0; Idx < InternalArcsCount; Idx++ )
 	{
-		FPackageMapInternalDependencyArc& InternalArc = PackageData.InternalArcs.AddDefaulted_GetRef();
+		FPackageMapInternalDependencyArc& InternalArc = InternalArcs.AddDefaulted_GetRef();
 		ArcsAr << InternalArc.FromExportBundleIndex;
 		ArcsAr << InternalArc.ToExportBundleIndex;
 	}
@@ -351,7 +1032,7 @@ FPackageMapExportBundleEntry* FIoStorePackageMap::ReadExportBundleData( const FP
 
 		for ( int32 Idx = 0; Idx < ExternalArcsCount; Idx++ )
 		{
-			FPackageMapExternalDependencyArc& ExternalArc = PackageData.ExternalArcs.AddDefaulted_GetRef();
+			FPackageMapExternalDependencyArc& ExternalArc = ExternalArcs.AddDefaulted_GetRef();
 			ArcsAr << ExternalArc.FromImportIndex;
 			uint8 FromCommandType = 0;
 			ArcsAr << FromCommandType;
@@ -359,5 +1040,20 @@ FPackageMapExportBundleEntry* FIoStorePackageMap::ReadExportBundleData( const FP
 			ArcsAr << ExternalArc.ToExportBundleIndex;
 		}
 	}
-	return &PackageData;
+
+	// Group the arcs by the bundle they lead to, so the preload dependencies for each bundle can be built without scanning all of them
+	TArray<int32> InternalArcsBundleOffsets;
+	TArray<int32> ExternalArcsBundleOffsets;
+	GroupArcsByExportBundle( InternalArcs, PackageHeader.ExportBundleCount, InternalArcsBundleOffsets );
+	GroupArcsByExportBundle( ExternalArcs, PackageHeader.ExportBundleCount, ExternalArcsBundleOffsets );
+
+	PackageData.InternalArcRange = { Arenas->InternalArcs.Num(), InternalArcs.Num() };
+	PackageData.ExternalArcRange = { Arenas->ExternalArcs.Num(), ExternalArcs.Num() };
+	Arenas->InternalArcs.Append( InternalArcs );
+	Arenas->ExternalArcs.Append( ExternalArcs );
+	Arenas->ExportBundleOffsets.Append( InternalArcsBundleOffsets );
+	Arenas->ExportBundleOffsets.Append( ExternalArcsBundleOffsets );
+
+	PackageData.BulkDataChunkIdRange = { Arenas->BulkDataChunkIds.Num(), BulkDataChunkIds.Num() };
+	Arenas->BulkDataChunkIds.Append( BulkDataChunkIds.GetData(), BulkDataChunkIds.Num() );
 }
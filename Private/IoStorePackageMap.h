@@ -6,6 +6,7 @@
 #include "IO/IoContainerId.h"
 #include "IO/IoDispatcher.h"
 #include "Serialization/AsyncLoading2.h"
+#include "UObject/TopLevelAssetPath.h"
 
 /** Metadata about a single package container */
 struct FPackageContainerMetadata
@@ -36,34 +37,71 @@ struct FPackageMapScriptObjectEntry
 	FPackageObjectIndex CDOClassIndex{};
 };
 
-/** Import entry describes a Script package name or a PackageId and ExportHash used to uniquely identify an exported object */
-struct FPackageMapImportEntry
+/** Single object in the flattened path of a script object, see FIoStorePackageMap::FindScriptObjectPath */
+struct FPackageMapScriptObjectPathEntry
 {
-	/** Index to use in the global lookup map to find a script object */
-	FPackageObjectIndex ScriptImportIndex{};
-	/** PackageId + hash of the export name to find a package inside of the package map and also an exported object inside of it's exports */
-	FPublicExportKey PackageExportKey{};
-	/** True if this is a script import */
-	bool bIsScriptImport{false};
-	/** True if this is a Null import, in that case nothing else will be set */
-	bool bIsNullImport{false};
-	/** True if this is a package import */
-	bool bIsPackageImport{false};
+	FName ObjectName;
+	/** Index of the class this CDO is of if this object is a CDO. The class gets an import of its own along with the CDO */
+	FPackageObjectIndex CDOClassIndex{};
+	/**
+	 * Class path to write into the import of this object. Known only for CDOs, where it is the path of the CDO class, since other script objects
+	 * can be classes, functions, enums or structs, and are written as UObject
+	 */
+	FTopLevelAssetPath ClassPath;
 };
 
-/** Represents an object reference inside of the package, can be either an import or index into the export map */
-struct FPackageLocalObjectRef
+/**
+ * Reference to an object from inside of the package, packed into a single 64-bit value. Can be Null, an index into the exports of the package, a script import,
+ * or a package import. Uses the layout of FPackageObjectIndex, except that package imports hold the index of the resolved import key in the package import keys
+ * of the package instead of the indices into the package header, so they can be resolved without the header of the container the package was read from.
+ */
+class FPackageLocalObjectRef
 {
-	/** If this represents an import, the entry describing it */
-	FPackageMapImportEntry Import;
-	/** If this represents an export, an index into the Exports of the package this ref belongs to */
-	uint32 ExportIndex{0};
+	FPackageObjectIndex PackedIndex;
+public:
+	FPackageLocalObjectRef() = default;
+
+	FORCEINLINE static FPackageLocalObjectRef FromExportIndex( int32 ExportIndex )
+	{
+		FPackageLocalObjectRef Result;
+		Result.PackedIndex = FPackageObjectIndex::FromExportIndex( ExportIndex );
+		return Result;
+	}
+
+	FORCEINLINE static FPackageLocalObjectRef FromScriptImport( const FPackageObjectIndex& ScriptImportIndex )
+	{
+		check( ScriptImportIndex.IsScriptImport() );
+		FPackageLocalObjectRef Result;
+		Result.PackedIndex = ScriptImportIndex;
+		return Result;
+	}
+
+	FORCEINLINE static FPackageLocalObjectRef FromPackageImport( int32 PackageImportKeyIndex )
+	{
+		FPackageLocalObjectRef Result;
+		Result.PackedIndex = FPackageObjectIndex::FromPackageImportRef( FPackageImportReference( 0, PackageImportKeyIndex ) );
+		return Result;
+	}
+
+	/** True if this is Null, which means this is a top level export, or a remnant of the package import for null import map entries */
+	FORCEINLINE bool IsNull() const { return PackedIndex.IsNull(); }
 	/** True if this reference is an index into the exports objects of this package and not an external import */
-	bool bIsExportReference{false};
+	FORCEINLINE bool IsExport() const { return PackedIndex.IsExport(); }
 	/** True if this is an import from another package or script */
-	bool bIsImport{false};
-	/** True if this is Null, which means this is a top level export */
-	bool bIsNull{false};
+	FORCEINLINE bool IsImport() const { return PackedIndex.IsImport(); }
+	FORCEINLINE bool IsScriptImport() const { return PackedIndex.IsScriptImport(); }
+	FORCEINLINE bool IsPackageImport() const { return PackedIndex.IsPackageImport(); }
+
+	FORCEINLINE int32 GetExportIndex() const { return PackedIndex.ToExport(); }
+	/** Index to use in the global lookup map to find a script object */
+	FORCEINLINE const FPackageObjectIndex& GetScriptImportIndex() const { return PackedIndex; }
+	/** Index of the PackageId + export hash pair in the package import keys of the package this ref belongs to */
+	FORCEINLINE int32 GetPackageImportKeyIndex() const { return PackedIndex.ToPackageImportRef().GetImportedPublicExportHashIndex(); }
+
+	friend FArchive& operator<<( FArchive& Ar, FPackageLocalObjectRef& ObjectRef )
+	{
+		return Ar << ObjectRef.PackedIndex;
+	}
 };
 
 /** Export entry describes a single exported object inside of the export bundle */
@@ -103,10 +141,63 @@ struct FPackageMapExternalDependencyArc
 	int32 ToExportBundleIndex{0};
 };
 
+/** Range of the elements belonging to a single package in one of the package map arenas */
+struct FPackageMapArenaRange
+{
+	int32 Offset{0};
+	int32 Num{0};
+
+	template<typename ElementType>
+	FORCEINLINE TArrayView<const ElementType> GetView( const TArray<ElementType>& Arena ) const
+	{
+		return MakeArrayView( Arena.GetData() + Offset, Num );
+	}
+};
+
+/**
+ * Variable sized data of all packages in the package map, stored in flat arrays shared by all packages instead of the arrays owned by each package.
+ * Packages refer to their data by the ranges in these arrays, and all indices stored inside of the ranges are relative to the start of the range of their package.
+ */
+struct FPackageMapArenas
+{
+	/** Names referenced by the name maps of the packages, each one stored once */
+	TArray<FName> UniqueNames;
+	/** Name map entries of all packages, as indices into the unique names */
+	TArray<int32> NameMapEntries;
+	/** UTF-8 characters of the package directories and package file names */
+	TArray<uint8> PathCharacters;
+	/** Directories the packages are located in, as ranges of the path characters. Each directory is stored once */
+	TArray<FPackageMapArenaRange> PackageDirectories;
+	/** Import map entries, which are always script imports, package imports or Null */
+	TArray<FPackageLocalObjectRef> Imports;
+	/** PackageId + hash of the export name of the package imports, referenced by the package import refs */
+	TArray<FPublicExportKey> PackageImportKeys;
+	TArray<FPackageMapExportEntry> Exports;
+	TArray<FExportBundleEntry> ExportBundleEntries;
+	TArray<FPackageMapInternalDependencyArc> InternalArcs;
+	TArray<FPackageMapExternalDependencyArc> ExternalArcs;
+	/** Offsets of the first element belonging to each export bundle in the export bundle entries and arc ranges, with an extra entry at the end holding the total number */
+	TArray<int32> ExportBundleOffsets;
+	TArray<FIoChunkId> BulkDataChunkIds;
+
+	/**
+	 * Appends the per-package contents of the other arenas to these ones. Names and directories of the other arenas are not appended,
+	 * they must have been interned into these arenas already, and the name map entries are remapped to them
+	 */
+	void Append( const FPackageMapArenas& Other, const TArray<int32>& OtherNameIndexRemap );
+	/** Decodes the path stored in the given range of the path characters */
+	FString GetPath( const FPackageMapArenaRange& Range ) const;
+	/** Releases the slack of all arenas */
+	void Shrink();
+	/** Returns the total number of bytes allocated for the arenas */
+	SIZE_T GetAllocatedSize() const;
+};
+
 /**
  * Describes an export bundle, e.g. a package inside of the IO store container.
  * This intentionally omits some zen-specific data like arcs and export bundle entries, because they are generated during the packaging time and
  * serve no purpose other than optimizing the performance of the zen loader in runtime.
+ * Name map, imports, exports, export bundles and arcs are stored in the arenas of the package map this package belongs to.
  */
 struct FPackageMapExportBundleEntry
 {
@@ -115,24 +206,99 @@ struct FPackageMapExportBundleEntry
 	TOptional<FZenPackageVersioningInfo> VersioningInfo;
 	/** Flags of the UPackage object this describes */
 	uint32 PackageFlags{PKG_None};
-	/** Package name map */
-	TArray<FName> NameMap;
-	/** Processed map of the imported objects from other packages and script objects */
-	TArray<FPackageMapImportEntry> ImportMap;
-	/** Processed map of the exported objects inside of this package */
-	TArray<FPackageMapExportEntry> ExportMap;
-	/** Export bundles for this package */
-	TArray<TArray<FExportBundleEntry>> ExportBundles;
-	/** Dependencies between the package bundles inside of this package */
-	TArray<FPackageMapInternalDependencyArc> InternalArcs;
-	/** Dependencies from the package bundles inside of this package to external packages */
-	TArray<FPackageMapExternalDependencyArc> ExternalArcs;
-	/** Filename of the package, retrieved from the chunk filename */
-	FString PackageFilename;
+	/** Index of the directory of the package file in the package directories of the arenas */
+	int32 PackageDirectoryIndex{INDEX_NONE};
 	/** ID of the chunk in which exports of this package are located */
 	FIoChunkId PackageChunkId;
+	/** Number of the export bundles in this package */
+	int32 ExportBundleCount{0};
+
+	/** Ranges of the data of this package in the arenas */
+	FPackageMapArenaRange NameMapRange;
+	/** Name of the package file without the directory, in the path characters */
+	FPackageMapArenaRange PackageFileNameRange;
+	FPackageMapArenaRange ImportMapRange;
+	FPackageMapArenaRange PackageImportKeyRange;
+	FPackageMapArenaRange ExportMapRange;
+	FPackageMapArenaRange ExportBundleEntryRange;
+	FPackageMapArenaRange InternalArcRange;
+	FPackageMapArenaRange ExternalArcRange;
+	/** Holds the export bundle entry offsets, then the internal arc offsets and then the external arc offsets, ExportBundleCount + 1 elements each */
+	FPackageMapArenaRange ExportBundleOffsetRange;
+	FPackageMapArenaRange BulkDataChunkIdRange;
+	/** Arenas of the package map this package belongs to */
+	const FPackageMapArenas* Arenas{nullptr};
+
+	/** Moves the ranges of this package past the current contents of the given arenas, before the arenas this package belongs to are appended to them */
+	void RebaseArenaRanges( const FPackageMapArenas& BaseArenas );
+
+	/** Number of the entries in the package name map */
+	FORCEINLINE int32 GetNameMapNum() const { return NameMapRange.Num; }
+
+	/** Returns the entry of the package name map */
+	FORCEINLINE FName GetNameMapEntry( int32 NameIndex ) const
+	{
+		return Arenas->UniqueNames[ Arenas->NameMapEntries[ NameMapRange.Offset + NameIndex ] ];
+	}
+
+	/** Directory of the package file, without the trailing slash. Empty if the file is at the root of the container */
+	FString GetPackageDirectory() const;
+
+	/** Filename of the package, retrieved from the chunk filename */
+	FString GetPackageFilename() const;
+
+	/** Processed map of the imported objects from other packages and script objects */
+	FORCEINLINE TArrayView<const FPackageLocalObjectRef> GetImportMap() const { return ImportMapRange.GetView( Arenas->Imports ); }
+
+	/** Processed map of the exported objects inside of this package */
+	FORCEINLINE TArrayView<const FPackageMapExportEntry> GetExportMap() const { return ExportMapRange.GetView( Arenas->Exports ); }
+
 	/** ID of the bulk data chunks for this package */
-	TArray<FIoChunkId> BulkDataChunkIds;
+	FORCEINLINE TArrayView<const FIoChunkId> GetBulkDataChunkIds() const { return BulkDataChunkIdRange.GetView( Arenas->BulkDataChunkIds ); }
+
+	/** Returns the PackageId + hash of the export name identifying the object the package import ref of this package points to */
+	FORCEINLINE const FPublicExportKey& GetPackageImportKey( const FPackageLocalObjectRef& ObjectRef ) const
+	{
+		return Arenas->PackageImportKeys[ PackageImportKeyRange.Offset + ObjectRef.GetPackageImportKeyIndex() ];
+	}
+
+	/** Returns the entries of the given export bundle, in their order */
+	FORCEINLINE TArrayView<const FExportBundleEntry> GetExportBundle( int32 ExportBundleIndex ) const
+	{
+		return GetExportBundleSlice( Arenas->ExportBundleEntries, ExportBundleEntryRange, 0, ExportBundleIndex );
+	}
+
+	/** Returns the internal arcs leading to the given export bundle, in the order they have been defined in */
+	FORCEINLINE TArrayView<const FPackageMapInternalDependencyArc> GetInternalArcsToExportBundle( int32 ExportBundleIndex ) const
+	{
+		return GetExportBundleSlice( Arenas->InternalArcs, InternalArcRange, 1, ExportBundleIndex );
+	}
+
+	/** Returns the external arcs leading to the given export bundle, in the order they have been defined in */
+	FORCEINLINE TArrayView<const FPackageMapExternalDependencyArc> GetExternalArcsToExportBundle( int32 ExportBundleIndex ) const
+	{
+		return GetExportBundleSlice( Arenas->ExternalArcs, ExternalArcRange, 2, ExportBundleIndex );
+	}
+private:
+	template<typename ElementType>
+	FORCEINLINE TArrayView<const ElementType> GetExportBundleSlice( const TArray<ElementType>& Arena, const FPackageMapArenaRange& Range, int32 OffsetTableIndex, int32 ExportBundleIndex ) const
+	{
+		const int32* BundleOffsets = Arenas->ExportBundleOffsets.GetData() + ExportBundleOffsetRange.Offset + OffsetTableIndex * ( ExportBundleCount + 1 );
+		return MakeArrayView( Arena.GetData() + Range.Offset + BundleOffsets[ ExportBundleIndex ], BundleOffsets[ ExportBundleIndex + 1 ] - BundleOffsets[ ExportBundleIndex ] );
+	}
+};
+
+/** Paths inside of the containers are case sensitive, unlike the default FString keys */
+struct FPackageMapPathKeyFuncs : TDefaultMapHashableKeyFuncs<FString, int32, false>
+{
+	FORCEINLINE static bool Matches( const FString& A, const FString& B )
+	{
+		return A.Equals( B, ESearchCase::CaseSensitive );
+	}
+	FORCEINLINE static uint32 GetKeyHash( const FString& Key )
+	{
+		return FCrc::StrCrc32( *Key );
+	}
 };
 
 /** Package map is a central storage mapping package IDs (and overall any FPackageObjectIndex objects) to their names and locations */
@@ -141,26 +307,95 @@ class ZENTOOLS_API FIoStorePackageMap
 private:
 	TMap<FPackageId, FPackageHeaderData> PackageHeaders;
 	TMap<FPackageObjectIndex, FPackageMapScriptObjectEntry> ScriptObjectMap;
+	/** Flattened paths of the script objects, as ranges of the script object path entries. Not serialized, rebuilt from the script object map */
+	TMap<FPackageObjectIndex, FPackageMapArenaRange> ScriptObjectPaths;
+	TArray<FPackageMapScriptObjectPathEntry> ScriptObjectPathEntries;
 	TMap<FPackageId, FPackageMapExportBundleEntry> PackageMap;
 	TMap<FIoContainerId, FPackageContainerMetadata> ContainerMetadata;
+	/** Maps package ID and public export hash to the index of the export in the package export map */
+	TMap<FPublicExportKey, int32> PublicExportMap;
+	/** Data of all packages in the map. Allocated separately so that the packages can keep pointing to it when the map is moved */
+	TUniquePtr<FPackageMapArenas> Arenas;
+	/** Maps the names to their index in the unique names of the arenas. Not serialized, rebuilt from the arenas */
+	TMap<FNameEntryId, int32> UniqueNameIndices;
+	/** Maps the package directories to their index in the package directories of the arenas. Not serialized, rebuilt from the arenas */
+	TMap<FString, int32, FDefaultSetAllocator, FPackageMapPathKeyFuncs> PackageDirectoryIndices;
 public:
+	FIoStorePackageMap();
+	FIoStorePackageMap( FIoStorePackageMap&& ) = default;
+	FIoStorePackageMap& operator=( FIoStorePackageMap&& ) = default;
+
 	/** Salvages the provided IoStore container for the exports and script objects and populates the map */
 	void PopulateFromContainer(const TSharedPtr<FIoStoreReader>& Reader);
 
-	/** Attempts to find a script object in the map, returns true and the info if it was found */
-	bool FindScriptObject( const FPackageObjectIndex& Index, FPackageMapScriptObjectEntry& OutMapEntry ) const;
+	/** Reads the script objects and the container header of the container, which lists the packages in it and the packages they import */
+	void ReadContainerHeader( const TSharedPtr<FIoStoreReader>& Reader );
+
+	/** Reads the headers of the packages in the container. Container header must have been read first. If the set of packages is provided, other packages are not read */
+	void ReadPackagesFromContainer( const TSharedPtr<FIoStoreReader>& Reader, const TSet<FPackageId>* PackagesToRead = nullptr );
+
+	/**
+	 * Moves the contents of the map populated from another container into this one. Packages present in both maps are overriden by the merged map,
+	 * so merging the maps in the container order gives the same result as populating a single map from all of the containers in that order.
+	 */
+	void MergeFrom( FIoStorePackageMap&& OtherPackageMap );
+
+	/** Attempts to find a script object in the map, returns nullptr if it was not found. The entry is owned by the map */
+	const FPackageMapScriptObjectEntry* FindScriptObject( const FPackageObjectIndex& Index ) const;
+
+	/**
+	 * Returns the path of the script object, from the top level package to the object itself, with the class paths of the objects already resolved.
+	 * Returns an empty view if the script object was not found. The path is owned by the map
+	 */
+	TArrayView<const FPackageMapScriptObjectPathEntry> FindScriptObjectPath( const FPackageObjectIndex& Index ) const;
 
-	/** Attempts to find the export bundle for the given package */
-	bool FindExportBundleData( const FPackageId& PackageId, FPackageMapExportBundleEntry& OutExportBundleEntry ) const;
+	/** Attempts to find the export bundle for the given package, returns nullptr if it was not found. The entry is owned by the map */
+	const FPackageMapExportBundleEntry* FindExportBundleData( const FPackageId& PackageId ) const;
 
-	bool FindPackageContainerMetadata( FIoContainerId ContainerId, FPackageContainerMetadata& OutMetadata ) const;
+	const FPackageContainerMetadata* FindPackageContainerMetadata( FIoContainerId ContainerId ) const;
 
-	bool FindPackageHeader( const FPackageId& PackageId, FPackageHeaderData& OutPackageHeader ) const;
+	const FPackageHeaderData* FindPackageHeader( const FPackageId& PackageId ) const;
+
+	/** Returns the index of the public export with the given key in the export map of it's package, or INDEX_NONE if there is no such export */
+	int32 FindPublicExportIndex( const FPublicExportKey& ExportKey ) const;
+
+	/** Logs all package imports that do not resolve to a public export of a package in the map, optionally only for the given packages. Returns the number of such imports */
+	int32 ReportDanglingImports( const TSet<FPackageId>* PackagesToCheck = nullptr ) const;
 
 	FORCEINLINE int32 GetTotalPackageCount() const { return PackageMap.Num(); }
+
+	/** Returns the number of bytes allocated for the data of the packages in the map, not including the lookup maps */
+	SIZE_T GetAllocatedPackageDataSize() const;
+
+	/**
+	 * Computes the hash of the parts of the package that affect the packages importing it, e.g. the names, outers and classes of it's exports.
+	 * Returns an empty hash if the package is not in the map.
+	 */
+	FSHAHash ComputeExportLayoutHash( const FPackageId& PackageId ) const;
+
+	/**
+	 * Collects the packages which exports the imports of the given package are resolved through when it is written: the directly imported packages,
+	 * and the packages of the outers and classes of the imported exports, transitively. The package itself is not included unless it imports itself through another package
+	 */
+	void CollectImportResolutionPackages( const FPackageId& PackageId, TSet<FPackageId>& OutPackageIds ) const;
+
+	/** Computes the hash of all script objects in the map */
+	FSHAHash ComputeScriptObjectsHash() const;
+
+	/** Returns the ID of the chunk containing the package header and exports */
+	static FIoChunkId GetPackageChunkId( const FPackageId& PackageId, bool bIsOptionalSegmentPackage );
+
+	/** Serializes the contents of the map. Names are serialized through the archive, so it is up to the archive to store them compactly */
+	void Serialize( FArchive& Ar );
 private:
 	void ReadScriptObjects( const FIoBuffer& ChunkBuffer );
-	FPackageMapExportBundleEntry* ReadExportBundleData( const FPackageId& PackageId, const FIoStoreTocChunkInfo& ChunkInfo, const FIoBuffer& ChunkBuffer );
-	
-	static FPackageLocalObjectRef ResolvePackageLocalRef( const FPackageObjectIndex& PackageObjectIndex, const TArrayView<const FPackageId>& ImportedPackages, const TArrayView<const uint64>& ImportedPublicExportHashes );
+	/** Rebuilds the flattened script object paths from the script object map */
+	void BuildScriptObjectPaths();
+	FPackageMapArenaRange BuildScriptObjectPath( const FPackageObjectIndex& Index );
+	void ReadExportBundleData( const FPackageId& PackageId, const FIoStoreTocChunkInfo& ChunkInfo, const FIoBuffer& ChunkBuffer, TArrayView<const FIoChunkId> BulkDataChunkIds );
+	void RemovePublicExports( const FPackageId& PackageId, const FPackageMapExportBundleEntry& PackageData );
+	/** Returns the index of the name in the unique names of the arenas, adding it if it is not there yet */
+	int32 InternName( FName Name );
+	/** Returns the index of the directory in the package directories of the arenas, adding it if it is not there yet */
+	int32 InternPackageDirectory( const FString& PackageDirectory );
 };
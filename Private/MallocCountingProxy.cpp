@@ -0,0 +1,126 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#include "MallocCountingProxy.h"
+
+FMallocCountingProxy* FMallocCountingProxy::Instance = nullptr;
+
+FMallocCountingProxy::FMallocCountingProxy( FMalloc* InMalloc ) : UsedMalloc( InMalloc )
+{
+}
+
+void FMallocCountingProxy::Install()
+{
+	if ( Instance == nullptr )
+	{
+		// Allocator is only created on the first allocation, which has usually been made by the static initialization already
+		if ( GMalloc == nullptr )
+		{
+			FMemory::Free( FMemory::Malloc( 0 ) );
+		}
+
+		// Allocations made before the proxy has been installed are still freed through it, the proxy just forwards them to the underlying allocator without counting frees
+		Instance = new FMallocCountingProxy( GMalloc );
+		GMalloc = Instance;
+	}
+}
+
+FAllocationCounters FMallocCountingProxy::GetCounters() const
+{
+	return FAllocationCounters{ NumAllocations.load( std::memory_order_relaxed ), NumBytesAllocated.load( std::memory_order_relaxed ) };
+}
+
+void* FMallocCountingProxy::Malloc( SIZE_T Size, uint32 Alignment )
+{
+	CountAllocation( Size );
+	return UsedMalloc->Malloc( Size, Alignment );
+}
+
+void* FMallocCountingProxy::TryMalloc( SIZE_T Size, uint32 Alignment )
+{
+	CountAllocation( Size );
+	return UsedMalloc->TryMalloc( Size, Alignment );
+}
+
+void* FMallocCountingProxy::Realloc( void* Original, SIZE_T Size, uint32 Alignment )
+{
+	// Growing an existing allocation is counted as a new allocation, since that is what it usually ends up being
+	if ( Size != 0 )
+	{
+		CountAllocation( Size );
+	}
+	return UsedMalloc->Realloc( Original, Size, Alignment );
+}
+
+void* FMallocCountingProxy::TryRealloc( void* Original, SIZE_T Size, uint32 Alignment )
+{
+	if ( Size != 0 )
+	{
+		CountAllocation( Size );
+	}
+	return UsedMalloc->TryRealloc( Original, Size, Alignment );
+}
+
+void FMallocCountingProxy::Free( void* Original )
+{
+	UsedMalloc->Free( Original );
+}
+
+SIZE_T FMallocCountingProxy::QuantizeSize( SIZE_T Count, uint32 Alignment )
+{
+	return UsedMalloc->QuantizeSize( Count, Alignment );
+}
+
+bool FMallocCountingProxy::GetAllocationSize( void* Original, SIZE_T& SizeOut )
+{
+	return UsedMalloc->GetAllocationSize( Original, SizeOut );
+}
+
+void FMallocCountingProxy::Trim( bool bTrimThreadCaches )
+{
+	UsedMalloc->Trim( bTrimThreadCaches );
+}
+
+void FMallocCountingProxy::SetupTLSCachesOnCurrentThread()
+{
+	UsedMalloc->SetupTLSCachesOnCurrentThread();
+}
+
+void FMallocCountingProxy::ClearAndDisableTLSCachesOnCurrentThread()
+{
+	UsedMalloc->ClearAndDisableTLSCachesOnCurrentThread();
+}
+
+void FMallocCountingProxy::InitializeStatsMetadata()
+{
+	UsedMalloc->InitializeStatsMetadata();
+}
+
+void FMallocCountingProxy::UpdateStats()
+{
+	UsedMalloc->UpdateStats();
+}
+
+void FMallocCountingProxy::GetAllocatorStats( FGenericMemoryStats& OutStats )
+{
+	UsedMalloc->GetAllocatorStats( OutStats );
+}
+
+void FMallocCountingProxy::DumpAllocatorStats( FOutputDevice& Ar )
+{
+	UsedMalloc->DumpAllocatorStats( Ar );
+}
+
+bool FMallocCountingProxy::IsInternallyThreadSafe() const
+{
+	return UsedMalloc->IsInternallyThreadSafe();
+}
+
+bool FMallocCountingProxy::ValidateHeap()
+{
+	return UsedMalloc->ValidateHeap();
+}
+
+const TCHAR* FMallocCountingProxy::GetDescriptiveName()
+{
+	return UsedMalloc->GetDescriptiveName();
+}
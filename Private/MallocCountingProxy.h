@@ -0,0 +1,68 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/MemoryBase.h"
+#include <atomic>
+
+/** Snapshot of the number of heap allocations performed and the number of bytes requested by them */
+struct FAllocationCounters
+{
+	uint64 NumAllocations{0};
+	uint64 NumBytesAllocated{0};
+
+	FAllocationCounters operator-( const FAllocationCounters& Other ) const
+	{
+		return FAllocationCounters{ NumAllocations - Other.NumAllocations, NumBytesAllocated - Other.NumBytesAllocated };
+	}
+};
+
+/**
+ * Malloc proxy counting the number of heap allocations going through GMalloc. Only installed when -AllocStats is passed,
+ * since the counting is not free when multiple threads are allocating at the same time.
+ */
+class FMallocCountingProxy final : public FMalloc
+{
+	FMalloc* UsedMalloc;
+	std::atomic<uint64> NumAllocations{0};
+	std::atomic<uint64> NumBytesAllocated{0};
+
+	static FMallocCountingProxy* Instance;
+public:
+	explicit FMallocCountingProxy( FMalloc* InMalloc );
+
+	/** Wraps GMalloc into the counting proxy. Must be called before the engine is initialized, while the main thread is the only one using the allocator */
+	static void Install();
+	/** Returns the installed proxy, or nullptr if allocations are not being counted */
+	FORCEINLINE static FMallocCountingProxy* Get() { return Instance; }
+
+	/** Returns the current value of the counters */
+	FAllocationCounters GetCounters() const;
+
+	// Begin FMalloc interface
+	virtual void* Malloc( SIZE_T Size, uint32 Alignment ) override;
+	virtual void* TryMalloc( SIZE_T Size, uint32 Alignment ) override;
+	virtual void* Realloc( void* Original, SIZE_T Size, uint32 Alignment ) override;
+	virtual void* TryRealloc( void* Original, SIZE_T Size, uint32 Alignment ) override;
+	virtual void Free( void* Original ) override;
+	virtual SIZE_T QuantizeSize( SIZE_T Count, uint32 Alignment ) override;
+	virtual bool GetAllocationSize( void* Original, SIZE_T& SizeOut ) override;
+	virtual void Trim( bool bTrimThreadCaches ) override;
+	virtual void SetupTLSCachesOnCurrentThread() override;
+	virtual void ClearAndDisableTLSCachesOnCurrentThread() override;
+	virtual void InitializeStatsMetadata() override;
+	virtual void UpdateStats() override;
+	virtual void GetAllocatorStats( FGenericMemoryStats& OutStats ) override;
+	virtual void DumpAllocatorStats( FOutputDevice& Ar ) override;
+	virtual bool IsInternallyThreadSafe() const override;
+	virtual bool ValidateHeap() override;
+	virtual const TCHAR* GetDescriptiveName() override;
+	// End FMalloc interface
+private:
+	FORCEINLINE void CountAllocation( SIZE_T Size )
+	{
+		NumAllocations.fetch_add( 1, std::memory_order_relaxed );
+		NumBytesAllocated.fetch_add( Size, std::memory_order_relaxed );
+	}
+};
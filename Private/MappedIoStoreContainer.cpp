@@ -0,0 +1,85 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#include "MappedIoStoreContainer.h"
+#include "ZenTools.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/PlatformFileManager.h"
+#include "IO/IoStore.h"
+
+TSharedPtr<FMappedIoStoreContainer> FMappedIoStoreContainer::TryCreate( const TSharedPtr<FIoStoreReader>& InReader, const FString& ContainerPathWithoutExtension )
+{
+	// Encrypted chunks have to be decrypted by the reader, so they can never be used from the mapped file directly
+	if ( EnumHasAnyFlags( InReader->GetContainerFlags(), EIoContainerFlags::Encrypted ) )
+	{
+		return nullptr;
+	}
+
+	const FString ContainerFilePath = ContainerPathWithoutExtension + TEXT(".ucas");
+	TUniquePtr<IMappedFileHandle> MappedFileHandle( FPlatformFileManager::Get().GetPlatformFile().OpenMapped( *ContainerFilePath ) );
+	if ( !MappedFileHandle.IsValid() || MappedFileHandle->GetFileSize() <= 0 )
+	{
+		UE_LOG( LogIoStoreTools, Display, TEXT("Failed to memory map Container file '%s', it will be read normally"), *ContainerFilePath );
+		return nullptr;
+	}
+
+	TUniquePtr<IMappedFileRegion> MappedFileRegion( MappedFileHandle->MapRegion( 0, MappedFileHandle->GetFileSize() ) );
+	if ( !MappedFileRegion.IsValid() )
+	{
+		UE_LOG( LogIoStoreTools, Display, TEXT("Failed to memory map Container file '%s', it will be read normally"), *ContainerFilePath );
+		return nullptr;
+	}
+	return MakeShared<FMappedIoStoreContainer>( InReader, MoveTemp( MappedFileHandle ), MoveTemp( MappedFileRegion ) );
+}
+
+FMappedIoStoreContainer::FMappedIoStoreContainer( const TSharedPtr<FIoStoreReader>& InReader, TUniquePtr<IMappedFileHandle>&& InMappedFileHandle, TUniquePtr<IMappedFileRegion>&& InMappedFileRegion ) :
+	Reader( InReader ), MappedFileHandle( MoveTemp( InMappedFileHandle ) ), MappedFileRegion( MoveTemp( InMappedFileRegion ) )
+{
+	MappedData = MappedFileRegion->GetMappedPtr();
+	MappedSize = MappedFileRegion->GetMappedSize();
+}
+
+FMappedIoStoreContainer::~FMappedIoStoreContainer()
+{
+	// Region must be released before the file handle it has been mapped from
+	MappedFileRegion.Reset();
+	MappedFileHandle.Reset();
+}
+
+bool FMappedIoStoreContainer::TryGetChunkData( const FIoChunkId& ChunkId, TArrayView64<const uint8>& OutChunkData ) const
+{
+	TIoStatusOr<FIoStoreTocChunkInfo> ChunkInfo = Reader->GetChunkInfo( ChunkId );
+	if ( !ChunkInfo.IsOk() || ChunkInfo.ValueOrDie().PartitionIndex != 0 )
+	{
+		return false;
+	}
+	const uint64 ChunkSize = ChunkInfo.ValueOrDie().Size;
+
+	// Chunk can only be used directly if all of it's blocks are uncompressed and follow each other without any padding in between
+	int64 ChunkStartOffset = INDEX_NONE;
+	int64 NextBlockOffset = INDEX_NONE;
+	bool bChunkContiguous = true;
+
+	Reader->EnumerateCompressedBlocksForChunk( ChunkId, [&]( const FIoStoreTocCompressedBlockInfo& BlockInfo )
+	{
+		const int64 BlockOffset = static_cast<int64>( BlockInfo.Offset );
+		if ( BlockInfo.CompressionMethodIndex != 0 || BlockInfo.CompressedSize != BlockInfo.UncompressedSize || ( NextBlockOffset != INDEX_NONE && BlockOffset != NextBlockOffset ) )
+		{
+			bChunkContiguous = false;
+			return false;
+		}
+		if ( ChunkStartOffset == INDEX_NONE )
+		{
+			ChunkStartOffset = BlockOffset;
+		}
+		NextBlockOffset = BlockOffset + BlockInfo.UncompressedSize;
+		return true;
+	} );
+
+	if ( !bChunkContiguous || ChunkStartOffset == INDEX_NONE || NextBlockOffset - ChunkStartOffset < static_cast<int64>( ChunkSize ) || ChunkStartOffset + static_cast<int64>( ChunkSize ) > MappedSize )
+	{
+		return false;
+	}
+
+	OutChunkData = TArrayView64<const uint8>( MappedData + ChunkStartOffset, ChunkSize );
+	return true;
+}
@@ -0,0 +1,32 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "IO/IoDispatcher.h"
+
+class FIoStoreReader;
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+/**
+ * Memory mapped container file (.ucas) of an unencrypted container. Chunks stored without compression are accessed directly in the mapped file,
+ * without the reader allocating a buffer and copying them into it. Only the first partition of the container is mapped.
+ */
+class FMappedIoStoreContainer
+{
+	TSharedPtr<FIoStoreReader> Reader;
+	TUniquePtr<IMappedFileHandle> MappedFileHandle;
+	TUniquePtr<IMappedFileRegion> MappedFileRegion;
+	const uint8* MappedData{nullptr};
+	int64 MappedSize{0};
+public:
+	/** Maps the container file of the reader. Returns null if the container is encrypted or the file cannot be mapped */
+	static TSharedPtr<FMappedIoStoreContainer> TryCreate( const TSharedPtr<FIoStoreReader>& InReader, const FString& ContainerPathWithoutExtension );
+
+	FMappedIoStoreContainer( const TSharedPtr<FIoStoreReader>& InReader, TUniquePtr<IMappedFileHandle>&& InMappedFileHandle, TUniquePtr<IMappedFileRegion>&& InMappedFileRegion );
+	~FMappedIoStoreContainer();
+
+	/** Returns the contents of the chunk inside of the mapped file. Returns false if the chunk is compressed, or is not stored contiguously in the mapped partition */
+	bool TryGetChunkData( const FIoChunkId& ChunkId, TArrayView64<const uint8>& OutChunkData ) const;
+};
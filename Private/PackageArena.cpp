@@ -0,0 +1,26 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#include "PackageArena.h"
+
+FPackageArenaScope::FPackageArenaScope() : MemMark( FMemStack::Get() ), CountersAtStart( GetThreadCounters() )
+{
+}
+
+FAllocationCounters FPackageArenaScope::GetCounters() const
+{
+	return GetThreadCounters() - CountersAtStart;
+}
+
+void FPackageArenaScope::RecordAllocation( SIZE_T NumBytes )
+{
+	FAllocationCounters& ThreadCounters = GetThreadCounters();
+	ThreadCounters.NumAllocations++;
+	ThreadCounters.NumBytesAllocated += NumBytes;
+}
+
+FAllocationCounters& FPackageArenaScope::GetThreadCounters()
+{
+	// Each thread has its own FMemStack, and so its own arena
+	static thread_local FAllocationCounters ThreadCounters;
+	return ThreadCounters;
+}
@@ -0,0 +1,75 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "MallocCountingProxy.h"
+#include "Misc/MemStack.h"
+
+/**
+ * Linear arena backing the transient state of a single package on the calling thread. Built on top of the thread's FMemStack, so allocations
+ * are bumps of the stack pointer, frees are no-ops, and everything allocated while the scope is alive is released at once when it ends.
+ * Containers using the package arena allocators must not outlive the scope they have been allocated in.
+ */
+class FPackageArenaScope
+{
+	FMemMark MemMark;
+	FAllocationCounters CountersAtStart;
+public:
+	FPackageArenaScope();
+
+	/** Returns the number of the allocations made from the arena on this thread since the scope has been entered, and their total size */
+	FAllocationCounters GetCounters() const;
+
+	/** Records the allocation made from the arena on this thread. Called by the container allocators */
+	static void RecordAllocation( SIZE_T NumBytes );
+private:
+	static FAllocationCounters& GetThreadCounters();
+};
+
+/** Container allocator placing the elements into the package arena of the calling thread. Same as TMemStackAllocator, except that the allocations are counted */
+template<uint32 Alignment = DEFAULT_ALIGNMENT>
+class TPackageArenaAllocator
+{
+	using FMemStackAllocator = TMemStackAllocator<Alignment>;
+public:
+	using SizeType = typename FMemStackAllocator::SizeType;
+
+	enum { NeedsElementType = FMemStackAllocator::NeedsElementType };
+	enum { RequireRangeCheck = FMemStackAllocator::RequireRangeCheck };
+
+	class ForAnyElementType : public FMemStackAllocator::ForAnyElementType
+	{
+	public:
+		FORCEINLINE void ResizeAllocation( SizeType PreviousNumElements, SizeType NumElements, SIZE_T NumBytesPerElement )
+		{
+			// Shrinking to zero elements does not allocate anything, everything else is a new allocation since the arena never grows them in place
+			if ( NumElements )
+			{
+				FPackageArenaScope::RecordAllocation( NumElements * NumBytesPerElement );
+			}
+			FMemStackAllocator::ForAnyElementType::ResizeAllocation( PreviousNumElements, NumElements, NumBytesPerElement );
+		}
+	};
+
+	template<typename ElementType>
+	class ForElementType : public ForAnyElementType
+	{
+	public:
+		FORCEINLINE ElementType* GetAllocation() const
+		{
+			return (ElementType*) ForAnyElementType::GetAllocation();
+		}
+	};
+};
+
+template<uint32 Alignment>
+struct TAllocatorTraits<TPackageArenaAllocator<Alignment>> : TAllocatorTraitsBase<TPackageArenaAllocator<Alignment>>
+{
+	enum { IsZeroConstruct = true };
+};
+
+/** Allocators for the sets and maps placed into the package arena, laid out the same way as the ones the renderer uses for the scene rendering allocator */
+using FPackageArenaBitArrayAllocator = TInlineAllocator<4, TPackageArenaAllocator<>>;
+using FPackageArenaSparseArrayAllocator = TSparseArrayAllocator<TPackageArenaAllocator<>, FPackageArenaBitArrayAllocator>;
+using FPackageArenaSetAllocator = TSetAllocator<FPackageArenaSparseArrayAllocator, TInlineAllocator<1, TPackageArenaAllocator<>>>;
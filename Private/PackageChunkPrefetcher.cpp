@@ -0,0 +1,73 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#include "PackageChunkPrefetcher.h"
+#include "MappedIoStoreContainer.h"
+#include "IO/IoStore.h"
+
+FPackageChunkPrefetcher::FPackageChunkPrefetcher( const FIoStoreReader& InReader, const FMappedIoStoreContainer* MappedContainer, TArray<FIoChunkId>&& InChunkIds, int32 InMaxReadsInFlight ) : Reader( InReader ),
+	ChunkIds( MoveTemp( InChunkIds ) ), MaxReadsInFlight( FMath::Max( InMaxReadsInFlight, 1 ) )
+{
+	PendingReads.SetNum( ChunkIds.Num() );
+	MappedChunks.SetNum( ChunkIds.Num() );
+
+	if ( MappedContainer )
+	{
+		for ( int32 ChunkIndex = 0; ChunkIndex < ChunkIds.Num(); ChunkIndex++ )
+		{
+			TArrayView64<const uint8> MappedChunkData;
+			if ( MappedContainer->TryGetChunkData( ChunkIds[ ChunkIndex ], MappedChunkData ) )
+			{
+				MappedChunks[ ChunkIndex ] = MappedChunkData;
+			}
+		}
+	}
+}
+
+uint64 FPackageChunkPrefetcher::GetChunkOffset( const FIoStoreReader& Reader, const FIoChunkId& ChunkId )
+{
+	TIoStatusOr<FIoStoreTocChunkInfo> ChunkInfo = Reader.GetChunkInfo( ChunkId );
+	return ChunkInfo.IsOk() ? ChunkInfo.ValueOrDie().Offset : MAX_uint64;
+}
+
+FIoBuffer FPackageChunkPrefetcher::RetrieveChunk( int32 ChunkIndex )
+{
+	checkf( ChunkIds.IsValidIndex( ChunkIndex ), TEXT("Chunk index %d is out of range"), ChunkIndex );
+
+	// Mapped chunks are returned as a view into the mapped file, without copying them
+	if ( MappedChunks[ ChunkIndex ].IsSet() )
+	{
+		const TArrayView64<const uint8> MappedChunkData = MappedChunks[ ChunkIndex ].GetValue();
+		return FIoBuffer( FIoBuffer::Wrap, MappedChunkData.GetData(), MappedChunkData.Num() );
+	}
+
+	UE::Tasks::TTask<TIoStatusOr<FIoBuffer>> ReadTask;
+	{
+		FScopeLock ScopeLock( &PrefetchCriticalSection );
+
+		// Keep the reads in flight ahead of the chunk being retrieved. The retrieved chunk itself is issued here if the consumers got ahead of the reads
+		const int32 LastReadIndex = FMath::Min( ChunkIndex + MaxReadsInFlight, ChunkIds.Num() );
+		for ( ; NextReadIndex < LastReadIndex; NextReadIndex++ )
+		{
+			if ( !MappedChunks[ NextReadIndex ].IsSet() )
+			{
+				PendingReads[ NextReadIndex ] = Reader.ReadAsync( ChunkIds[ NextReadIndex ], FIoReadOptions() );
+			}
+		}
+
+		checkf( PendingReads[ ChunkIndex ].IsSet(), TEXT("Chunk at index %d has already been retrieved"), ChunkIndex );
+		ReadTask = MoveTemp( PendingReads[ ChunkIndex ].GetValue() );
+		PendingReads[ ChunkIndex ].Reset();
+	}
+
+	const uint64 WaitStartCycles = FPlatformTime::Cycles64();
+	TIoStatusOr<FIoBuffer>& ReadResult = ReadTask.GetResult();
+	WaitCycles += FPlatformTime::Cycles64() - WaitStartCycles;
+
+	checkf( ReadResult.IsOk(), TEXT("Failed to read chunk: %s"), *ReadResult.Status().ToString() );
+	return ReadResult.ValueOrDie();
+}
+
+double FPackageChunkPrefetcher::GetWaitTimeSeconds() const
+{
+	return FPlatformTime::ToSeconds64( WaitCycles.load() );
+}
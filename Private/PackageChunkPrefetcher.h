@@ -0,0 +1,43 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "IO/IoDispatcher.h"
+#include "Tasks/Task.h"
+#include <atomic>
+
+class FIoStoreReader;
+class FMappedIoStoreContainer;
+
+/**
+ * Reads the chunks ahead of the threads consuming them, keeping a fixed number of reads in flight. Chunks should be consumed in the order they were provided in,
+ * which should be the order of their offsets in the container, so that the reads are sequential and the source reaches its sequential bandwidth.
+ */
+class FPackageChunkPrefetcher
+{
+	const FIoStoreReader& Reader;
+	TArray<FIoChunkId> ChunkIds;
+	int32 MaxReadsInFlight;
+	/** Chunks available in the memory mapped container file. These are never read through the reader */
+	TArray<TOptional<TArrayView64<const uint8>>> MappedChunks;
+
+	/** Guards the pending reads and the index of the next read */
+	FCriticalSection PrefetchCriticalSection;
+	TArray<TOptional<UE::Tasks::TTask<TIoStatusOr<FIoBuffer>>>> PendingReads;
+	int32 NextReadIndex{0};
+	/** Time the consumers spent waiting for the reads to complete */
+	std::atomic<uint64> WaitCycles{0};
+public:
+	/** Mapped container is optional, and if provided must outlive the prefetcher */
+	FPackageChunkPrefetcher( const FIoStoreReader& InReader, const FMappedIoStoreContainer* MappedContainer, TArray<FIoChunkId>&& InChunkIds, int32 InMaxReadsInFlight );
+
+	/** Returns the offset of the chunk in the container, used to order the reads. Chunks missing from the container are placed after all other chunks */
+	static uint64 GetChunkOffset( const FIoStoreReader& Reader, const FIoChunkId& ChunkId );
+
+	/** Returns the contents of the chunk at the given index, waiting for the read to complete if necessary, and issues the reads of the following chunks. Each chunk can only be retrieved once */
+	FIoBuffer RetrieveChunk( int32 ChunkIndex );
+
+	/** Returns the total time the consumers have spent waiting for the reads to complete, across all threads */
+	double GetWaitTimeSeconds() const;
+};
@@ -0,0 +1,110 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#include "PackageExportChainCache.h"
+#include "Algo/Reverse.h"
+#include "Misc/ScopeRWLock.h"
+
+FPackageExportChainCache::FPackageExportChainCache( const FIoStorePackageMap& InPackageMap ) : PackageMap( InPackageMap )
+{
+}
+
+const FPackageExportChain& FPackageExportChainCache::FindOrResolveChain( const FPackageMapExportBundleEntry* PackageData, int32 ExportIndex )
+{
+	NumLookups.fetch_add( 1, std::memory_order_relaxed );
+	const FExportKey ExportKey( PackageData, ExportIndex );
+	{
+		FReadScopeLock ReadLock( ChainsLock );
+		if ( const TUniquePtr<const FPackageExportChain>* ExistingChain = Chains.Find( ExportKey ) )
+		{
+			return **ExistingChain;
+		}
+	}
+
+	// Resolved outside of the lock. Threads resolving the same chain at the same time get the same result, and the first one to add it wins
+	TUniquePtr<const FPackageExportChain> NewChain = ResolveChain( PackageData, ExportIndex );
+
+	FWriteScopeLock WriteLock( ChainsLock );
+	TUniquePtr<const FPackageExportChain>& Chain = Chains.FindOrAdd( ExportKey );
+	if ( !Chain.IsValid() )
+	{
+		Chain = MoveTemp( NewChain );
+	}
+	return *Chain;
+}
+
+int32 FPackageExportChainCache::GetNumChains() const
+{
+	FReadScopeLock ReadLock( ChainsLock );
+	return Chains.Num();
+}
+
+TUniquePtr<const FPackageExportChain> FPackageExportChainCache::ResolveChain( const FPackageMapExportBundleEntry* PackageData, int32 ExportIndex ) const
+{
+	TUniquePtr<FPackageExportChain> Chain = MakeUnique<FPackageExportChain>();
+	FPackageLocalObjectRef CurrentRef = FPackageLocalObjectRef::FromExportIndex( ExportIndex );
+
+	// Walk the outers while they are exports of the same package. The outer of the outermost one is resolved by the importing package
+	while ( CurrentRef.IsExport() )
+	{
+		const FPackageMapExportEntry& ExportData = PackageData->GetExportMap()[ CurrentRef.GetExportIndex() ];
+
+		FPackageExportChainLink& Link = Chain->Links.AddDefaulted_GetRef();
+		Link.ObjectName = ExportData.ObjectName;
+		Link.ClassIndex = ExportData.ClassIndex;
+		Link.ClassPath = ResolveTopLevelAssetPath( PackageData, ExportData.ClassIndex );
+
+		CurrentRef = ExportData.OuterIndex;
+	}
+	Chain->RootOuterIndex = CurrentRef;
+
+	// Imports are created starting from the outermost object
+	Algo::Reverse( Chain->Links );
+	return Chain;
+}
+
+FTopLevelAssetPath FPackageExportChainCache::ResolveTopLevelAssetPath( const FPackageMapExportBundleEntry* PackageData, FPackageLocalObjectRef ObjectRef ) const
+{
+	// Names of the objects from the innermost one to the package. Only the last two are needed, but the depth of the chain is not known upfront
+	TArray<FName, TInlineAllocator<8>> ObjectPath;
+
+	while ( true )
+	{
+		if ( ObjectRef.IsScriptImport() )
+		{
+			// Script object paths are stored from the package to the object
+			const TArrayView<const FPackageMapScriptObjectPathEntry> ScriptObjectPath = PackageMap.FindScriptObjectPath( ObjectRef.GetScriptImportIndex() );
+			check( !ScriptObjectPath.IsEmpty() );
+			for ( int32 PathIndex = ScriptObjectPath.Num() - 1; PathIndex >= 0; PathIndex-- )
+			{
+				ObjectPath.Add( ScriptObjectPath[ PathIndex ].ObjectName );
+			}
+			break;
+		}
+		if ( ObjectRef.IsPackageImport() )
+		{
+			// Continue from the imported export inside of the package it belongs to
+			const FPublicExportKey& ImportKey = PackageData->GetPackageImportKey( ObjectRef );
+			PackageData = PackageMap.FindExportBundleData( ImportKey.GetPackageId() );
+			check( PackageData );
+
+			const int32 ImportedExportIndex = PackageMap.FindPublicExportIndex( ImportKey );
+			check( ImportedExportIndex != INDEX_NONE );
+			ObjectRef = FPackageLocalObjectRef::FromExportIndex( ImportedExportIndex );
+			continue;
+		}
+		if ( ObjectRef.IsExport() )
+		{
+			const FPackageMapExportEntry& ExportData = PackageData->GetExportMap()[ ObjectRef.GetExportIndex() ];
+			ObjectPath.Add( ExportData.ObjectName );
+			ObjectRef = ExportData.OuterIndex;
+			continue;
+		}
+
+		// Null in the scope of a package is the package itself
+		ObjectPath.Add( PackageData->PackageName );
+		break;
+	}
+
+	const int32 NumObjects = ObjectPath.Num();
+	return FTopLevelAssetPath( ObjectPath[ NumObjects - 1 ], NumObjects > 1 ? ObjectPath[ NumObjects - 2 ] : NAME_None );
+}
@@ -0,0 +1,59 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "IoStorePackageMap.h"
+#include "UObject/TopLevelAssetPath.h"
+#include <atomic>
+
+/** Single object in the outer chain of an export of another package */
+struct FPackageExportChainLink
+{
+	FName ObjectName;
+	/** Class of the object, still resolved by each importing package so that the class gets its own import */
+	FPackageLocalObjectRef ClassIndex;
+	/** Package and top level asset name of the class of the object, as written into the import map */
+	FTopLevelAssetPath ClassPath;
+};
+
+/** Outer chain of an export of another package, resolved the same way for all packages importing it */
+struct FPackageExportChain
+{
+	/** Outer of the outermost export in the chain, resolved in the importing package. Null means the package itself */
+	FPackageLocalObjectRef RootOuterIndex;
+	/** Exports from the outermost one to the export itself, each one being the outer of the next one */
+	TArray<FPackageExportChainLink, TInlineAllocator<4>> Links;
+};
+
+/**
+ * Memoizes the outer chains of the exports imported by the packages being written. Popular exports (engine classes, base blueprints, shared materials)
+ * are imported by thousands of packages, and their chains and class paths only depend on the package map, so they are resolved once for all of them.
+ * Can be used from multiple threads at the same time. Chains are never removed, so the references returned stay valid for the lifetime of the cache.
+ */
+class FPackageExportChainCache
+{
+	/** Packages are identified by their entry in the package map, which does not change while the packages are written */
+	using FExportKey = TPair<const FPackageMapExportBundleEntry*, int32>;
+
+	const FIoStorePackageMap& PackageMap;
+	mutable FRWLock ChainsLock;
+	TMap<FExportKey, TUniquePtr<const FPackageExportChain>> Chains;
+	std::atomic<int64> NumLookups{0};
+public:
+	explicit FPackageExportChainCache( const FIoStorePackageMap& InPackageMap );
+
+	/** Returns the outer chain of the given export of the package, resolving it if it has not been resolved yet */
+	const FPackageExportChain& FindOrResolveChain( const FPackageMapExportBundleEntry* PackageData, int32 ExportIndex );
+
+	/** Returns the number of chains resolved so far */
+	int32 GetNumChains() const;
+
+	/** Returns the number of times a chain has been requested */
+	FORCEINLINE int64 GetNumLookups() const { return NumLookups.load( std::memory_order_relaxed ); }
+private:
+	TUniquePtr<const FPackageExportChain> ResolveChain( const FPackageMapExportBundleEntry* PackageData, int32 ExportIndex ) const;
+
+	/** Returns the package and top level asset name of the object the reference inside of the given package points to */
+	FTopLevelAssetPath ResolveTopLevelAssetPath( const FPackageMapExportBundleEntry* PackageData, FPackageLocalObjectRef ObjectRef ) const;
+};
@@ -0,0 +1,118 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#include "PackageFilter.h"
+#include "IoStorePackageMap.h"
+
+FPackageFilter::FPackageFilter( const FString& IncludeList, const FString& ExcludeList, bool bInWithDependencies ) : bWithDependencies( bInWithDependencies )
+{
+	IncludeList.ParseIntoArray( IncludePatterns, TEXT(","), true );
+	ExcludeList.ParseIntoArray( ExcludePatterns, TEXT(","), true );
+
+	for ( FString& Pattern : IncludePatterns )
+	{
+		Pattern.TrimStartAndEndInline();
+		FPaths::NormalizeFilename( Pattern );
+	}
+	for ( FString& Pattern : ExcludePatterns )
+	{
+		Pattern.TrimStartAndEndInline();
+		FPaths::NormalizeFilename( Pattern );
+	}
+}
+
+bool FPackageFilter::IsEmpty() const
+{
+	return IncludePatterns.IsEmpty() && ExcludePatterns.IsEmpty();
+}
+
+bool FPackageFilter::Matches( FName PackageName, const FString& PackageFilename ) const
+{
+	const FString PackageNameString = PackageName.ToString();
+	return Matches( &PackageNameString, PackageFilename );
+}
+
+bool FPackageFilter::MayMatch( const FPackageId& PackageId, const FString& PackageFilename ) const
+{
+	FString PackageName;
+	return Matches( TryGuessPackageName( PackageId, PackageFilename, PackageName ) ? &PackageName : nullptr, PackageFilename );
+}
+
+bool FPackageFilter::Matches( const FString* PackageName, const FString& PackageFilename ) const
+{
+	// Patterns that are matched against an unknown package name are considered to match for includes, and to not match for excludes
+	auto MatchesPattern = [&]( const FString& Pattern, bool bUnknownNameResult )
+	{
+		if ( Pattern.StartsWith( TEXT("/") ) )
+		{
+			return PackageName ? PackageName->MatchesWildcard( Pattern ) : bUnknownNameResult;
+		}
+		return PackageFilename.MatchesWildcard( Pattern );
+	};
+
+	if ( !IncludePatterns.IsEmpty() && !IncludePatterns.ContainsByPredicate( [&]( const FString& Pattern ) { return MatchesPattern( Pattern, true ); } ) )
+	{
+		return false;
+	}
+	return !ExcludePatterns.ContainsByPredicate( [&]( const FString& Pattern ) { return MatchesPattern( Pattern, false ); } );
+}
+
+void FPackageFilter::AddDependencies( TSet<FPackageId>& Packages, TFunctionRef<const FPackageHeaderData*( const FPackageId& )> FindPackageHeader )
+{
+	TArray<FPackageId> PackagesToVisit = Packages.Array();
+
+	while ( !PackagesToVisit.IsEmpty() )
+	{
+		const FPackageId PackageId = PackagesToVisit.Pop( false );
+
+		if ( const FPackageHeaderData* PackageHeader = FindPackageHeader( PackageId ) )
+		{
+			for ( const FPackageId& ImportedPackageId : PackageHeader->ImportedPackages )
+			{
+				bool bAlreadyInSet = false;
+				Packages.Add( ImportedPackageId, &bAlreadyInSet );
+
+				if ( !bAlreadyInSet )
+				{
+					PackagesToVisit.Add( ImportedPackageId );
+				}
+			}
+		}
+	}
+}
+
+bool FPackageFilter::TryGuessPackageName( const FPackageId& PackageId, const FString& PackageFilename, FString& OutPackageName )
+{
+	// Content of the engine, the project and the plugins is usually in the Content folder, which is mounted to /Engine, /Game and /<PluginName> respectively
+	const int32 ContentFolderIndex = PackageFilename.Find( TEXT("/Content/"), ESearchCase::IgnoreCase );
+	if ( ContentFolderIndex == INDEX_NONE )
+	{
+		return false;
+	}
+
+	const FString RootFolderPath = PackageFilename.Left( ContentFolderIndex );
+	const FString PackagePathInContent = FPaths::GetBaseFilename( PackageFilename.Mid( ContentFolderIndex + 1 ), false );
+
+	TArray<FString, TInlineAllocator<3>> MountPointNames;
+	if ( RootFolderPath.Equals( TEXT("Engine"), ESearchCase::IgnoreCase ) )
+	{
+		MountPointNames.Add( TEXT("Engine") );
+	}
+	else if ( !RootFolderPath.Contains( TEXT("/") ) )
+	{
+		MountPointNames.Add( TEXT("Game") );
+	}
+	MountPointNames.AddUnique( FPaths::GetCleanFilename( RootFolderPath ) );
+
+	// Mount points can be changed by the project and the plugins, so the guess is only trusted if it produces the ID of the package. Package IDs are the hashes of the names
+	for ( const FString& MountPointName : MountPointNames )
+	{
+		// Package path in content starts with Content/, which is replaced with the mount point name
+		FString PackageName = TEXT("/") + MountPointName + PackagePathInContent.Mid( FCString::Strlen( TEXT("Content") ) );
+		if ( FPackageId::FromName( FName( *PackageName ) ) == PackageId )
+		{
+			OutPackageName = MoveTemp( PackageName );
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,48 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "IO/PackageId.h"
+
+struct FPackageHeaderData;
+
+/**
+ * Selects the packages to extract. Patterns starting with a slash are matched against the package name (e.g. /Game/Characters/*),
+ * other patterns are matched against the package file path inside of the container (e.g. MyGame/Content/Characters/*.uasset).
+ * A package is selected if it matches any of the include patterns (or there are none) and none of the exclude patterns.
+ */
+class FPackageFilter
+{
+	TArray<FString> IncludePatterns;
+	TArray<FString> ExcludePatterns;
+	bool bWithDependencies;
+public:
+	FPackageFilter( const FString& IncludeList, const FString& ExcludeList, bool bInWithDependencies );
+
+	/** Returns true if the filter selects all packages */
+	bool IsEmpty() const;
+
+	/** Returns true if the packages imported by the selected packages, directly or indirectly, should be selected too */
+	FORCEINLINE bool ShouldIncludeDependencies() const { return bWithDependencies; }
+
+	/** Returns true if the package matches the filter */
+	bool Matches( FName PackageName, const FString& PackageFilename ) const;
+
+	/**
+	 * Returns true if the package could match the filter, using only the ID and the file path of the package. The package name is derived from the file path for the standard
+	 * mount points, and if it cannot be derived with certainty the name patterns are assumed to include the package and not to exclude it.
+	 */
+	bool MayMatch( const FPackageId& PackageId, const FString& PackageFilename ) const;
+
+	/** Adds all packages imported by the given packages, directly or indirectly, to the set */
+	static void AddDependencies( TSet<FPackageId>& Packages, TFunctionRef<const FPackageHeaderData*( const FPackageId& )> FindPackageHeader );
+
+	/**
+	 * Derives the package name from the file path inside of the container, e.g. MyGame/Content/Maps/Map.umap becomes /Game/Maps/Map. The name is only returned if the ID
+	 * of the package is the one computed from it, since content can be mounted anywhere. Returns false if the name could not be derived
+	 */
+	static bool TryGuessPackageName( const FPackageId& PackageId, const FString& PackageFilename, FString& OutPackageName );
+private:
+	bool Matches( const FString* PackageName, const FString& PackageFilename ) const;
+};
@@ -0,0 +1,255 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#include "PackageMapCache.h"
+#include "IoStorePackageMap.h"
+#include "ZenTools.h"
+#include "Serialization/ArchiveProxy.h"
+#include "Serialization/LargeMemoryWriter.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+/** Magic number at the start of each cache file */
+static constexpr uint32 PackageMapCacheMagic = 0x5A504D43;
+/** Version of the cache file format. Must be bumped each time the layout of the package map or it's serialization changes */
+static constexpr uint32 PackageMapCacheVersion = 4;
+
+/** Writes names as indices into the name table collected during the serialization, instead of writing them as strings each time */
+class FPackageMapCacheNameWriter final : public FArchiveProxy
+{
+	TMap<FNameEntryId, int32> NameIndices;
+public:
+	TArray<FString> NameTable;
+
+	explicit FPackageMapCacheNameWriter( FArchive& InInnerArchive ) : FArchiveProxy( InInnerArchive )
+	{
+	}
+
+	virtual FArchive& operator<<( FName& Name ) override
+	{
+		int32 NameIndex;
+		if ( const int32* ExistingNameIndex = NameIndices.Find( Name.GetDisplayIndex() ) )
+		{
+			NameIndex = *ExistingNameIndex;
+		}
+		else
+		{
+			NameIndex = NameTable.Add( Name.GetPlainNameString() );
+			NameIndices.Add( Name.GetDisplayIndex(), NameIndex );
+		}
+		int32 NameNumber = Name.GetNumber();
+
+		*this << NameIndex;
+		*this << NameNumber;
+		return *this;
+	}
+};
+
+/**
+ * Converts the name table written by FPackageMapCacheNameWriter back into names. Table holds the plain name strings, so they must not be parsed for the number suffix again,
+ * otherwise plain names like Foo_12 would turn into Foo with a number. Numbers are stored separately and applied by FPackageMapCacheNameReader
+ */
+static TArray<FName> MakePackageMapCacheNameTable( const TArray<FString>& NameTableStrings )
+{
+	TArray<FName> NameTable;
+	NameTable.Reserve( NameTableStrings.Num() );
+	for ( const FString& NameString : NameTableStrings )
+	{
+		NameTable.Add( FName( *NameString, NAME_NO_NUMBER_INTERNAL ) );
+	}
+	return NameTable;
+}
+
+/** Reads names written by FPackageMapCacheNameWriter */
+class FPackageMapCacheNameReader final : public FArchiveProxy
+{
+	const TArray<FName>& NameTable;
+public:
+	FPackageMapCacheNameReader( FArchive& InInnerArchive, const TArray<FName>& InNameTable ) : FArchiveProxy( InInnerArchive ), NameTable( InNameTable )
+	{
+	}
+
+	virtual FArchive& operator<<( FName& Name ) override
+	{
+		int32 NameIndex = INDEX_NONE;
+		int32 NameNumber = 0;
+		*this << NameIndex;
+		*this << NameNumber;
+
+		if ( NameTable.IsValidIndex( NameIndex ) )
+		{
+			Name = FName( NameTable[ NameIndex ], NameNumber );
+		}
+		else
+		{
+			Name = NAME_None;
+			SetError();
+			InnerArchive.SetError();
+		}
+		return *this;
+	}
+};
+
+FPackageMapCache::FPackageMapCache( const FString& InCacheDir ) : CacheDir( InCacheDir )
+{
+}
+
+TOptional<FPackageMapCacheKey> FPackageMapCache::ComputeCacheKey( const FString& TocFilePath )
+{
+	FPackageMapCacheKey CacheKey;
+	CacheKey.TocFileSize = IFileManager::Get().FileSize( *TocFilePath );
+	CacheKey.TocTimestamp = IFileManager::Get().GetTimeStamp( *TocFilePath );
+	CacheKey.TocHash = FMD5Hash::HashFile( *TocFilePath );
+
+	if ( CacheKey.TocFileSize < 0 || !CacheKey.TocHash.IsValid() )
+	{
+		return TOptional<FPackageMapCacheKey>();
+	}
+	return CacheKey;
+}
+
+FString FPackageMapCache::GetCacheFilePath( const FString& TocFilePath ) const
+{
+	return FPaths::Combine( CacheDir, FPaths::GetBaseFilename( TocFilePath ) + TEXT(".pkgmap") );
+}
+
+bool FPackageMapCache::Load( const FString& TocFilePath, const FPackageMapCacheKey& CacheKey, FIoStorePackageMap& OutPackageMap ) const
+{
+	const FString CacheFilePath = GetCacheFilePath( TocFilePath );
+
+	TArray<uint8> CacheFileData;
+	if ( !IFileManager::Get().FileExists( *CacheFilePath ) || !FFileHelper::LoadFileToArray( CacheFileData, *CacheFilePath ) )
+	{
+		return false;
+	}
+	FMemoryReader CacheFileReader( CacheFileData );
+
+	uint32 Magic = 0;
+	uint32 Version = 0;
+	FPackageMapCacheKey CachedKey;
+	CacheFileReader << Magic;
+	CacheFileReader << Version;
+
+	if ( CacheFileReader.IsError() || Magic != PackageMapCacheMagic || Version != PackageMapCacheVersion )
+	{
+		UE_LOG( LogIoStoreTools, Display, TEXT("Ignoring Package Map cache file '%s' because it has been written by a different version of ZenTools"), *CacheFilePath );
+		return false;
+	}
+
+	CacheFileReader << CachedKey;
+	if ( CacheFileReader.IsError() || !( CachedKey == CacheKey ) )
+	{
+		UE_LOG( LogIoStoreTools, Display, TEXT("Package Map cache file '%s' is out of date with the Container '%s'"), *CacheFilePath, *TocFilePath );
+		return false;
+	}
+
+	TArray<FString> NameTableStrings;
+	CacheFileReader << NameTableStrings;
+	const TArray<FName> NameTable = MakePackageMapCacheNameTable( NameTableStrings );
+
+	FIoStorePackageMap CachedPackageMap;
+	FPackageMapCacheNameReader NameReader( CacheFileReader, NameTable );
+	CachedPackageMap.Serialize( NameReader );
+
+	if ( CacheFileReader.IsError() || !CacheFileReader.AtEnd() )
+	{
+		UE_LOG( LogIoStoreTools, Warning, TEXT("Package Map cache file '%s' is corrupted, ignoring it"), *CacheFilePath );
+		return false;
+	}
+
+	OutPackageMap = MoveTemp( CachedPackageMap );
+	return true;
+}
+
+bool FPackageMapCache::Save( const FString& TocFilePath, const FPackageMapCacheKey& CacheKey, FIoStorePackageMap& PackageMap ) const
+{
+	// Names are collected while the package map is serialized, so the body has to be written before the header
+	FLargeMemoryWriter BodyWriter;
+	FPackageMapCacheNameWriter NameWriter( BodyWriter );
+	PackageMap.Serialize( NameWriter );
+
+	const FString CacheFilePath = GetCacheFilePath( TocFilePath );
+	const FString TempCacheFilePath = CacheFilePath + TEXT(".tmp");
+
+	// Write into a temporary file first and then move it over the existing one, so that an interrupted run does not leave a partially written cache file behind
+	TUniquePtr<FArchive> CacheFileWriter( IFileManager::Get().CreateFileWriter( *TempCacheFilePath ) );
+	if ( !CacheFileWriter.IsValid() )
+	{
+		UE_LOG( LogIoStoreTools, Warning, TEXT("Failed to open Package Map cache file '%s' for writing"), *TempCacheFilePath );
+		return false;
+	}
+
+	uint32 Magic = PackageMapCacheMagic;
+	uint32 Version = PackageMapCacheVersion;
+	FPackageMapCacheKey WrittenKey = CacheKey;
+	*CacheFileWriter << Magic;
+	*CacheFileWriter << Version;
+	*CacheFileWriter << WrittenKey;
+	*CacheFileWriter << NameWriter.NameTable;
+	CacheFileWriter->Serialize( BodyWriter.GetData(), BodyWriter.TotalSize() );
+
+	const bool bWriteSucceeded = CacheFileWriter->Close();
+	CacheFileWriter.Reset();
+
+	if ( !bWriteSucceeded || !IFileManager::Get().Move( *CacheFilePath, *TempCacheFilePath, true, true ) )
+	{
+		UE_LOG( LogIoStoreTools, Warning, TEXT("Failed to write Package Map cache file '%s'"), *CacheFilePath );
+		IFileManager::Get().Delete( *TempCacheFilePath );
+		return false;
+	}
+	return true;
+}
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST( FPackageMapCacheNameRoundTripTest, "ZenTools.PackageMapCache.NameRoundTrip", EAutomationTestFlags::EngineFilter | EAutomationTestFlags::ApplicationContextMask )
+
+bool FPackageMapCacheNameRoundTripTest::RunTest( const FString& Parameters )
+{
+	// Plain names that look like they have a number suffix must come back as they are, and numbered names must keep their number
+	const TArray<FName> OriginalNames{
+		FName( TEXT("Foo_12"), NAME_NO_NUMBER_INTERNAL ),
+		FName( TEXT("Foo"), NAME_EXTERNAL_TO_INTERNAL( 12 ) ),
+		FName( TEXT("Foo_0"), NAME_NO_NUMBER_INTERNAL ),
+		FName( TEXT("Foo_012"), NAME_NO_NUMBER_INTERNAL ),
+		FName( TEXT("Bar_7"), NAME_EXTERNAL_TO_INTERNAL( 3 ) ),
+		FName( TEXT("Foo_12"), NAME_NO_NUMBER_INTERNAL ),
+		NAME_None,
+	};
+
+	// Same layout as the cache file: the names are written into the body first, and the name table is written after them
+	TArray<uint8> BodyData;
+	FMemoryWriter BodyWriter( BodyData );
+	FPackageMapCacheNameWriter NameWriter( BodyWriter );
+	TArray<FName> WrittenNames = OriginalNames;
+	NameWriter << WrittenNames;
+
+	TArray<uint8> NameTableData;
+	FMemoryWriter NameTableWriter( NameTableData );
+	NameTableWriter << NameWriter.NameTable;
+
+	TArray<FString> NameTableStrings;
+	FMemoryReader NameTableReader( NameTableData );
+	NameTableReader << NameTableStrings;
+	const TArray<FName> NameTable = MakePackageMapCacheNameTable( NameTableStrings );
+
+	FMemoryReader BodyReader( BodyData );
+	FPackageMapCacheNameReader NameReader( BodyReader, NameTable );
+	TArray<FName> ReadNames;
+	NameReader << ReadNames;
+
+	TestFalse( TEXT("Reading the names failed"), BodyReader.IsError() );
+	if ( TestEqual( TEXT("Number of names read"), ReadNames.Num(), OriginalNames.Num() ) )
+	{
+		for ( int32 NameIndex = 0; NameIndex < OriginalNames.Num(); NameIndex++ )
+		{
+			TestEqual( FString::Printf( TEXT("Name %d"), NameIndex ), ReadNames[ NameIndex ].ToString(), OriginalNames[ NameIndex ].ToString() );
+			TestEqual( FString::Printf( TEXT("Number of name %d"), NameIndex ), ReadNames[ NameIndex ].GetNumber(), OriginalNames[ NameIndex ].GetNumber() );
+			TestTrue( FString::Printf( TEXT("Plain name of name %d"), NameIndex ), ReadNames[ NameIndex ].GetPlainNameString().Equals( OriginalNames[ NameIndex ].GetPlainNameString(), ESearchCase::CaseSensitive ) );
+		}
+	}
+	return true;
+}
+
+#endif
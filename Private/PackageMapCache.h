@@ -0,0 +1,52 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/SecureHash.h"
+
+class FIoStorePackageMap;
+
+/** Identifies the exact state of the container TOC the cached package map has been built from */
+struct FPackageMapCacheKey
+{
+	int64 TocFileSize{0};
+	FDateTime TocTimestamp;
+	FMD5Hash TocHash;
+
+	bool operator==( const FPackageMapCacheKey& Other ) const
+	{
+		return TocFileSize == Other.TocFileSize && TocTimestamp == Other.TocTimestamp && TocHash == Other.TocHash;
+	}
+
+	friend FArchive& operator<<( FArchive& Ar, FPackageMapCacheKey& Key )
+	{
+		Ar << Key.TocFileSize;
+		Ar << Key.TocTimestamp;
+		Ar << Key.TocHash;
+		return Ar;
+	}
+};
+
+/**
+ * Stores package maps populated from the individual containers on disk, so that subsequent runs on the same containers
+ * do not have to parse the package headers again. Each container gets it's own cache file, which is only considered valid
+ * if the size, the timestamp and the hash of the container TOC match the ones recorded in it.
+ */
+class FPackageMapCache
+{
+	FString CacheDir;
+public:
+	explicit FPackageMapCache( const FString& InCacheDir );
+
+	/** Computes the cache key for the given container TOC file. Returns an empty optional if the file cannot be read */
+	static TOptional<FPackageMapCacheKey> ComputeCacheKey( const FString& TocFilePath );
+
+	/** Attempts to load the package map for the given container from the cache. Returns false if there is no valid cache entry for it */
+	bool Load( const FString& TocFilePath, const FPackageMapCacheKey& CacheKey, FIoStorePackageMap& OutPackageMap ) const;
+
+	/** Saves the package map populated from the given container into the cache, replacing any previous cache entry for it */
+	bool Save( const FString& TocFilePath, const FPackageMapCacheKey& CacheKey, FIoStorePackageMap& PackageMap ) const;
+private:
+	FString GetCacheFilePath( const FString& TocFilePath ) const;
+};
@@ -0,0 +1,751 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#include "PackageOutputSink.h"
+#include "ZenTools.h"
+#include "Async/Async.h"
+#include "HAL/FileManager.h"
+#include "HAL/FileManagerGeneric.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/Compression.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+#if PLATFORM_WINDOWS
+#include "Windows/WindowsHWrapper.h"
+#else
+#include <unistd.h>
+#endif
+
+/** Size of the tar archive blocks. Entry headers and file data are always padded to the block size */
+static constexpr int64 TarBlockSize = 512;
+/** Amount of data compressed at once into a single gzip member */
+static constexpr int64 TarCompressionBatchSize = 1024 * 1024;
+/** Largest file staged in memory before it is appended to the archive. Larger files are staged in a temporary file */
+static constexpr int64 TarMaxStagedEntrySize = 64 * 1024 * 1024;
+/** Size of the buffer the files staged in temporary files are copied into the archive with */
+static constexpr int64 TarSpillCopyBufferSize = 4 * 1024 * 1024;
+
+bool IPackageOutputSink::IsArchiveOutputPath( const FString& OutputPath )
+{
+	return OutputPath.EndsWith( TEXT(".tar") ) || OutputPath.EndsWith( TEXT(".tar.gz") ) || OutputPath.EndsWith( TEXT(".tgz") );
+}
+
+TSharedPtr<IPackageOutputSink> IPackageOutputSink::CreateForOutputPath( const FString& OutputPath )
+{
+	if ( OutputPath.EndsWith( TEXT(".tar") ) )
+	{
+		return MakeShared<FTarPackageOutputSink>( OutputPath, false );
+	}
+	if ( OutputPath.EndsWith( TEXT(".tar.gz") ) || OutputPath.EndsWith( TEXT(".tgz") ) )
+	{
+		return MakeShared<FTarPackageOutputSink>( OutputPath, true );
+	}
+	return MakeShared<FLooseFilePackageOutputSink>( OutputPath );
+}
+
+FLooseFilePackageOutputSink::FLooseFilePackageOutputSink( const FString& InRootOutputDir ) : RootOutputDir( InRootOutputDir )
+{
+}
+
+TUniquePtr<FArchive> FLooseFilePackageOutputSink::CreateFileWriter( const FString& RelativeFilename, int64 FileSize )
+{
+	return OpenFileWriter( RelativeFilename );
+}
+
+void FLooseFilePackageOutputSink::WriteFile( const FString& RelativeFilename, TArrayView64<const uint8> FileData )
+{
+	const TUniquePtr<FArchive> FileWriter = OpenFileWriter( RelativeFilename );
+	FileWriter->Serialize( const_cast<uint8*>( FileData.GetData() ), FileData.Num() );
+	verifyf( FileWriter->Close(), TEXT("Failed to write file '%s'"), *FPaths::Combine( RootOutputDir, RelativeFilename ) );
+}
+
+/** Creates the hard link to the existing file. Returns false if the file system does not support hard links */
+static bool CreateHardLink( const FString& LinkFilename, const FString& TargetFilename )
+{
+#if PLATFORM_WINDOWS
+	return ::CreateHardLinkW( *LinkFilename, *TargetFilename, nullptr ) != 0;
+#else
+	return ::link( TCHAR_TO_UTF8( *TargetFilename ), TCHAR_TO_UTF8( *LinkFilename ) ) == 0;
+#endif
+}
+
+void FLooseFilePackageOutputSink::CreateLink( const FString& RelativeFilename, const FString& RelativeTargetFilename )
+{
+	const FString Filename = FPaths::Combine( RootOutputDir, RelativeFilename );
+	const FString TargetFilename = FPaths::Combine( RootOutputDir, RelativeTargetFilename );
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+
+	// Link replaces the file left by the previous extraction, if any
+	PlatformFile.SetReadOnly( *Filename, false );
+	PlatformFile.DeleteFile( *Filename );
+	if ( !PreparedDirectories.Contains( FPaths::GetPath( RelativeFilename ) ) )
+	{
+		PlatformFile.CreateDirectoryTree( *FPaths::GetPath( Filename ) );
+	}
+
+	// File systems without hard links get a copy of the file instead
+	if ( !CreateHardLink( Filename, TargetFilename ) )
+	{
+		verifyf( PlatformFile.CopyFile( *Filename, *TargetFilename ), TEXT("Failed to link or copy file '%s' to '%s'"), *TargetFilename, *Filename );
+	}
+}
+
+/** Returns the number of directories on the path, which is the number of directories the file manager checks or creates when creating the directory tree */
+static int32 CountPathDirectories( const FString& DirectoryPath )
+{
+	int32 NumDirectories = 1;
+	for ( const TCHAR Character : DirectoryPath )
+	{
+		NumDirectories += Character == TEXT('/') ? 1 : 0;
+	}
+	return NumDirectories;
+}
+
+TUniquePtr<FArchive> FLooseFilePackageOutputSink::OpenFileWriter( const FString& RelativeFilename )
+{
+	const FString Filename = FPaths::Combine( RootOutputDir, RelativeFilename );
+
+	// Directory has already been created, so open the file directly instead of going through the file manager, which would create the directory tree again
+	if ( PreparedDirectories.Contains( FPaths::GetPath( RelativeFilename ) ) )
+	{
+		if ( IFileHandle* FileHandle = FPlatformFileManager::Get().GetPlatformFile().OpenWrite( *Filename ) )
+		{
+			NumDirectoryCallsSaved += CountPathDirectories( FPaths::GetPath( Filename ) );
+			return MakeUnique<FArchiveFileWriterGeneric>( FileHandle, *Filename, 0 );
+		}
+	}
+
+	// File might be read only, the file manager will take care of that
+	TUniquePtr<FArchive> FileWriter( IFileManager::Get().CreateFileWriter( *Filename, FILEWRITE_EvenIfReadOnly ) );
+	checkf( FileWriter.IsValid(), TEXT("Failed to open file '%s' for writing"), *Filename );
+	return FileWriter;
+}
+
+void FLooseFilePackageOutputSink::PrepareDirectories( const TSet<FString>& RelativeDirectories )
+{
+	// Gather parent directories as well, so every directory can be created with a single call once its parent has been created
+	TSet<FString> AllDirectories;
+	for ( const FString& RelativeDirectory : RelativeDirectories )
+	{
+		for ( FString CurrentDirectory = RelativeDirectory; !CurrentDirectory.IsEmpty(); CurrentDirectory = FPaths::GetPath( CurrentDirectory ) )
+		{
+			bool bAlreadyInSet = false;
+			AllDirectories.Add( CurrentDirectory, &bAlreadyInSet );
+			if ( bAlreadyInSet )
+			{
+				break;
+			}
+		}
+	}
+
+	// Parent directories are always shorter than their children, so sorting by length creates the parents first
+	TArray<FString> SortedDirectories = AllDirectories.Array();
+	SortedDirectories.Sort( []( const FString& A, const FString& B ) { return A.Len() < B.Len(); } );
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	verifyf( PlatformFile.CreateDirectoryTree( *RootOutputDir ), TEXT("Failed to create output directory '%s'"), *RootOutputDir );
+
+	for ( const FString& RelativeDirectory : SortedDirectories )
+	{
+		const FString Directory = FPaths::Combine( RootOutputDir, RelativeDirectory );
+		verifyf( PlatformFile.CreateDirectory( *Directory ), TEXT("Failed to create output directory '%s'"), *Directory );
+	}
+	NumDirectoriesPrepared = SortedDirectories.Num();
+
+	PreparedDirectories = RelativeDirectories;
+	PreparedDirectories.Add( FString() );
+}
+
+void FLooseFilePackageOutputSink::Finalize()
+{
+	if ( NumDirectoriesPrepared != 0 )
+	{
+		UE_LOG( LogIoStoreTools, Display, TEXT("Created %d output directories upfront, saving %lld file system calls to create them for each file"), NumDirectoriesPrepared, FMath::Max<int64>( NumDirectoryCallsSaved.load() - NumDirectoriesPrepared, 0 ) );
+	}
+}
+
+const FString& FLooseFilePackageOutputSink::GetOutputPath() const
+{
+	return RootOutputDir;
+}
+
+/**
+ * Stages the file until it is complete, and then appends it to the tar archive as a single entry. Entries must be contiguous in the archive, so this keeps the archive lock
+ * from being held while the contents of the file are still being produced, e.g. while the chunks copied into it are read. Small files are staged in memory,
+ * files growing over the limit are moved into a temporary file next to the archive, so the memory used by each thread stays bounded regardless of the file sizes
+ */
+class FTarStagedFileWriter final : public FArchive
+{
+	FTarPackageOutputSink& Sink;
+	FString RelativeFilename;
+	TArray64<uint8> StagedData;
+	FString SpillFilename;
+	TUniquePtr<FArchive> SpillWriter;
+	int64 NumBytesWritten{0};
+public:
+	FTarStagedFileWriter( FTarPackageOutputSink& InSink, const FString& InRelativeFilename, int64 FileSize ) : Sink( InSink ), RelativeFilename( InRelativeFilename )
+	{
+		SetIsSaving( true );
+		SetIsPersistent( true );
+
+		// Files of the known size are staged in memory without reallocations if they fit, and spilled right away if they do not
+		if ( FileSize > TarMaxStagedEntrySize )
+		{
+			OpenSpillFile();
+		}
+		else if ( FileSize > 0 )
+		{
+			StagedData.Reserve( FileSize );
+		}
+	}
+
+	virtual ~FTarStagedFileWriter() override
+	{
+		if ( SpillWriter.IsValid() )
+		{
+			verifyf( SpillWriter->Close(), TEXT("Failed to write temporary file '%s' for file '%s'"), *SpillFilename, *RelativeFilename );
+			SpillWriter.Reset();
+
+			const TUniquePtr<FArchive> SpillReader( IFileManager::Get().CreateFileReader( *SpillFilename ) );
+			checkf( SpillReader.IsValid(), TEXT("Failed to open temporary file '%s' for file '%s'"), *SpillFilename, *RelativeFilename );
+			Sink.WriteFileFromArchive( RelativeFilename, *SpillReader, NumBytesWritten );
+		}
+		else
+		{
+			Sink.WriteFile( RelativeFilename, StagedData );
+		}
+
+		if ( !SpillFilename.IsEmpty() )
+		{
+			IFileManager::Get().Delete( *SpillFilename, false, true, true );
+		}
+	}
+
+	virtual void Serialize( void* Data, int64 Num ) override
+	{
+		if ( !SpillWriter.IsValid() && StagedData.Num() + Num > TarMaxStagedEntrySize )
+		{
+			OpenSpillFile();
+			SpillWriter->Serialize( StagedData.GetData(), StagedData.Num() );
+			StagedData.Empty();
+		}
+
+		if ( SpillWriter.IsValid() )
+		{
+			SpillWriter->Serialize( Data, Num );
+		}
+		else
+		{
+			StagedData.Append( static_cast<const uint8*>( Data ), Num );
+		}
+		NumBytesWritten += Num;
+	}
+
+	virtual int64 Tell() override
+	{
+		return NumBytesWritten;
+	}
+
+	virtual int64 TotalSize() override
+	{
+		return NumBytesWritten;
+	}
+
+	virtual FString GetArchiveName() const override
+	{
+		return RelativeFilename;
+	}
+private:
+	void OpenSpillFile()
+	{
+		SpillFilename = FString::Printf( TEXT("%s.%s.tmp"), *Sink.ArchivePath, *FGuid::NewGuid().ToString() );
+		SpillWriter.Reset( IFileManager::Get().CreateFileWriter( *SpillFilename, FILEWRITE_EvenIfReadOnly ) );
+		checkf( SpillWriter.IsValid(), TEXT("Failed to open temporary file '%s' for file '%s'"), *SpillFilename, *RelativeFilename );
+	}
+};
+
+FTarPackageOutputSink::FTarPackageOutputSink( const FString& InArchivePath, bool bInCompressArchive ) : ArchivePath( InArchivePath ), bCompressArchive( bInCompressArchive ),
+	ModificationTime( FDateTime::UtcNow().ToUnixTimestamp() )
+{
+	ArchiveWriter.Reset( IFileManager::Get().CreateFileWriter( *ArchivePath, FILEWRITE_EvenIfReadOnly ) );
+	checkf( ArchiveWriter.IsValid(), TEXT("Failed to open archive '%s' for writing"), *ArchivePath );
+}
+
+FTarPackageOutputSink::~FTarPackageOutputSink()
+{
+	checkf( !ArchiveWriter.IsValid(), TEXT("Archive '%s' has not been finalized"), *ArchivePath );
+}
+
+TUniquePtr<FArchive> FTarPackageOutputSink::CreateFileWriter( const FString& RelativeFilename, int64 FileSize )
+{
+	return MakeUnique<FTarStagedFileWriter>( *this, RelativeFilename, FileSize );
+}
+
+void FTarPackageOutputSink::WriteFile( const FString& RelativeFilename, TArrayView64<const uint8> FileData )
+{
+	const uint64 LockStartCycles = FPlatformTime::Cycles64();
+	FScopeLock ScopeLock( &ArchiveCriticalSection );
+	ArchiveLockWaitCycles.fetch_add( FPlatformTime::Cycles64() - LockStartCycles, std::memory_order_relaxed );
+
+	AppendEntryHeader( RelativeFilename, FileData.Num() );
+	AppendData( FileData.GetData(), FileData.Num() );
+	AppendEntryPadding( FileData.Num() );
+}
+
+void FTarPackageOutputSink::WriteFileFromArchive( const FString& RelativeFilename, FArchive& SourceArchive, int64 FileSize )
+{
+	// Copy buffer is allocated before taking the lock, only the copy itself is done while holding it
+	TArray64<uint8> CopyBuffer;
+	CopyBuffer.SetNumUninitialized( FMath::Min( FileSize, TarSpillCopyBufferSize ) );
+
+	const uint64 LockStartCycles = FPlatformTime::Cycles64();
+	FScopeLock ScopeLock( &ArchiveCriticalSection );
+	ArchiveLockWaitCycles.fetch_add( FPlatformTime::Cycles64() - LockStartCycles, std::memory_order_relaxed );
+
+	AppendEntryHeader( RelativeFilename, FileSize );
+	for ( int64 CopyOffset = 0; CopyOffset < FileSize; CopyOffset += CopyBuffer.Num() )
+	{
+		const int64 CopySize = FMath::Min( FileSize - CopyOffset, CopyBuffer.Num() );
+		SourceArchive.Serialize( CopyBuffer.GetData(), CopySize );
+		checkf( !SourceArchive.IsError(), TEXT("Failed to read the staged contents of file '%s'"), *RelativeFilename );
+		AppendData( CopyBuffer.GetData(), CopySize );
+	}
+	AppendEntryPadding( FileSize );
+}
+
+void FTarPackageOutputSink::CreateLink( const FString& RelativeFilename, const FString& RelativeTargetFilename )
+{
+	const uint64 LockStartCycles = FPlatformTime::Cycles64();
+	FScopeLock ScopeLock( &ArchiveCriticalSection );
+	ArchiveLockWaitCycles.fetch_add( FPlatformTime::Cycles64() - LockStartCycles, std::memory_order_relaxed );
+
+	// Hard link entries have no data, they refer to the entry written earlier in the archive
+	AppendEntryHeader( RelativeFilename, 0, &RelativeTargetFilename );
+}
+
+void FTarPackageOutputSink::Finalize()
+{
+	FScopeLock ScopeLock( &ArchiveCriticalSection );
+
+	// Tar archive ends with two empty blocks
+	const uint8 EndOfArchiveBlocks[ TarBlockSize * 2 ]{};
+	AppendData( EndOfArchiveBlocks, sizeof( EndOfArchiveBlocks ) );
+	FlushPendingData();
+
+	verifyf( ArchiveWriter->Close(), TEXT("Failed to write archive '%s'"), *ArchivePath );
+	ArchiveWriter.Reset();
+}
+
+const FString& FTarPackageOutputSink::GetOutputPath() const
+{
+	return ArchivePath;
+}
+
+double FTarPackageOutputSink::GetProducerWaitTimeSeconds() const
+{
+	return FPlatformTime::ToSeconds64( ArchiveLockWaitCycles.load( std::memory_order_relaxed ) );
+}
+
+/** Writes the number as a zero padded octal number occupying the entire field except for the terminating null character */
+static void WriteTarOctalField( ANSICHAR* Field, int32 FieldSize, uint64 Value )
+{
+	for ( int32 DigitIndex = FieldSize - 2; DigitIndex >= 0; DigitIndex-- )
+	{
+		Field[ DigitIndex ] = '0' + ( Value & 7 );
+		Value >>= 3;
+	}
+	Field[ FieldSize - 1 ] = '\0';
+	checkf( Value == 0, TEXT("Value does not fit into the tar header field") );
+}
+
+void FTarPackageOutputSink::AppendEntryHeader( const FString& RelativeFilename, int64 FileSize, const FString* RelativeLinkTarget )
+{
+	// Header layout as defined by the GNU tar format
+	struct FTarHeader
+	{
+		ANSICHAR Name[100];
+		ANSICHAR Mode[8];
+		ANSICHAR OwnerId[8];
+		ANSICHAR GroupId[8];
+		ANSICHAR Size[12];
+		ANSICHAR ModificationTime[12];
+		ANSICHAR Checksum[8];
+		ANSICHAR TypeFlag;
+		ANSICHAR LinkName[100];
+		ANSICHAR Magic[8];
+		ANSICHAR OwnerName[32];
+		ANSICHAR GroupName[32];
+		ANSICHAR DeviceMajor[8];
+		ANSICHAR DeviceMinor[8];
+		ANSICHAR Padding[167];
+	};
+	static_assert( sizeof( FTarHeader ) == TarBlockSize, "Tar header must occupy exactly one block" );
+
+	auto AppendHeader = [&]( const ANSICHAR* EntryName, int32 EntryNameLength, int64 EntrySize, ANSICHAR TypeFlag, const ANSICHAR* LinkName = nullptr, int32 LinkNameLength = 0 )
+	{
+		FTarHeader Header{};
+		FMemory::Memcpy( Header.Name, EntryName, FMath::Min<int32>( EntryNameLength, sizeof( Header.Name ) ) );
+		if ( LinkName )
+		{
+			FMemory::Memcpy( Header.LinkName, LinkName, FMath::Min<int32>( LinkNameLength, sizeof( Header.LinkName ) ) );
+		}
+		WriteTarOctalField( Header.Mode, sizeof( Header.Mode ), 0644 );
+		WriteTarOctalField( Header.OwnerId, sizeof( Header.OwnerId ), 0 );
+		WriteTarOctalField( Header.GroupId, sizeof( Header.GroupId ), 0 );
+		WriteTarOctalField( Header.Size, sizeof( Header.Size ), EntrySize );
+		WriteTarOctalField( Header.ModificationTime, sizeof( Header.ModificationTime ), ModificationTime );
+		Header.TypeFlag = TypeFlag;
+		FMemory::Memcpy( Header.Magic, "ustar  ", sizeof( Header.Magic ) );
+
+		// Checksum is calculated with the checksum field itself filled with spaces
+		FMemory::Memset( Header.Checksum, ' ', sizeof( Header.Checksum ) );
+		uint32 Checksum = 0;
+		for ( int32 ByteIndex = 0; ByteIndex < TarBlockSize; ByteIndex++ )
+		{
+			Checksum += reinterpret_cast<const uint8*>( &Header )[ ByteIndex ];
+		}
+		WriteTarOctalField( Header.Checksum, 7, Checksum );
+
+		AppendData( &Header, sizeof( Header ) );
+	};
+
+	// Names that do not fit into the header are written as a separate entry preceding the file entry, which is a GNU tar extension supported by all common tools.
+	// Long link targets are written the same way, using a different entry type
+	auto AppendLongName = [&]( const FTCHARToUTF8& LongName, ANSICHAR TypeFlag )
+	{
+		const ANSICHAR LongLinkName[] = "././@LongLink";
+		AppendHeader( LongLinkName, UE_ARRAY_COUNT( LongLinkName ) - 1, LongName.Length() + 1, TypeFlag );
+
+		AppendData( LongName.Get(), LongName.Length() );
+		const ANSICHAR NameTerminator = '\0';
+		AppendData( &NameTerminator, 1 );
+		AppendEntryPadding( LongName.Length() + 1 );
+	};
+
+	const FTCHARToUTF8 EntryName( *RelativeFilename );
+	if ( EntryName.Length() > UE_ARRAY_COUNT( FTarHeader::Name ) )
+	{
+		AppendLongName( EntryName, 'L' );
+	}
+
+	if ( RelativeLinkTarget )
+	{
+		const FTCHARToUTF8 LinkName( **RelativeLinkTarget );
+		if ( LinkName.Length() > UE_ARRAY_COUNT( FTarHeader::LinkName ) )
+		{
+			AppendLongName( LinkName, 'K' );
+		}
+		AppendHeader( reinterpret_cast<const ANSICHAR*>( EntryName.Get() ), EntryName.Length(), 0, '1', reinterpret_cast<const ANSICHAR*>( LinkName.Get() ), LinkName.Length() );
+		return;
+	}
+	AppendHeader( reinterpret_cast<const ANSICHAR*>( EntryName.Get() ), EntryName.Length(), FileSize, '0' );
+}
+
+void FTarPackageOutputSink::AppendEntryPadding( int64 FileSize )
+{
+	const uint8 PaddingBlock[ TarBlockSize ]{};
+	const int64 PaddingSize = Align( FileSize, TarBlockSize ) - FileSize;
+
+	if ( PaddingSize != 0 )
+	{
+		AppendData( PaddingBlock, PaddingSize );
+	}
+}
+
+void FTarPackageOutputSink::AppendData( const void* Data, int64 Size )
+{
+	if ( !bCompressArchive )
+	{
+		ArchiveWriter->Serialize( const_cast<void*>( Data ), Size );
+		return;
+	}
+
+	const uint8* DataBytes = static_cast<const uint8*>( Data );
+	while ( Size > 0 )
+	{
+		const int64 NumBytesToAppend = FMath::Min( Size, TarCompressionBatchSize - PendingUncompressedData.Num() );
+		PendingUncompressedData.Append( DataBytes, NumBytesToAppend );
+		DataBytes += NumBytesToAppend;
+		Size -= NumBytesToAppend;
+
+		if ( PendingUncompressedData.Num() == TarCompressionBatchSize )
+		{
+			FlushPendingData();
+		}
+	}
+}
+
+void FTarPackageOutputSink::FlushPendingData()
+{
+	if ( PendingUncompressedData.IsEmpty() )
+	{
+		return;
+	}
+
+	// Each batch is compressed as a separate gzip member, and concatenated gzip members decompress into the concatenated data
+	const int32 UncompressedSize = (int32) PendingUncompressedData.Num();
+	int32 CompressedSize = FCompression::CompressMemoryBound( NAME_Gzip, UncompressedSize );
+
+	TArray<uint8> CompressedData;
+	CompressedData.SetNumUninitialized( CompressedSize );
+	verifyf( FCompression::CompressMemory( NAME_Gzip, CompressedData.GetData(), CompressedSize, PendingUncompressedData.GetData(), UncompressedSize ), TEXT("Failed to compress data for archive '%s'"), *ArchivePath );
+
+	ArchiveWriter->Serialize( CompressedData.GetData(), CompressedSize );
+	PendingUncompressedData.Reset();
+}
+
+/**
+ * Buffers the file in memory, and queues it to be written once it is complete. If the size of the file is known, the space for it is reserved in the queue
+ * before the buffer is allocated, so the writer waits for the queue instead of allocating the memory over the limit
+ */
+class FWriteBehindFileWriter final : public FArchive
+{
+	FWriteBehindPackageOutputSink& Sink;
+	FString RelativeFilename;
+	TArray64<uint8> FileData;
+	int64 Offset{0};
+	int64 ReservedSize{INDEX_NONE};
+public:
+	FWriteBehindFileWriter( FWriteBehindPackageOutputSink& InSink, const FString& InRelativeFilename, int64 FileSize ) : Sink( InSink ), RelativeFilename( InRelativeFilename )
+	{
+		SetIsSaving( true );
+		SetIsPersistent( true );
+
+		if ( FileSize != INDEX_NONE )
+		{
+			Sink.ReserveQueueSpace( FileSize );
+			ReservedSize = FileSize;
+			FileData.Reserve( FileSize );
+		}
+	}
+
+	virtual ~FWriteBehindFileWriter() override
+	{
+		if ( ReservedSize != INDEX_NONE )
+		{
+			Sink.EnqueueReservedFile( RelativeFilename, MoveTemp( FileData ), ReservedSize );
+		}
+		else
+		{
+			Sink.EnqueueFile( RelativeFilename, MoveTemp( FileData ) );
+		}
+	}
+
+	virtual void Serialize( void* Data, int64 Num ) override
+	{
+		if ( Offset + Num > FileData.Num() )
+		{
+			FileData.SetNumUninitialized( Offset + Num, false );
+		}
+		FMemory::Memcpy( FileData.GetData() + Offset, Data, Num );
+		Offset += Num;
+	}
+
+	virtual void Seek( int64 InPos ) override
+	{
+		check( InPos >= 0 && InPos <= FileData.Num() );
+		Offset = InPos;
+	}
+
+	virtual int64 Tell() override
+	{
+		return Offset;
+	}
+
+	virtual int64 TotalSize() override
+	{
+		return FileData.Num();
+	}
+
+	virtual FString GetArchiveName() const override
+	{
+		return RelativeFilename;
+	}
+};
+
+FWriteBehindPackageOutputSink::FWriteBehindPackageOutputSink( const TSharedPtr<IPackageOutputSink>& InInnerSink, const FPackageWriteQueueSettings& InSettings ) : InnerSink( InInnerSink ), Settings( InSettings )
+{
+	check( Settings.NumIoThreads > 0 && Settings.MaxQueuedFiles > 0 );
+	IoThreadsStartTime = FPlatformTime::Seconds();
+
+	for ( int32 ThreadIndex = 0; ThreadIndex < Settings.NumIoThreads; ThreadIndex++ )
+	{
+		IoThreads.Add( Async( EAsyncExecution::Thread, [this]() { ProcessQueue(); } ) );
+	}
+}
+
+FWriteBehindPackageOutputSink::~FWriteBehindPackageOutputSink()
+{
+	StopIoThreads();
+}
+
+TUniquePtr<FArchive> FWriteBehindPackageOutputSink::CreateFileWriter( const FString& RelativeFilename, int64 FileSize )
+{
+	// Files that would not fit into the queue anyway are written directly, instead of buffering them in their entirety
+	if ( FileSize > Settings.MaxQueuedBytes )
+	{
+		return InnerSink->CreateFileWriter( RelativeFilename, FileSize );
+	}
+	return MakeUnique<FWriteBehindFileWriter>( *this, RelativeFilename, FileSize );
+}
+
+void FWriteBehindPackageOutputSink::WriteFile( const FString& RelativeFilename, TArrayView64<const uint8> FileData )
+{
+	if ( FileData.Num() > Settings.MaxQueuedBytes )
+	{
+		WriteFileDirectly( RelativeFilename, FileData );
+		return;
+	}
+
+	// Copy of the data is only made once there is space for it in the queue
+	ReserveQueueSpace( FileData.Num() );
+	EnqueueReservedFile( RelativeFilename, TArray64<uint8>( FileData.GetData(), FileData.Num() ), FileData.Num() );
+}
+
+void FWriteBehindPackageOutputSink::CreateLink( const FString& RelativeFilename, const FString& RelativeTargetFilename )
+{
+	std::unique_lock<std::mutex> QueueLock( QueueMutex );
+	PendingLinks.Add( { RelativeFilename, RelativeTargetFilename } );
+}
+
+void FWriteBehindPackageOutputSink::PrepareDirectories( const TSet<FString>& RelativeDirectories )
+{
+	InnerSink->PrepareDirectories( RelativeDirectories );
+}
+
+double FWriteBehindPackageOutputSink::GetProducerWaitTimeSeconds() const
+{
+	std::unique_lock<std::mutex> QueueLock( QueueMutex );
+	return ProducerWaitTimeSeconds;
+}
+
+void FWriteBehindPackageOutputSink::Flush()
+{
+	// Queued file count only drops once the file has been written by the inner sink, so an empty queue means there are no writes in progress either
+	std::unique_lock<std::mutex> QueueLock( QueueMutex );
+	QueueNotFullCondition.wait( QueueLock, [&]() { return NumQueuedFiles == 0; } );
+}
+
+void FWriteBehindPackageOutputSink::Finalize()
+{
+	StopIoThreads();
+	const double IoThreadsRunTime = FPlatformTime::Seconds() - IoThreadsStartTime;
+
+	for ( const TPair<FString, FString>& PendingLink : PendingLinks )
+	{
+		InnerSink->CreateLink( PendingLink.Key, PendingLink.Value );
+	}
+
+	const double IoThreadsOccupancy = IoThreadsRunTime > 0.0 ? FPlatformTime::ToSeconds64( IoBusyCycles.load() ) / ( IoThreadsRunTime * Settings.NumIoThreads ) : 0.0;
+	UE_LOG( LogIoStoreTools, Display, TEXT("Write-behind queue: %lld files written by %d I/O threads (%.1f%% occupied), peak queue size %.2f MB, %.2f seconds spent waiting for the space in the queue"),
+		NumFilesQueued, Settings.NumIoThreads, IoThreadsOccupancy * 100.0, PeakQueuedBytes / 1024.0 / 1024.0, ProducerWaitTimeSeconds );
+	InnerSink->Finalize();
+}
+
+const FString& FWriteBehindPackageOutputSink::GetOutputPath() const
+{
+	return InnerSink->GetOutputPath();
+}
+
+void FWriteBehindPackageOutputSink::ReserveQueueSpace( int64 FileSize )
+{
+	check( FileSize <= Settings.MaxQueuedBytes );
+	std::unique_lock<std::mutex> QueueLock( QueueMutex );
+	checkf( !bStopRequested, TEXT("File has been written after the output has been finalized") );
+
+	// Each thread produces one file at a time, and the files are never larger than the queue, so the space always frees up eventually
+	auto HasSpaceInQueue = [&]()
+	{
+		return NumQueuedFiles < Settings.MaxQueuedFiles && NumQueuedBytes + FileSize <= Settings.MaxQueuedBytes;
+	};
+	if ( !HasSpaceInQueue() )
+	{
+		const double WaitStartTime = FPlatformTime::Seconds();
+		QueueNotFullCondition.wait( QueueLock, HasSpaceInQueue );
+		ProducerWaitTimeSeconds += FPlatformTime::Seconds() - WaitStartTime;
+	}
+
+	NumQueuedFiles++;
+	NumQueuedBytes += FileSize;
+	PeakQueuedBytes = FMath::Max( PeakQueuedBytes, NumQueuedBytes );
+}
+
+void FWriteBehindPackageOutputSink::EnqueueReservedFile( const FString& RelativeFilename, TArray64<uint8>&& FileData, int64 ReservedSize )
+{
+	std::unique_lock<std::mutex> QueueLock( QueueMutex );
+	checkf( !bStopRequested, TEXT("File '%s' has been written after the output has been finalized"), *RelativeFilename );
+
+	// Writer might have produced less data than it has declared, the queue accounts for the actual size from now on
+	NumQueuedBytes += FileData.Num() - ReservedSize;
+	QueuedFiles.Enqueue( FQueuedFile{ RelativeFilename, MoveTemp( FileData ) } );
+	NumFilesQueued++;
+
+	QueueLock.unlock();
+	QueueNotEmptyCondition.notify_one();
+}
+
+void FWriteBehindPackageOutputSink::EnqueueFile( const FString& RelativeFilename, TArray64<uint8>&& FileData )
+{
+	if ( FileData.Num() > Settings.MaxQueuedBytes )
+	{
+		WriteFileDirectly( RelativeFilename, FileData );
+		return;
+	}
+	const int64 FileSize = FileData.Num();
+	ReserveQueueSpace( FileSize );
+	EnqueueReservedFile( RelativeFilename, MoveTemp( FileData ), FileSize );
+}
+
+void FWriteBehindPackageOutputSink::WriteFileDirectly( const FString& RelativeFilename, TArrayView64<const uint8> FileData )
+{
+	// Time spent writing is the time the producing thread has been blocked by the output, same as if it was waiting for the queue
+	const double WriteStartTime = FPlatformTime::Seconds();
+	InnerSink->WriteFile( RelativeFilename, FileData );
+
+	std::unique_lock<std::mutex> QueueLock( QueueMutex );
+	ProducerWaitTimeSeconds += FPlatformTime::Seconds() - WriteStartTime;
+}
+
+void FWriteBehindPackageOutputSink::ProcessQueue()
+{
+	while ( true )
+	{
+		FQueuedFile QueuedFile;
+		{
+			std::unique_lock<std::mutex> QueueLock( QueueMutex );
+			QueueNotEmptyCondition.wait( QueueLock, [&]() { return !QueuedFiles.IsEmpty() || bStopRequested; } );
+
+			if ( !QueuedFiles.Dequeue( QueuedFile ) )
+			{
+				// Stop has been requested and there is nothing left to write
+				return;
+			}
+		}
+
+		const uint64 WriteStartCycles = FPlatformTime::Cycles64();
+		InnerSink->WriteFile( QueuedFile.RelativeFilename, QueuedFile.FileData );
+		IoBusyCycles += FPlatformTime::Cycles64() - WriteStartCycles;
+
+		{
+			std::unique_lock<std::mutex> QueueLock( QueueMutex );
+			NumQueuedFiles--;
+			NumQueuedBytes -= QueuedFile.FileData.Num();
+		}
+		QueueNotFullCondition.notify_all();
+	}
+}
+
+void FWriteBehindPackageOutputSink::StopIoThreads()
+{
+	{
+		std::unique_lock<std::mutex> QueueLock( QueueMutex );
+		bStopRequested = true;
+	}
+	QueueNotEmptyCondition.notify_all();
+
+	for ( TFuture<void>& IoThread : IoThreads )
+	{
+		IoThread.Wait();
+	}
+	IoThreads.Empty();
+}
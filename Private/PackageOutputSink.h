@@ -0,0 +1,207 @@
+// Copyright Nikita Zolotukhin. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "Containers/Queue.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+/** Destination of the files written by the package writer. All sinks can be used from multiple threads at the same time */
+class IPackageOutputSink
+{
+public:
+	virtual ~IPackageOutputSink() = default;
+
+	/**
+	 * Creates the writer for the file at the given path relative to the output root. The file is complete once the writer is destroyed.
+	 * If the size of the file is known upfront it should be provided, since it allows the sinks buffering the file to allocate the buffer once.
+	 */
+	virtual TUniquePtr<FArchive> CreateFileWriter( const FString& RelativeFilename, int64 FileSize = INDEX_NONE ) = 0;
+
+	/** Writes the file at the given path relative to the output root with the provided contents */
+	virtual void WriteFile( const FString& RelativeFilename, TArrayView64<const uint8> FileData ) = 0;
+
+	/** Creates the file that is a link to another file, both relative to the output root. The target file must have been completely written already */
+	virtual void CreateLink( const FString& RelativeFilename, const FString& RelativeTargetFilename ) = 0;
+
+	/** Called with all directories relative to the output root the files are going to be written into before any of them are written */
+	virtual void PrepareDirectories( const TSet<FString>& RelativeDirectories ) {}
+
+	/** Returns the total time the threads producing the files have spent blocked because the sink could not keep up with them. Only sinks that queue the files or serialize the writes wait for anything */
+	virtual double GetProducerWaitTimeSeconds() const { return 0.0; }
+
+	/**
+	 * Waits until all files passed to the sink so far have been written. Files written after this are guaranteed to land after them,
+	 * which is what makes a file written again for a later container replace the earlier version of it
+	 */
+	virtual void Flush() {}
+
+	/** Finishes writing the output. No files can be written after this */
+	virtual void Finalize() = 0;
+
+	/** Returns the path to the output for logging */
+	virtual const FString& GetOutputPath() const = 0;
+
+	/** Returns true if the output path denotes an archive instead of a directory */
+	static bool IsArchiveOutputPath( const FString& OutputPath );
+
+	/** Creates the sink for the output path. Paths ending with .tar produce a tar archive, .tar.gz or .tgz a gzip compressed tar archive, and other paths a directory with loose files */
+	static TSharedPtr<IPackageOutputSink> CreateForOutputPath( const FString& OutputPath );
+};
+
+/**
+ * Writes the files into the output directory as they are. If the directories are prepared upfront, files inside of them are opened directly,
+ * without creating the directory tree for each file like the file manager does.
+ */
+class FLooseFilePackageOutputSink final : public IPackageOutputSink
+{
+	FString RootOutputDir;
+	/** Directories created by PrepareDirectories, relative to the output root. Not modified once the files start being written */
+	TSet<FString> PreparedDirectories;
+	int32 NumDirectoriesPrepared{0};
+	/** Number of directory creation calls the file manager would have made for the files written into the prepared directories */
+	std::atomic<int64> NumDirectoryCallsSaved{0};
+public:
+	explicit FLooseFilePackageOutputSink( const FString& InRootOutputDir );
+
+	// Begin IPackageOutputSink interface
+	virtual TUniquePtr<FArchive> CreateFileWriter( const FString& RelativeFilename, int64 FileSize ) override;
+	virtual void WriteFile( const FString& RelativeFilename, TArrayView64<const uint8> FileData ) override;
+	virtual void CreateLink( const FString& RelativeFilename, const FString& RelativeTargetFilename ) override;
+	virtual void PrepareDirectories( const TSet<FString>& RelativeDirectories ) override;
+	virtual void Finalize() override;
+	virtual const FString& GetOutputPath() const override;
+	// End IPackageOutputSink interface
+private:
+	TUniquePtr<FArchive> OpenFileWriter( const FString& RelativeFilename );
+};
+
+/**
+ * Writes the files into a single tar archive, optionally compressed with gzip. Files are appended to the archive in the order they are completed.
+ * Compressed archives are written as a sequence of gzip members, which the standard tools decompress as a single stream.
+ */
+class FTarPackageOutputSink final : public IPackageOutputSink
+{
+	friend class FTarStagedFileWriter;
+
+	FString ArchivePath;
+	TUniquePtr<FArchive> ArchiveWriter;
+	bool bCompressArchive;
+	/** Timestamp written for all files in the archive */
+	int64 ModificationTime;
+	/** Guards the archive writer. Only held while a complete entry is appended, never while the contents of the file are produced */
+	FCriticalSection ArchiveCriticalSection;
+	/** Data not compressed yet, compressed in large batches to keep the compression ratio reasonable */
+	TArray64<uint8> PendingUncompressedData;
+	/** Time the threads writing the files have spent waiting for the other threads to finish appending their entries */
+	std::atomic<uint64> ArchiveLockWaitCycles{0};
+public:
+	FTarPackageOutputSink( const FString& InArchivePath, bool bInCompressArchive );
+	virtual ~FTarPackageOutputSink() override;
+
+	// Begin IPackageOutputSink interface
+	virtual TUniquePtr<FArchive> CreateFileWriter( const FString& RelativeFilename, int64 FileSize ) override;
+	virtual void WriteFile( const FString& RelativeFilename, TArrayView64<const uint8> FileData ) override;
+	virtual void CreateLink( const FString& RelativeFilename, const FString& RelativeTargetFilename ) override;
+	virtual double GetProducerWaitTimeSeconds() const override;
+	virtual void Finalize() override;
+	virtual const FString& GetOutputPath() const override;
+	// End IPackageOutputSink interface
+private:
+	/** Appends the file of the given size read from the archive as a single entry, taking the archive critical section for the duration of the copy */
+	void WriteFileFromArchive( const FString& RelativeFilename, FArchive& SourceArchive, int64 FileSize );
+	/** Appends the entry header for the file of the given size, or for the hard link to the given file. Must be called with the archive critical section held */
+	void AppendEntryHeader( const FString& RelativeFilename, int64 FileSize, const FString* RelativeLinkTarget = nullptr );
+	/** Appends the padding after the file of the given size. Must be called with the archive critical section held */
+	void AppendEntryPadding( int64 FileSize );
+	/** Appends raw data to the archive. Must be called with the archive critical section held */
+	void AppendData( const void* Data, int64 Size );
+	/** Compresses and writes the pending data. Must be called with the archive critical section held */
+	void FlushPendingData();
+};
+
+/** Limits of the write-behind queue used by FWriteBehindPackageOutputSink */
+struct FPackageWriteQueueSettings
+{
+	/** Number of threads writing the queued files. Zero disables the queue, and the files are written by the threads producing them */
+	int32 NumIoThreads{2};
+	/** Maximum number of files waiting to be written */
+	int32 MaxQueuedFiles{256};
+	/**
+	 * Maximum total size of the files waiting to be written, including the space reserved by the files of the known size that are still being produced.
+	 * Files larger than this bypass the queue and are written by the threads producing them
+	 */
+	int64 MaxQueuedBytes{512 * 1024 * 1024};
+};
+
+/**
+ * Buffers the files in memory and hands them off to dedicated I/O threads that write them into another sink, so that the threads producing the files
+ * can continue with the next package instead of waiting for the disk. Threads producing the files are blocked once the queue is full.
+ * Files of the known size claim their space in the queue before they are produced, so the memory they are buffered in is always within the queue limits.
+ * Files of an unknown size are buffered by the thread producing them first, and claim their space once they are complete.
+ * Queued files are written in no particular order, so the same file must not be written twice without flushing the sink in between.
+ */
+class FWriteBehindPackageOutputSink final : public IPackageOutputSink
+{
+	friend class FWriteBehindFileWriter;
+
+	struct FQueuedFile
+	{
+		FString RelativeFilename;
+		TArray64<uint8> FileData;
+	};
+
+	TSharedPtr<IPackageOutputSink> InnerSink;
+	FPackageWriteQueueSettings Settings;
+	TArray<TFuture<void>> IoThreads;
+
+	/** Guards the queue and the counters below */
+	mutable std::mutex QueueMutex;
+	std::condition_variable QueueNotEmptyCondition;
+	std::condition_variable QueueNotFullCondition;
+	TQueue<FQueuedFile> QueuedFiles;
+	/** Number and size of the files in the queue, including the ones currently being written and the ones that have reserved their space and are still being produced */
+	int32 NumQueuedFiles{0};
+	int64 NumQueuedBytes{0};
+	bool bStopRequested{false};
+	/** Links are created once all queued files have been written, since their targets might still be in the queue */
+	TArray<TPair<FString, FString>> PendingLinks;
+
+	int64 NumFilesQueued{0};
+	int64 PeakQueuedBytes{0};
+	/** Time spent by the threads producing the files waiting for the space in the queue. Large values mean the output is the bottleneck */
+	double ProducerWaitTimeSeconds{0.0};
+	/** Time spent by the I/O threads writing the files, and the time they have been running for */
+	std::atomic<uint64> IoBusyCycles{0};
+	double IoThreadsStartTime{0.0};
+public:
+	FWriteBehindPackageOutputSink( const TSharedPtr<IPackageOutputSink>& InInnerSink, const FPackageWriteQueueSettings& InSettings );
+	virtual ~FWriteBehindPackageOutputSink() override;
+
+	// Begin IPackageOutputSink interface
+	virtual TUniquePtr<FArchive> CreateFileWriter( const FString& RelativeFilename, int64 FileSize ) override;
+	virtual void WriteFile( const FString& RelativeFilename, TArrayView64<const uint8> FileData ) override;
+	virtual void CreateLink( const FString& RelativeFilename, const FString& RelativeTargetFilename ) override;
+	virtual void PrepareDirectories( const TSet<FString>& RelativeDirectories ) override;
+	virtual double GetProducerWaitTimeSeconds() const override;
+	virtual void Flush() override;
+	virtual void Finalize() override;
+	virtual const FString& GetOutputPath() const override;
+	// End IPackageOutputSink interface
+private:
+	/** Waits for the space for the file of the given size in the queue and claims it. Space is released once the file has been written */
+	void ReserveQueueSpace( int64 FileSize );
+	/** Adds the file to the queue. Space for the file must have been reserved with the given size */
+	void EnqueueReservedFile( const FString& RelativeFilename, TArray64<uint8>&& FileData, int64 ReservedSize );
+	/** Adds the file to the queue, waiting for the space in the queue if it is full. Files too large for the queue are written directly */
+	void EnqueueFile( const FString& RelativeFilename, TArray64<uint8>&& FileData );
+	/** Writes the file on the calling thread, bypassing the queue */
+	void WriteFileDirectly( const FString& RelativeFilename, TArrayView64<const uint8> FileData );
+	/** Writes the queued files until the stop is requested and the queue is empty. Runs on the I/O threads */
+	void ProcessQueue();
+	/** Waits for the queued files to be written and stops the I/O threads */
+	void StopIoThreads();
+};
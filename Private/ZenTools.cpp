@@ -3,15 +3,79 @@
 #include "ZenTools.h"
 #include "CookedAssetWriter.h"
 #include "IoStorePackageMap.h"
+#include "MallocCountingProxy.h"
+#include "MappedIoStoreContainer.h"
+#include "PackageFilter.h"
+#include "PackageMapCache.h"
+#include "PackageOutputSink.h"
 #include "RequiredProgramMainCPPInclude.h"
+#include "Async/ParallelFor.h"
 #include "Serialization/JsonSerializer.h"
+#include <atomic>
 
 IMPLEMENT_APPLICATION(ZenTools, "ZenTools");
 
 DEFINE_LOG_CATEGORY( LogIoStoreTools );
 
+/** Logs the number of heap allocations performed by the given phase of the run, when allocation counting is enabled */
+static void LogAllocationCounters( const TCHAR* PhaseName, const FAllocationCounters& Counters )
+{
+	UE_LOG( LogIoStoreTools, Display, TEXT("%s performed %llu heap allocations totalling %.2f MB"), PhaseName, Counters.NumAllocations, Counters.NumBytesAllocated / 1024.0 / 1024.0 );
+}
+
+/**
+ * Adds the packages from the container matching the filter to the set. If the package map is provided, the packages are matched by their names and file paths,
+ * otherwise only by their file paths, in which case packages that could match are added.
+ */
+static void GatherFilteredPackages( const FPackageFilter& PackageFilter, const FIoStoreReader& Reader, const FPackageContainerMetadata& ContainerMetadata, const FIoStorePackageMap* PackageMap, TSet<FPackageId>& OutPackages )
+{
+	auto GatherPackage = [&]( const FPackageId& PackageId, bool bIsOptionalSegmentPackage )
+	{
+		if ( PackageMap )
+		{
+			const FPackageMapExportBundleEntry* PackageData = PackageMap->FindExportBundleData( PackageId );
+			if ( PackageData && PackageFilter.Matches( PackageData->PackageName, PackageData->GetPackageFilename() ) )
+			{
+				OutPackages.Add( PackageId );
+			}
+			return;
+		}
+
+		TIoStatusOr<FIoStoreTocChunkInfo> ChunkInfo = Reader.GetChunkInfo( FIoStorePackageMap::GetPackageChunkId( PackageId, bIsOptionalSegmentPackage ) );
+		if ( ChunkInfo.IsOk() )
+		{
+			FString PackageFilename = ChunkInfo.ValueOrDie().FileName;
+			PackageFilename.RemoveFromStart( TEXT("../../../") );
+
+			if ( PackageFilter.MayMatch( PackageId, PackageFilename ) )
+			{
+				OutPackages.Add( PackageId );
+			}
+		}
+	};
+
+	for ( const FPackageId& PackageId : ContainerMetadata.PackagesInContainer )
+	{
+		GatherPackage( PackageId, false );
+	}
+	for ( const FPackageId& PackageId : ContainerMetadata.OptionalPackagesInContainer )
+	{
+		GatherPackage( PackageId, true );
+	}
+}
+
 INT32_MAIN_INT32_ARGC_TCHAR_ARGV()
 {
+	// Allocator must be swapped before the engine starts the task graph and the thread pools, so the command line is not available yet and the arguments are checked directly
+	for ( int32 ArgIndex = 1; ArgIndex < ArgC; ArgIndex++ )
+	{
+		if ( FCString::Stricmp( ArgV[ ArgIndex ], TEXT("-AllocStats") ) == 0 )
+		{
+			FMallocCountingProxy::Install();
+			break;
+		}
+	}
+
 	FTaskTagScope Scope(ETaskTag::EGameThread);
 
 	// start up the main loop
@@ -22,6 +86,10 @@ INT32_MAIN_INT32_ARGC_TCHAR_ARGV()
 	int32 Result = FIOStoreTools::ExecuteIOStoreTools( FCommandLine::Get() ) ? 0 : 1;
 
 	UE_LOG( LogIoStoreTools, Display, TEXT("ZenTools executed in %f seconds"), FPlatformTime::Seconds() - StartTime);
+	if ( const FMallocCountingProxy* MallocCountingProxy = FMallocCountingProxy::Get() )
+	{
+		LogAllocationCounters( TEXT("ZenTools"), MallocCountingProxy->GetCounters() );
+	}
 
 	GLog->Flush();
 
@@ -34,7 +102,7 @@ INT32_MAIN_INT32_ARGC_TCHAR_ARGV()
 	return Result;
 }
 
-bool FIOStoreTools::ExtractPackagesFromContainers( const FString& ContainerDirPath, const FString& OutputDirPath, const FString& EncryptionKeysFile )
+bool FIOStoreTools::ExtractPackagesFromContainers( const FString& ContainerDirPath, const FString& OutputDirPath, const FString& EncryptionKeysFile, const FString& PackageMapCacheDir, int32 NumWorkerThreads, bool bIncremental, const FPackageFilter& PackageFilter, const FPackageWriteQueueSettings& WriteQueueSettings, int32 PrefetchDepth, bool bMemoryMapContainers, bool bDeduplicateBulkData, bool bWriteBinaryManifest )
 {
 	TMap<FGuid, FAES::FAESKey> EncryptionKeys;
 	if ( !EncryptionKeysFile.IsEmpty() )
@@ -93,34 +161,214 @@ bool FIOStoreTools::ExtractPackagesFromContainers( const FString& ContainerDirPa
 		return false;
 	}
 
+	// Containers are opened in parallel, but the errors are reported in the container order
 	TArray<TSharedPtr<FIoStoreReader>> ContainerReaders;
-	for ( const FString& ContainerFilename : ContainerTableOfContentsFiles )
+	TArray<FIoStatus> ContainerOpenStatuses;
+	ContainerReaders.SetNum( ContainerTableOfContentsFiles.Num() );
+	ContainerOpenStatuses.Init( FIoStatus::Ok, ContainerTableOfContentsFiles.Num() );
+
+	ParallelFor( ContainerTableOfContentsFiles.Num(), [&]( int32 ContainerIndex )
 	{
-		const TSharedPtr<FIoStoreReader> IoStoreReader = MakeShared<FIoStoreReader>();
-		const FString FullFilePath = FPaths::Combine( ContainerDirPath, ContainerFilename );
-		
-		const FIoStatus OpenStatus = IoStoreReader->Initialize(  *FPaths::ChangeExtension( FullFilePath, TEXT("") ), EncryptionKeys );
+		const FString FullFilePath = FPaths::Combine( ContainerDirPath, ContainerTableOfContentsFiles[ ContainerIndex ] );
+
+		ContainerReaders[ ContainerIndex ] = MakeShared<FIoStoreReader>();
+		ContainerOpenStatuses[ ContainerIndex ] = ContainerReaders[ ContainerIndex ]->Initialize( *FPaths::ChangeExtension( FullFilePath, TEXT("") ), EncryptionKeys );
+	} );
+
+	for ( int32 ContainerIndex = 0; ContainerIndex < ContainerTableOfContentsFiles.Num(); ContainerIndex++ )
+	{
+		const FIoStatus& OpenStatus = ContainerOpenStatuses[ ContainerIndex ];
 		if ( !OpenStatus.IsOk() )
 		{
-			UE_LOG( LogIoStoreTools, Error, TEXT("Failed to open Container file '%s': %s"), *FullFilePath, *OpenStatus.ToString() );
+			UE_LOG( LogIoStoreTools, Error, TEXT("Failed to open Container file '%s': %s"), *FPaths::Combine( ContainerDirPath, ContainerTableOfContentsFiles[ ContainerIndex ] ), *OpenStatus.ToString() );
 			return false;
 		}
-		ContainerReaders.Add( IoStoreReader );
 	}
 
 	UE_LOG( LogIoStoreTools, Display, TEXT("Successfully opened %d Container files"), ContainerReaders.Num() );
 
 	UE_LOG( LogIoStoreTools, Display, TEXT("Building Package Map from Containers") );
+	const FMallocCountingProxy* MallocCountingProxy = FMallocCountingProxy::Get();
+	const FAllocationCounters AllocationsBeforePackageMap = MallocCountingProxy ? MallocCountingProxy->GetCounters() : FAllocationCounters{};
 	const TSharedPtr<FIoStorePackageMap> PackageMap = MakeShared<FIoStorePackageMap>();
 
-	for ( const TSharedPtr<FIoStoreReader>& Reader : ContainerReaders )
+	// Each container is parsed into it's own map in parallel, and then the maps are merged in the container order so that patch containers override the base ones
+	TArray<FIoStorePackageMap> ContainerPackageMaps;
+	ContainerPackageMaps.SetNum( ContainerReaders.Num() );
+
+	const TUniquePtr<FPackageMapCache> PackageMapCache = PackageMapCacheDir.IsEmpty() ? nullptr : MakeUnique<FPackageMapCache>( PackageMapCacheDir );
+	std::atomic<int32> NumCachedContainers{0};
+
+	// When the packages are filtered, only the container headers are read at first, and the package headers are only read for the packages that are needed
+	const bool bFilterPackages = !PackageFilter.IsEmpty();
+	TArray<bool> ContainerPackageMapsFromCache;
+	ContainerPackageMapsFromCache.Init( false, ContainerReaders.Num() );
+
+	ParallelFor( ContainerReaders.Num(), [&]( int32 ContainerIndex )
+	{
+		const FString TocFilePath = FPaths::Combine( ContainerDirPath, ContainerTableOfContentsFiles[ ContainerIndex ] );
+		const TOptional<FPackageMapCacheKey> CacheKey = PackageMapCache ? FPackageMapCache::ComputeCacheKey( TocFilePath ) : TOptional<FPackageMapCacheKey>();
+
+		if ( CacheKey.IsSet() && PackageMapCache->Load( TocFilePath, CacheKey.GetValue(), ContainerPackageMaps[ ContainerIndex ] ) )
+		{
+			ContainerPackageMapsFromCache[ ContainerIndex ] = true;
+			NumCachedContainers++;
+			return;
+		}
+
+		// Partially populated maps are not saved to the cache, since the next run might need different packages
+		if ( bFilterPackages )
+		{
+			ContainerPackageMaps[ ContainerIndex ].ReadContainerHeader( ContainerReaders[ ContainerIndex ] );
+			return;
+		}
+
+		ContainerPackageMaps[ ContainerIndex ].PopulateFromContainer( ContainerReaders[ ContainerIndex ] );
+
+		if ( CacheKey.IsSet() )
+		{
+			PackageMapCache->Save( TocFilePath, CacheKey.GetValue(), ContainerPackageMaps[ ContainerIndex ] );
+		}
+	} );
+
+	if ( PackageMapCache )
+	{
+		UE_LOG( LogIoStoreTools, Display, TEXT("Loaded Package Map for %d out of %d Containers from the cache in '%s'"), NumCachedContainers.load(), ContainerReaders.Num(), *PackageMapCacheDir );
+	}
+
+	if ( bFilterPackages )
+	{
+		// Packages later in the container order override the ones before them
+		auto FindContainerPackageHeader = [&]( const FPackageId& PackageId ) -> const FPackageHeaderData*
+		{
+			for ( int32 ContainerIndex = ContainerPackageMaps.Num() - 1; ContainerIndex >= 0; ContainerIndex-- )
+			{
+				if ( const FPackageHeaderData* PackageHeader = ContainerPackageMaps[ ContainerIndex ].FindPackageHeader( PackageId ) )
+				{
+					return PackageHeader;
+				}
+			}
+			return nullptr;
+		};
+
+		// Package names are not known until the package headers are read, so select the packages that could match the filter based on their file paths
+		TSet<FPackageId> PackagesToRead;
+		for ( int32 ContainerIndex = 0; ContainerIndex < ContainerReaders.Num(); ContainerIndex++ )
+		{
+			const FIoStoreReader& Reader = *ContainerReaders[ ContainerIndex ];
+			if ( const FPackageContainerMetadata* ContainerMetadata = ContainerPackageMaps[ ContainerIndex ].FindPackageContainerMetadata( Reader.GetContainerId() ) )
+			{
+				GatherFilteredPackages( PackageFilter, Reader, *ContainerMetadata, nullptr, PackagesToRead );
+			}
+		}
+
+		// Packages imported by the selected packages must be read too even if they are not written, since the imported objects are resolved through their exports,
+		// which can in turn reference the objects in the packages they import (e.g. the class of the imported object)
+		FPackageFilter::AddDependencies( PackagesToRead, FindContainerPackageHeader );
+		UE_LOG( LogIoStoreTools, Display, TEXT("Reading headers of %d Packages matching the filter and their imports"), PackagesToRead.Num() );
+
+		ParallelFor( ContainerReaders.Num(), [&]( int32 ContainerIndex )
+		{
+			if ( !ContainerPackageMapsFromCache[ ContainerIndex ] )
+			{
+				ContainerPackageMaps[ ContainerIndex ].ReadPackagesFromContainer( ContainerReaders[ ContainerIndex ], &PackagesToRead );
+			}
+		} );
+	}
+
+	for ( FIoStorePackageMap& ContainerPackageMap : ContainerPackageMaps )
+	{
+		PackageMap->MergeFrom( MoveTemp( ContainerPackageMap ) );
+	}
+	ContainerPackageMaps.Empty();
+	UE_LOG( LogIoStoreTools, Display, TEXT("Populated Package Map with %d Packages (%.2f MB of package data)"), PackageMap->GetTotalPackageCount(), PackageMap->GetAllocatedPackageDataSize() / ( 1024.0 * 1024.0 ) );
+
+	// Now that the package names are known, select the packages that actually match the filter
+	TOptional<TSet<FPackageId>> SelectedPackages;
+	if ( bFilterPackages )
+	{
+		SelectedPackages.Emplace();
+		for ( const TSharedPtr<FIoStoreReader>& Reader : ContainerReaders )
+		{
+			if ( const FPackageContainerMetadata* ContainerMetadata = PackageMap->FindPackageContainerMetadata( Reader->GetContainerId() ) )
+			{
+				GatherFilteredPackages( PackageFilter, *Reader, *ContainerMetadata, PackageMap.Get(), SelectedPackages.GetValue() );
+			}
+		}
+		if ( PackageFilter.ShouldIncludeDependencies() )
+		{
+			FPackageFilter::AddDependencies( SelectedPackages.GetValue(), [&]( const FPackageId& PackageId ) { return PackageMap->FindPackageHeader( PackageId ); } );
+		}
+
+		// Dependencies that are not in any of the containers cannot be written
+		for ( auto It = SelectedPackages->CreateIterator(); It; ++It )
+		{
+			if ( PackageMap->FindExportBundleData( *It ) == nullptr )
+			{
+				It.RemoveCurrent();
+			}
+		}
+		UE_LOG( LogIoStoreTools, Display, TEXT("Selected %d Packages matching the filter"), SelectedPackages->Num() );
+	}
+
+	// Imports that cannot be resolved would make the package writer fail, so find all of them upfront instead of failing on the first one
+	const int32 NumDanglingImports = PackageMap->ReportDanglingImports( SelectedPackages.GetPtrOrNull() );
+	if ( NumDanglingImports != 0 )
+	{
+		UE_LOG( LogIoStoreTools, Error, TEXT("Found %d imports that cannot be resolved to an export of any package in the Containers. Make sure all Containers the packages depend on are present in '%s'"), NumDanglingImports, *ContainerDirPath );
+		return false;
+	}
+
+	const FAllocationCounters AllocationsBeforeWriting = MallocCountingProxy ? MallocCountingProxy->GetCounters() : FAllocationCounters{};
+	if ( MallocCountingProxy )
 	{
-		PackageMap->PopulateFromContainer( Reader );
+		LogAllocationCounters( TEXT("Building Package Map"), AllocationsBeforeWriting - AllocationsBeforePackageMap );
 	}
-	UE_LOG( LogIoStoreTools, Display, TEXT("Populated Package Map with %d Packages"), PackageMap->GetTotalPackageCount() );
 
-	UE_LOG( LogIoStoreTools, Display, TEXT("Begin writing Cooked Packages to '%s'"), *OutputDirPath );
-	const TSharedPtr<FCookedAssetWriter> PackageWriter = MakeShared<FCookedAssetWriter>( PackageMap, OutputDirPath );
+	UE_LOG( LogIoStoreTools, Display, TEXT("Begin writing Cooked Packages to '%s' using %d threads"), *OutputDirPath, NumWorkerThreads );
+	TSharedPtr<IPackageOutputSink> OutputSink = IPackageOutputSink::CreateForOutputPath( OutputDirPath );
+	if ( WriteQueueSettings.NumIoThreads > 0 )
+	{
+		OutputSink = MakeShared<FWriteBehindPackageOutputSink>( OutputSink, WriteQueueSettings );
+	}
+	const TSharedPtr<FCookedAssetWriter> PackageWriter = MakeShared<FCookedAssetWriter>( PackageMap, OutputDirPath, OutputSink, NumWorkerThreads );
+
+	if ( PrefetchDepth > 0 )
+	{
+		PackageWriter->SetMaxChunkReadsInFlight( PrefetchDepth );
+	}
+
+	if ( bMemoryMapContainers )
+	{
+		int32 NumMappedContainers = 0;
+		for ( int32 ContainerIndex = 0; ContainerIndex < ContainerReaders.Num(); ContainerIndex++ )
+		{
+			const FString ContainerPath = FPaths::ChangeExtension( FPaths::Combine( ContainerDirPath, ContainerTableOfContentsFiles[ ContainerIndex ] ), TEXT("") );
+			if ( const TSharedPtr<FMappedIoStoreContainer> MappedContainer = FMappedIoStoreContainer::TryCreate( ContainerReaders[ ContainerIndex ], ContainerPath ) )
+			{
+				PackageWriter->SetMappedContainer( ContainerReaders[ ContainerIndex ]->GetContainerId(), MappedContainer );
+				NumMappedContainers++;
+			}
+		}
+		UE_LOG( LogIoStoreTools, Display, TEXT("Memory mapped %d unencrypted Container files, their uncompressed chunks will be copied directly"), NumMappedContainers );
+	}
+
+	if ( SelectedPackages.IsSet() )
+	{
+		PackageWriter->SetSelectedPackages( MoveTemp( SelectedPackages.GetValue() ) );
+	}
+
+	if ( bIncremental )
+	{
+		PackageWriter->EnableIncrementalExtraction( ContainerReaders );
+	}
+
+	if ( bDeduplicateBulkData )
+	{
+		PackageWriter->EnableBulkDataDeduplication();
+	}
+
+	PackageWriter->PrepareOutputDirectories( ContainerReaders );
 
 	for ( const TSharedPtr<FIoStoreReader>& Reader : ContainerReaders )
 	{
@@ -129,8 +377,32 @@ bool FIOStoreTools::ExtractPackagesFromContainers( const FString& ContainerDirPa
 	}
 	
 	UE_LOG( LogIoStoreTools, Display, TEXT("Done writing %d packages."), PackageWriter->GetTotalNumPackagesWritten() );
+	if ( bIncremental )
+	{
+		UE_LOG( LogIoStoreTools, Display, TEXT("Skipped %d packages that have not changed since the previous extraction."), PackageWriter->GetTotalNumPackagesUnchanged() );
+	}
+	if ( MallocCountingProxy )
+	{
+		LogAllocationCounters( TEXT("Writing Packages"), MallocCountingProxy->GetCounters() - AllocationsBeforeWriting );
+	}
 
+	if ( bIncremental )
+	{
+		PackageWriter->RecordPackagesFromPreviousExtraction();
+	}
+	PackageWriter->CreateDeduplicatedBulkDataLinks();
 	PackageWriter->WritePackageStoreManifest();
+	if ( bWriteBinaryManifest )
+	{
+		PackageWriter->WriteBinaryPackageStoreManifest();
+	}
+	PackageWriter->FinalizeOutput();
+	PackageWriter->LogPipelineStatistics();
+
+	if ( bIncremental )
+	{
+		PackageWriter->WriteExtractionState();
+	}
 	return true;
 }
 
@@ -141,14 +413,14 @@ bool FIOStoreTools::ExecuteIOStoreTools(const TCHAR* Cmd)
 		FString ContainerFolderPath;
 		if ( !FParse::Token( Cmd, ContainerFolderPath, false ) )
 		{
-			UE_LOG( LogIoStoreTools, Display, TEXT("Usage: ZenTools ExtractPackages <ContainerFolderPath> <ExtractionDir> [--EncryptionKeys=<KeyFile>]") );
+			UE_LOG( LogIoStoreTools, Display, TEXT("Usage: ZenTools ExtractPackages <ContainerFolderPath> <ExtractionDirOrArchive> [-EncryptionKeys=<KeyFile>] [-Threads=<NumThreads>] [-PackageMapCache=<CacheDir>] [-Incremental] [-Include=<Patterns>] [-Exclude=<Patterns>] [-WithDependencies] [-IOThreads=<NumThreads>] [-WriteQueueDepth=<NumFiles>] [-WriteQueueMemoryMB=<Megabytes>] [-PrefetchDepth=<NumReads>] [-NoMemoryMapping] [-DeduplicateBulkData] [-BinaryManifest] [-AllocStats]") );
 			return false;
 		}
 
 		FString ExtractFolderRootPath;
 		if ( !FParse::Token( Cmd, ExtractFolderRootPath, false ) )
 		{
-			UE_LOG( LogIoStoreTools, Display, TEXT("Usage: ZenTools ExtractPackages <ContainerFolderPath> <ExtractionDir> [-EncryptionKeys=<KeyFile>]") );
+			UE_LOG( LogIoStoreTools, Display, TEXT("Usage: ZenTools ExtractPackages <ContainerFolderPath> <ExtractionDirOrArchive> [-EncryptionKeys=<KeyFile>] [-Threads=<NumThreads>] [-PackageMapCache=<CacheDir>] [-Incremental] [-Include=<Patterns>] [-Exclude=<Patterns>] [-WithDependencies] [-IOThreads=<NumThreads>] [-WriteQueueDepth=<NumFiles>] [-WriteQueueMemoryMB=<Megabytes>] [-PrefetchDepth=<NumReads>] [-NoMemoryMapping] [-DeduplicateBulkData] [-BinaryManifest] [-AllocStats]") );
 			return false;
 		}
 
@@ -157,16 +429,72 @@ bool FIOStoreTools::ExecuteIOStoreTools(const TCHAR* Cmd)
 		{
 			EncryptionKeysFile = FPaths::ConvertRelativePathToFull( EncryptionKeysFile );
 		}
+
+		FString PackageMapCacheDir;
+		if ( FParse::Value( Cmd, TEXT("-PackageMapCache="), PackageMapCacheDir ) )
+		{
+			PackageMapCacheDir = FPaths::ConvertRelativePathToFull( PackageMapCacheDir );
+		}
+
+		const bool bIncremental = FParse::Param( Cmd, TEXT("Incremental") );
+		if ( bIncremental && IPackageOutputSink::IsArchiveOutputPath( ExtractFolderRootPath ) )
+		{
+			UE_LOG( LogIoStoreTools, Display, TEXT("-Incremental can only be used when extracting into a directory, not into an archive") );
+			return false;
+		}
+
+		// Deduplicated files are hard links, so writing the package again in place would change all other files linked to it
+		const bool bDeduplicateBulkData = FParse::Param( Cmd, TEXT("DeduplicateBulkData") );
+		if ( bDeduplicateBulkData && bIncremental )
+		{
+			UE_LOG( LogIoStoreTools, Display, TEXT("-DeduplicateBulkData cannot be used together with -Incremental") );
+			return false;
+		}
+
+		// Binary manifest is written in addition to the JSON one
+		const bool bWriteBinaryManifest = FParse::Param( Cmd, TEXT("BinaryManifest") );
+
+		// Include and exclude patterns are comma separated lists of package names or file paths
+		FString IncludePatterns;
+		FString ExcludePatterns;
+		FParse::Value( Cmd, TEXT("-Include="), IncludePatterns, false );
+		FParse::Value( Cmd, TEXT("-Exclude="), ExcludePatterns, false );
+		const FPackageFilter PackageFilter( IncludePatterns, ExcludePatterns, FParse::Param( Cmd, TEXT("WithDependencies") ) );
+
+		// Packages are written on a single thread unless asked otherwise. 0 means one thread per logical core
+		int32 NumWorkerThreads = 1;
+		if ( FParse::Value( Cmd, TEXT("-Threads="), NumWorkerThreads ) && NumWorkerThreads <= 0 )
+		{
+			NumWorkerThreads = FPlatformMisc::NumberOfCoresIncludingHyperthreads();
+		}
+
+		// Files are written by the dedicated I/O threads while the packages are being processed. -IOThreads=0 writes them on the package writer threads instead
+		FPackageWriteQueueSettings WriteQueueSettings;
+		FParse::Value( Cmd, TEXT("-IOThreads="), WriteQueueSettings.NumIoThreads );
+		FParse::Value( Cmd, TEXT("-WriteQueueDepth="), WriteQueueSettings.MaxQueuedFiles );
+		int32 WriteQueueMemoryMB = 0;
+		if ( FParse::Value( Cmd, TEXT("-WriteQueueMemoryMB="), WriteQueueMemoryMB ) )
+		{
+			WriteQueueSettings.MaxQueuedBytes = FMath::Max( WriteQueueMemoryMB, 1 ) * 1024ll * 1024ll;
+		}
+		WriteQueueSettings.MaxQueuedFiles = FMath::Max( WriteQueueSettings.MaxQueuedFiles, 1 );
+
+		// Package chunks are read ahead of the packages being written, in the order of their offsets in the container
+		int32 PrefetchDepth = 0;
+		FParse::Value( Cmd, TEXT("-PrefetchDepth="), PrefetchDepth );
+
+		// Unencrypted containers are memory mapped, and their uncompressed chunks are copied straight from the mapping
+		const bool bMemoryMapContainers = !FParse::Param( Cmd, TEXT("NoMemoryMapping") );
 		
 		ContainerFolderPath = FPaths::ConvertRelativePathToFull( ContainerFolderPath );
 		ExtractFolderRootPath = FPaths::ConvertRelativePathToFull( ExtractFolderRootPath );
 		
 		UE_LOG( LogIoStoreTools, Display, TEXT("Extracting packages from IoStore containers at '%s' to directory '%s'"), *ContainerFolderPath, *ExtractFolderRootPath );
 
-		return ExtractPackagesFromContainers( ContainerFolderPath, ExtractFolderRootPath, EncryptionKeysFile );
+		return ExtractPackagesFromContainers( ContainerFolderPath, ExtractFolderRootPath, EncryptionKeysFile, PackageMapCacheDir, NumWorkerThreads, bIncremental, PackageFilter, WriteQueueSettings, PrefetchDepth, bMemoryMapContainers, bDeduplicateBulkData, bWriteBinaryManifest );
 	}
 
 	UE_LOG( LogIoStoreTools, Display, TEXT("Unknown command. Available commands: ") );
-	UE_LOG( LogIoStoreTools, Display, TEXT("ZenTools ExtractPackages <ContainerFolderPath> <ExtractionDir> [-EncryptionKeys=<KeyFile>] -- Extract packages from the IoStore containers in the provided folder") );
+	UE_LOG( LogIoStoreTools, Display, TEXT("ZenTools ExtractPackages <ContainerFolderPath> <ExtractionDirOrArchive> [-EncryptionKeys=<KeyFile>] [-Threads=<NumThreads>] [-PackageMapCache=<CacheDir>] [-Incremental] [-Include=<Patterns>] [-Exclude=<Patterns>] [-WithDependencies] [-IOThreads=<NumThreads>] [-WriteQueueDepth=<NumFiles>] [-WriteQueueMemoryMB=<Megabytes>] [-PrefetchDepth=<NumReads>] [-NoMemoryMapping] [-DeduplicateBulkData] [-BinaryManifest] [-AllocStats] -- Extract packages from the IoStore containers in the provided folder") );
 	return false;
 }
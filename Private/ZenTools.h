@@ -6,9 +6,12 @@
 
 DECLARE_LOG_CATEGORY_EXTERN( LogIoStoreTools, All, All );
 
+class FPackageFilter;
+struct FPackageWriteQueueSettings;
+
 class ZENTOOLS_API FIOStoreTools
 {
 public:
 	static bool ExecuteIOStoreTools( const TCHAR* Cmd );
-	static bool ExtractPackagesFromContainers( const FString& ContainerDirPath, const FString& OutputDirPath, const FString& EncryptionKeysFile );
+	static bool ExtractPackagesFromContainers( const FString& ContainerDirPath, const FString& OutputDirPath, const FString& EncryptionKeysFile, const FString& PackageMapCacheDir, int32 NumWorkerThreads, bool bIncremental, const FPackageFilter& PackageFilter, const FPackageWriteQueueSettings& WriteQueueSettings, int32 PrefetchDepth, bool bMemoryMapContainers, bool bDeduplicateBulkData, bool bWriteBinaryManifest );
 };
\ No newline at end of file